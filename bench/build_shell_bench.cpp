@@ -0,0 +1,296 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "configuration.h"
+#include "build_environment.h"
+#include "buildset_tree_builder.h"
+#include "env_script_builder.h"
+#include "tree_builder.h"
+#include "tree_writer.h"
+#include "json_tree.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Times the parts of build_shell that grow with the size of the buildset,
+// on generated buildsets, and prints the results as json
+//
+//    build_shell_bench [--samples n] [--min-time seconds] [projects ...]
+//
+// The default sizes are 10, 100, 1000 and 10000 projects. Each benchmark
+// repeats its operation until a sample takes at least --min-time, and
+// reports the fastest and the median time per operation of the samples
+
+struct Options
+{
+    Options()
+        : samples(5)
+        , min_time(0.05)
+    { }
+    int samples;
+    double min_time;
+    std::vector<size_t> sizes;
+};
+
+struct Result
+{
+    std::string name;
+    size_t projects;
+    size_t iterations;
+    double min_us;
+    double median_us;
+};
+
+static double timeIterations(const std::function<void()> &operation, size_t iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++)
+        operation();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+static Result measure(const Options &options, const std::string &name, size_t projects,
+                      const std::function<void()> &operation)
+{
+    // The first run warms the caches and gives an estimate of how many
+    // iterations make up a sample
+    double once = timeIterations(operation, 1);
+    size_t iterations = 1;
+    if (once < options.min_time)
+        iterations = std::min<size_t>(1000000, options.min_time / std::max(once, 1e-7) + 1);
+
+    std::vector<double> samples;
+    for (int i = 0; i < options.samples; i++)
+        samples.push_back(timeIterations(operation, iterations) / iterations * 1e6);
+    std::sort(samples.begin(), samples.end());
+
+    Result result;
+    result.name = name;
+    result.projects = projects;
+    result.iterations = iterations;
+    result.min_us = samples.front();
+    result.median_us = samples[samples.size() / 2];
+    return result;
+}
+
+// Projects look like the ones in examples/: an scm, configure_args using
+// variables, and every tenth project adds to the environment
+static std::string generateBuildset(size_t projects)
+{
+    std::string buildset = "{\n";
+    for (size_t i = 0; i < projects; i++) {
+        std::string name = "project_" + std::to_string(i);
+        buildset += "    \"" + name + "\" : {\n"
+            "        \"scm\" : {\n"
+            "            \"type\" : \"git\",\n"
+            "            \"url\" : \"git://git.example.org/" + name + "\",\n"
+            "            \"branch\" : \"master\",\n"
+            "            \"remote\" : \"origin\",\n"
+            "            \"remote_branch\" : \"master\"\n"
+            "        },\n";
+        if (i % 10 == 0) {
+            buildset +=
+            "        \"env\" : {\n"
+            "            \"post\" : {\n"
+            "                \"ACLOCAL\" : {\n"
+            "                    \"value\" : \"aclocal -I ${install_path}/share/aclocal\",\n"
+            "                    \"overwrite\" : true\n"
+            "                },\n"
+            "                \"BS_VIM_SEARCH_PATH\" : {\n"
+            "                    \"value\" : \"${project_src_path}/src/**\",\n"
+            "                    \"seperator\" : \",\"\n"
+            "                }\n"
+            "            }\n"
+            "        },\n";
+        }
+        if (i > 0)
+            buildset += "        \"depends_on\" : \"project_" + std::to_string(i - 1) + "\",\n";
+        buildset += "        \"configure_args\" : \"--prefix=${install_path} --with-sources=${project_src_path} --enable-feature-" + std::to_string(i) + "\"\n";
+        buildset += i + 1 < projects ? "    },\n" : "    }\n";
+    }
+    buildset += "}\n";
+    return buildset;
+}
+
+static bool writeFile(const std::string &file, const std::string &content)
+{
+    FILE *out = fopen(file.c_str(), "we");
+    if (!out) {
+        fprintf(stderr, "Failed to open %s : %s\n", file.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = fwrite(content.data(), 1, content.size(), out) == content.size();
+    return fclose(out) == 0 && ok;
+}
+
+static bool benchmarkBuildset(const Options &options, const std::string &dir, size_t projects,
+                              std::vector<Result> &results)
+{
+    const std::string buildset_file = dir + "/buildset";
+    const std::string build_dir = dir + "/build";
+    const std::string out_file = dir + "/written.json";
+    mkdir(build_dir.c_str(), S_IRWXU);
+    mkdir((build_dir + "/build_shell").c_str(), S_IRWXU);
+    if (!writeFile(buildset_file, generateBuildset(projects)))
+        return false;
+
+    Configuration configuration;
+    configuration.setMode(Configuration::Build, "build");
+    configuration.setBuildsetFile(buildset_file.c_str());
+    configuration.setBuildDir(build_dir.c_str());
+    configuration.validate();
+    if (!configuration.sane()) {
+        fprintf(stderr, "Failed to set up configuration for %s\n", buildset_file.c_str());
+        return false;
+    }
+
+    BuildEnvironment build_environment(configuration);
+
+    std::vector<std::string> project_names;
+    std::vector<std::string> configure_args;
+    std::unique_ptr<JT::ObjectNode> buildset;
+    {
+        BuildsetTreeBuilder builder(build_environment, buildset_file, false, true);
+        if (builder.error()) {
+            fprintf(stderr, "Failed to load generated buildset %s\n", buildset_file.c_str());
+            return false;
+        }
+        buildset.reset(builder.treeBuilder.takeRootNode());
+    }
+    {
+        TreeBuilder builder(buildset_file);
+        if (!builder.load())
+            return false;
+        JT::ObjectNode *root = builder.rootNode();
+        for (auto it = root->begin(); it != root->end(); ++it) {
+            project_names.push_back(it->first.string());
+            JT::ObjectNode *project = it->second->asObjectNode();
+            configure_args.push_back(project ? project->stringAt("configure_args") : std::string());
+        }
+    }
+
+    results.push_back(measure(options, "tree_builder_load", projects, [&] {
+        TreeBuilder builder(buildset_file);
+        builder.load();
+    }));
+
+    results.push_back(measure(options, "buildset_tree_builder_load", projects, [&] {
+        BuildsetTreeBuilder builder(build_environment, buildset_file, false, true);
+    }));
+
+    results.push_back(measure(options, "find_variables", projects, [&] {
+        for (auto it = configure_args.begin(); it != configure_args.end(); ++it)
+            BuildEnvironment::findVariables(it->c_str(), it->size());
+    }));
+
+    results.push_back(measure(options, "expand_variables_in_string", projects, [&] {
+        for (size_t i = 0; i < configure_args.size(); i++)
+            build_environment.expandVariablesInString(configure_args[i], project_names[i]);
+    }));
+
+    // make_variable_list_for is reached through variables. A new builder is
+    // used every time, so the prefix is built along the whole buildset too
+    results.push_back(measure(options, "make_variable_list_for", projects, [&] {
+        EnvScriptBuilder builder(configuration, build_environment, buildset.get());
+        builder.setToProject(project_names.back());
+        std::list<EnvVariable> variables = builder.variables();
+        EnvScriptBuilder::Environment environment;
+        if (!EnvScriptBuilder::expandsInShell(variables))
+            EnvScriptBuilder::applyEnvironment(configuration, variables, configuration.buildDir(), environment);
+    }));
+
+    results.push_back(measure(options, "tree_writer_write", projects, [&] {
+        int file = open(out_file.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, S_IRUSR|S_IWUSR);
+        TreeWriter writer(file, true);
+        writer.write(buildset.get());
+    }));
+
+    results.push_back(measure(options, "find_script", projects, [&] {
+        for (auto it = project_names.begin(); it != project_names.end(); ++it)
+            configuration.findScript("configure_" + *it, "cmake_configure");
+    }));
+
+    unlink(out_file.c_str());
+    return true;
+}
+
+static void removeTree(const std::string &dir)
+{
+    std::string command = "rm -rf '" + dir + "'";
+    if (system(command.c_str()))
+        fprintf(stderr, "Failed to remove %s\n", dir.c_str());
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            options.samples = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            options.min_time = atof(argv[++i]);
+        } else {
+            options.sizes.push_back(strtoul(argv[i], nullptr, 10));
+        }
+    }
+    if (options.sizes.empty())
+        options.sizes = { 10, 100, 1000, 10000 };
+
+    char dir_template[] = "/tmp/build_shell_bench.XXXXXX";
+    if (!mkdtemp(dir_template)) {
+        fprintf(stderr, "Failed to create temporary directory : %s\n", strerror(errno));
+        return 1;
+    }
+    const std::string dir = dir_template;
+
+    std::vector<Result> results;
+    bool ok = true;
+    for (auto it = options.sizes.begin(); ok && it != options.sizes.end(); ++it) {
+        if (*it == 0)
+            continue;
+        fprintf(stderr, "Benchmarking buildset with %zu projects\n", *it);
+        ok = benchmarkBuildset(options, dir, *it, results);
+    }
+    removeTree(dir);
+
+    fprintf(stdout, "{\n    \"samples\": %d,\n    \"benchmarks\": [\n", options.samples);
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &result = results[i];
+        fprintf(stdout, "        { \"name\": \"%s\", \"projects\": %zu, \"iterations\": %zu, \"min_us\": %.3f, \"median_us\": %.3f }%s\n",
+                result.name.c_str(), result.projects, result.iterations, result.min_us, result.median_us,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(stdout, "    ]\n}\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "child_process_io_handler.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/wait.h>
+
+#include <chrono>
+#include <string>
+
+// Starts a child writing make like output and measures how fast the
+// ChildProcessIoHandler moves it into a log file, and optionally to stdout
+//
+//    child_output_bench [megabytes] [log file] [--print]
+
+static void spew(size_t bytes)
+{
+    std::string chunk;
+    int line = 0;
+    while (chunk.size() < 4096) {
+        chunk += "g++ -c -O2 -Isrc -Iinclude -o build/object_" + std::to_string(line++) +
+            ".o src/some/deeply/nested/source_file.cpp\n";
+    }
+    size_t written = 0;
+    while (written < bytes) {
+        ssize_t w = write(STDOUT_FILENO, chunk.data(), chunk.size());
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            _exit(1);
+        }
+        written += w;
+    }
+    _exit(0);
+}
+
+int main(int argc, char **argv)
+{
+    size_t megabytes = 512;
+    std::string log_file = "child_output_bench.log";
+    bool print = false;
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--print") == 0) {
+            print = true;
+        } else if (positional++ == 0) {
+            megabytes = strtoul(argv[i], nullptr, 10);
+        } else {
+            log_file = argv[i];
+        }
+    }
+
+    int out_file = open(log_file.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (out_file < 0) {
+        fprintf(stderr, "Failed to open log file %s : %s\n", log_file.c_str(), strerror(errno));
+        return 1;
+    }
+
+    const std::string phase = "bench";
+    const std::string project = "child_output";
+    auto start = std::chrono::steady_clock::now();
+    int child_status = 0;
+    {
+        ChildProcessIoHandler handler(phase, project, out_file);
+        if (handler.error())
+            return 1;
+        handler.setPrintStdOut(print);
+        handler.setUseRoller(false);
+
+        pid_t child = fork();
+        if (child == 0) {
+            handler.setupChildProcessState();
+            spew(megabytes * 1024 * 1024);
+        }
+        handler.setupMasterProcessState();
+        while (waitpid(child, &child_status, 0) < 0 && errno == EINTR)
+            ;
+    }
+    auto end = std::chrono::steady_clock::now();
+    close(out_file);
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    fprintf(stderr, "{ \"megabytes\": %zu, \"print\": %s, \"seconds\": %.3f, \"megabytes_per_second\": %.1f }\n",
+            megabytes, print ? "true" : "false", seconds, megabytes / seconds);
+    unlink(log_file.c_str());
+    return WEXITSTATUS(child_status);
+}
@@ -0,0 +1,494 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "json_tokenizer.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// Measures the throughput of jsonmod on generated files and prints the
+// results as json
+//
+//    jsonmod_bench [--samples n] [--min-time seconds] [--jsonmod path]
+//                  [--baseline file] [--max-regression percent]
+//                  [--write-baseline file] [kbytes ...]
+//
+// The default sizes are 1 KB, 64 KB, 1 MB, 16 MB and 100 MB. Every size is
+// generated as a wide file, many small objects next to each other, and as a
+// deep file, chains of nested objects, both with strict json and with the
+// relaxed syntax jsonmod accepts without --strict. For each file a query,
+// an inline set, a create-object and a pretty and a compact reprint are
+// timed. A sample runs jsonmod until it took at least --min-time, the best
+// and the median MB/s of the samples are reported.
+//
+// With --baseline the results are compared to the ones in the file, and the
+// exit code is 1 if the best MB/s of a benchmark dropped more than
+// --max-regression percent. When the file does not exist nothing is run and
+// the exit code is 77, which the jsonmod_throughput test reports as skipped.
+// --write-baseline writes the results to a file to compare later runs with.
+
+static const int DEEP_LEVELS = 32;
+
+struct Options
+{
+    Options()
+        : samples(5)
+        , min_time(0.2)
+        , jsonmod("jsonmod")
+        , max_regression(25)
+    { }
+    int samples;
+    double min_time;
+    std::string jsonmod;
+    std::string baseline;
+    std::string write_baseline;
+    double max_regression;
+    std::vector<size_t> sizes;
+};
+
+struct Result
+{
+    std::string key() const { return name + " " + shape + " " + syntax + " " + std::to_string(bytes); }
+
+    std::string name;
+    std::string shape;
+    std::string syntax;
+    size_t bytes;
+    size_t iterations;
+    double mb_per_s;
+    double median_mb_per_s;
+};
+
+struct Input
+{
+    std::string shape;
+    bool strict;
+    std::string file;
+    size_t bytes;
+    std::string last_property;
+    std::string new_object;
+};
+
+// Returns the wall time of running jsonmod with arguments, or a negative
+// value if it could not be started or failed
+static double runJsonmod(const Options &options, const std::vector<std::string> &arguments)
+{
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>(options.jsonmod.c_str()));
+    for (auto it = arguments.begin(); it != arguments.end(); ++it)
+        argv.push_back(const_cast<char *>(it->c_str()));
+    argv.push_back(nullptr);
+
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Failed to fork : %s\n", strerror(errno));
+        return -1;
+    }
+    if (pid == 0) {
+        int null_file = open("/dev/null", O_WRONLY);
+        if (null_file >= 0)
+            dup2(null_file, STDOUT_FILENO);
+        execvp(argv[0], argv.data());
+        fprintf(stderr, "Failed to start %s : %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    auto end = std::chrono::steady_clock::now();
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s %s failed\n", options.jsonmod.c_str(), arguments.front().c_str());
+        return -1;
+    }
+    return std::chrono::duration<double>(end - start).count();
+}
+
+static bool readFile(const std::string &file, std::string &content)
+{
+    FILE *in = fopen(file.c_str(), "re");
+    if (!in)
+        return false;
+    char buffer[4096];
+    size_t read_bytes;
+    content.clear();
+    while ((read_bytes = fread(buffer, 1, sizeof buffer, in)) > 0)
+        content.append(buffer, read_bytes);
+    fclose(in);
+    return true;
+}
+
+static bool writeFile(const std::string &file, const std::string &content)
+{
+    FILE *out = fopen(file.c_str(), "we");
+    if (!out) {
+        fprintf(stderr, "Failed to open %s : %s\n", file.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = fwrite(content.data(), 1, content.size(), out) == content.size();
+    return fclose(out) == 0 && ok;
+}
+
+// prepare is run before every jsonmod run, and is not part of the time
+static bool measure(const Options &options, const std::string &name, const Input &input,
+                    const std::vector<std::string> &arguments, const std::function<bool()> &prepare,
+                    std::vector<Result> &results)
+{
+    auto runOnce = [&]() -> double {
+        if (prepare && !prepare())
+            return -1;
+        return runJsonmod(options, arguments);
+    };
+
+    double once = runOnce();
+    if (once < 0)
+        return false;
+    size_t iterations = 1;
+    if (once < options.min_time)
+        iterations = std::min<size_t>(10000, options.min_time / std::max(once, 1e-6) + 1);
+
+    std::vector<double> samples;
+    for (int i = 0; i < options.samples; i++) {
+        double total = 0;
+        for (size_t j = 0; j < iterations; j++) {
+            double time = runOnce();
+            if (time < 0)
+                return false;
+            total += time;
+        }
+        samples.push_back(input.bytes / (total / iterations) / (1024 * 1024));
+    }
+    std::sort(samples.begin(), samples.end());
+
+    Result result;
+    result.name = name;
+    result.shape = input.shape;
+    result.syntax = input.strict ? "strict" : "relaxed";
+    result.bytes = input.bytes;
+    result.iterations = iterations;
+    result.mb_per_s = samples.back();
+    result.median_mb_per_s = samples[samples.size() / 2];
+    results.push_back(result);
+    return true;
+}
+
+// Relaxed files separate members with new lines instead of commas, and
+// leave a comma after the last element of arrays
+static void appendMember(std::string &json, const std::string &indent, const std::string &name,
+                         const std::string &value, bool last, bool strict)
+{
+    json += indent + "\"" + name + "\" : " + value;
+    json += (strict && !last) ? ",\n" : "\n";
+}
+
+static std::string array(bool strict)
+{
+    return strict ? "[ 1, 2, 3, \"four\", true, null ]" : "[ 1, 2, 3, \"four\", true, null, ]";
+}
+
+static void appendWideMember(std::string &json, size_t i, bool last, bool strict)
+{
+    std::string name = "member_" + std::to_string(i);
+    json += "    \"" + name + "\" : {\n";
+    json += "        \"scm\" : {\n";
+    appendMember(json, "            ", "type", "\"git\"", false, strict);
+    appendMember(json, "            ", "url", "\"git://git.example.org/" + name + "\"", false, strict);
+    appendMember(json, "            ", "branch", "\"master\"", true, strict);
+    json += strict ? "        },\n" : "        }\n";
+    appendMember(json, "        ", "list", array(strict), false, strict);
+    appendMember(json, "        ", "count", std::to_string(i), false, strict);
+    appendMember(json, "        ", "enabled", "true", true, strict);
+    json += last ? "    }\n" : (strict ? "    },\n" : "    }\n");
+}
+
+static void appendDeepMember(std::string &json, size_t i, bool last, bool strict)
+{
+    std::string name = "tree_" + std::to_string(i);
+    json += "\"" + name + "\" : {\n";
+    for (int level = 0; level < DEEP_LEVELS; level++) {
+        appendMember(json, "", "name", "\"" + name + "_" + std::to_string(level) + "\"", false, strict);
+        appendMember(json, "", "list", array(strict), false, strict);
+        json += "\"level_" + std::to_string(level) + "\" : {\n";
+    }
+    appendMember(json, "", "value", "\"leaf\"", false, strict);
+    appendMember(json, "", "count", std::to_string(i), true, strict);
+    for (int level = 0; level < DEEP_LEVELS; level++)
+        json += "}\n";
+    json += last ? "}\n" : (strict ? "},\n" : "}\n");
+}
+
+static size_t memberSize(const std::string &shape, bool strict)
+{
+    std::string member;
+    if (shape == "wide")
+        appendWideMember(member, 0, false, strict);
+    else
+        appendDeepMember(member, 0, false, strict);
+    return member.size();
+}
+
+static bool generateInput(const std::string &dir, const std::string &shape, bool strict, size_t bytes,
+                          Input &input)
+{
+    size_t members = std::max<size_t>(1, bytes / memberSize(shape, strict));
+    std::string json = "{\n";
+    json.reserve(bytes + bytes / 8);
+    for (size_t i = 0; i < members; i++) {
+        if (shape == "wide")
+            appendWideMember(json, i, i + 1 == members, strict);
+        else
+            appendDeepMember(json, i, i + 1 == members, strict);
+    }
+    json += "}\n";
+
+    std::string last = std::to_string(members - 1);
+    input.shape = shape;
+    input.strict = strict;
+    input.file = dir + "/" + shape + (strict ? "_strict" : "_relaxed") + ".json";
+    input.bytes = json.size();
+    if (shape == "wide") {
+        input.last_property = "member_" + last + ".scm.url";
+        input.new_object = "member_" + last + ".scm.new_object";
+    } else {
+        input.last_property = "tree_" + last;
+        for (int level = 0; level < DEEP_LEVELS; level++)
+            input.last_property += ".level_" + std::to_string(level);
+        input.new_object = input.last_property + ".new_object";
+        input.last_property += ".value";
+    }
+    return writeFile(input.file, json);
+}
+
+static bool benchmarkInput(const Options &options, const std::string &dir, const Input &input,
+                           std::vector<Result> &results)
+{
+    std::vector<std::string> strict;
+    if (input.strict)
+        strict.push_back("--strict");
+    auto arguments = [&](std::vector<std::string> arguments) {
+        arguments.insert(arguments.end(), strict.begin(), strict.end());
+        arguments.push_back(input.file);
+        return arguments;
+    };
+
+    bool ok = measure(options, "query", input, arguments({ "-p", input.last_property }), nullptr, results)
+        && measure(options, "create_object", input, arguments({ "-o", input.new_object }), nullptr, results)
+        && measure(options, "reprint_pretty", input, arguments({ "--pretty" }), nullptr, results)
+        && measure(options, "reprint_compact", input, arguments({ "-c" }), nullptr, results);
+    if (!ok)
+        return false;
+
+    // The inline set rewrites the file, so every run starts from a copy of
+    // the generated one
+    std::string original;
+    if (!readFile(input.file, original))
+        return false;
+    Input copy = input;
+    copy.file = dir + "/inline.json";
+    std::vector<std::string> inline_arguments = { "-i", "-p", input.last_property, "-v", "bench_value" };
+    inline_arguments.insert(inline_arguments.end(), strict.begin(), strict.end());
+    inline_arguments.push_back(copy.file);
+    ok = measure(options, "inline_set", copy, inline_arguments, [&] {
+        return writeFile(copy.file, original);
+    }, results);
+    unlink(copy.file.c_str());
+    return ok;
+}
+
+static std::string tokenString(const JT::Data &data, JT::Token::Type type)
+{
+    if (type == JT::Token::String && data.size >= 2)
+        return std::string(data.data + 1, data.size - 2);
+    return std::string(data.data, data.size);
+}
+
+static bool readBaseline(const std::string &file, std::map<std::string, double> &baseline)
+{
+    std::string content;
+    if (!readFile(file, content))
+        return false;
+
+    JT::Tokenizer tokenizer;
+    tokenizer.addData(content.c_str(), content.size(), false);
+    JT::Token token;
+    JT::Error error;
+    int depth = 0;
+    std::map<std::string, std::string> benchmark;
+    while ((error = tokenizer.nextToken(&token)) == JT::Error::NoError) {
+        switch (token.value_type) {
+            case JT::Token::ObjectStart:
+            case JT::Token::ArrayStart:
+                depth++;
+                benchmark.clear();
+                break;
+            case JT::Token::ObjectEnd:
+            case JT::Token::ArrayEnd:
+                if (depth == 3) {
+                    Result result;
+                    result.name = benchmark["name"];
+                    result.shape = benchmark["shape"];
+                    result.syntax = benchmark["syntax"];
+                    result.bytes = strtoul(benchmark["bytes"].c_str(), nullptr, 10);
+                    baseline[result.key()] = atof(benchmark["mb_per_s"].c_str());
+                }
+                depth--;
+                break;
+            default:
+                if (depth == 3)
+                    benchmark[tokenString(token.name, token.name_type)] = tokenString(token.value, token.value_type);
+                break;
+        }
+    }
+    if (error != JT::Error::NeedMoreData || depth != 0) {
+        fprintf(stderr, "Failed to parse baseline %s\n", file.c_str());
+        return false;
+    }
+    return true;
+}
+
+static void printResults(FILE *out, const Options &options, const std::vector<Result> &results)
+{
+    fprintf(out, "{\n    \"samples\": %d,\n    \"benchmarks\": [\n", options.samples);
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &result = results[i];
+        fprintf(out, "        { \"name\": \"%s\", \"shape\": \"%s\", \"syntax\": \"%s\", \"bytes\": %zu, \"iterations\": %zu, \"mb_per_s\": %.3f, \"median_mb_per_s\": %.3f }%s\n",
+                result.name.c_str(), result.shape.c_str(), result.syntax.c_str(), result.bytes,
+                result.iterations, result.mb_per_s, result.median_mb_per_s,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "    ]\n}\n");
+}
+
+static bool compareToBaseline(const Options &options, const std::vector<Result> &results)
+{
+    std::map<std::string, double> baseline;
+    if (!readBaseline(options.baseline, baseline))
+        return false;
+
+    bool ok = true;
+    for (auto it = results.begin(); it != results.end(); ++it) {
+        auto base = baseline.find(it->key());
+        if (base == baseline.end() || base->second <= 0) {
+            fprintf(stderr, "No baseline for %s\n", it->key().c_str());
+            continue;
+        }
+        double change = (it->mb_per_s - base->second) / base->second * 100;
+        fprintf(stderr, "%-40s %10.3f MB/s %10.3f MB/s %+7.1f%%\n", it->key().c_str(),
+                base->second, it->mb_per_s, change);
+        if (-change > options.max_regression) {
+            fprintf(stderr, "%s dropped more than %.1f%%\n", it->key().c_str(), options.max_regression);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static void removeTree(const std::string &dir)
+{
+    std::string command = "rm -rf '" + dir + "'";
+    if (system(command.c_str()))
+        fprintf(stderr, "Failed to remove %s\n", dir.c_str());
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            options.samples = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            options.min_time = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--jsonmod") == 0 && i + 1 < argc) {
+            options.jsonmod = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            options.baseline = argv[++i];
+        } else if (strcmp(argv[i], "--max-regression") == 0 && i + 1 < argc) {
+            options.max_regression = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc) {
+            options.write_baseline = argv[++i];
+        } else {
+            options.sizes.push_back(strtoul(argv[i], nullptr, 10));
+        }
+    }
+    if (options.sizes.empty())
+        options.sizes = { 1, 64, 1024, 16 * 1024, 100 * 1024 };
+
+    if (!options.baseline.empty() && access(options.baseline.c_str(), F_OK) != 0) {
+        fprintf(stderr, "No baseline %s, write one with --write-baseline\n", options.baseline.c_str());
+        return 77;
+    }
+
+    char dir_template[] = "/tmp/jsonmod_bench.XXXXXX";
+    if (!mkdtemp(dir_template)) {
+        fprintf(stderr, "Failed to create temporary directory : %s\n", strerror(errno));
+        return 1;
+    }
+    const std::string dir = dir_template;
+
+    std::vector<Result> results;
+    bool ok = true;
+    for (auto size = options.sizes.begin(); ok && size != options.sizes.end(); ++size) {
+        if (*size == 0)
+            continue;
+        for (const char *shape : { "wide", "deep" }) {
+            for (bool strict : { true, false }) {
+                fprintf(stderr, "Benchmarking %s %s json of %zu KB\n", shape, strict ? "strict" : "relaxed", *size);
+                Input input;
+                ok = ok && generateInput(dir, shape, strict, *size * 1024, input)
+                    && benchmarkInput(options, dir, input, results);
+                unlink(input.file.c_str());
+            }
+        }
+    }
+    removeTree(dir);
+
+    printResults(stdout, options, results);
+    if (!ok)
+        return 1;
+
+    if (!options.write_baseline.empty()) {
+        FILE *out = fopen(options.write_baseline.c_str(), "we");
+        if (!out) {
+            fprintf(stderr, "Failed to write baseline %s : %s\n", options.write_baseline.c_str(), strerror(errno));
+            return 1;
+        }
+        printResults(out, options, results);
+        fclose(out);
+        fprintf(stderr, "Wrote baseline %s\n", options.write_baseline.c_str());
+    }
+
+    if (!options.baseline.empty())
+        return compareToBaseline(options, results) ? 0 : 1;
+    return 0;
+}
@@ -65,3 +65,11 @@ JT::ObjectNode::Iterator Action::endIterator(JT::ObjectNode *project_tree)
     }
     return project_tree->end();
 }
+
+std::vector<std::string> Action::selectedProjects() const
+{
+    std::vector<std::string> projects;
+    if (m_configuration.onlyOne() && m_configuration.buildFromProject().size())
+        projects.push_back(m_configuration.buildFromProject());
+    return projects;
+}
@@ -26,6 +26,8 @@
 
 #include "json_tree.h"
 
+#include <string>
+#include <vector>
 
 class Action
 {
@@ -39,6 +41,10 @@ public:
 
     JT::ObjectNode::Iterator startIterator(JT::ObjectNode *project_tree);
     JT::ObjectNode::Iterator endIterator(JT::ObjectNode *project_tree);
+
+    // The project the action works on when it is known before the buildset
+    // is parsed, so only that project has to be parsed. Empty otherwise
+    std::vector<std::string> selectedProjects() const;
 protected:
     const Configuration &m_configuration;
     bool m_error;
@@ -23,6 +23,8 @@
 
 #include <iostream>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <sys/stat.h>
 #include <errno.h>
@@ -46,6 +48,84 @@ option::ArgStatus Arg::requiresArg(const option::Option &option, bool msg)
     return option::ARG_ILLEGAL;
 }
 
+option::ArgStatus Arg::requiresPositiveNumber(const option::Option &option, bool msg)
+{
+    if (option.arg != 0) {
+        char *end = 0;
+        long number = strtol(option.arg, &end, 10);
+        if (end != option.arg && *end == '\0' && number > 0)
+            return option::ARG_OK;
+    }
+
+    if (msg)
+        printError("Option '", option, "' requires a positive number\n");
+
+    return option::ARG_ILLEGAL;
+}
+
+option::ArgStatus Arg::requiresSize(const option::Option &option, bool msg)
+{
+    unsigned long long size;
+    if (option.arg != 0 && parseSize(option.arg, &size))
+        return option::ARG_OK;
+
+    if (msg)
+        printError("Option '", option, "' requires a size like 500M or 20G\n");
+
+    return option::ARG_ILLEGAL;
+}
+
+option::ArgStatus Arg::requiresJobServerType(const option::Option &option, bool msg)
+{
+    Configuration::JobServerType type;
+    if (option.arg != 0 && parseJobServerType(option.arg, &type))
+        return option::ARG_OK;
+
+    if (msg)
+        printError("Option '", option, "' requires one of auto, fifo or pipe\n");
+
+    return option::ARG_ILLEGAL;
+}
+
+bool Arg::parseJobServerType(const char *arg, Configuration::JobServerType *type)
+{
+    for (int i = 0; i < Configuration::JobServerTypeSize; i++) {
+        if (strcmp(arg, Configuration::JobServerTypeStringMap[i]) == 0) {
+            *type = Configuration::JobServerType(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Arg::parseSize(const char *arg, unsigned long long *size)
+{
+    char *end = 0;
+    unsigned long long number = strtoull(arg, &end, 10);
+    if (end == arg)
+        return false;
+
+    switch (*end) {
+    case 'G': case 'g':
+        number *= 1024;
+        // fall through
+    case 'M': case 'm':
+        number *= 1024;
+        // fall through
+    case 'K': case 'k':
+        number *= 1024;
+        end++;
+        break;
+    default:
+        break;
+    }
+    if (*end != '\0')
+        return false;
+
+    *size = number;
+    return true;
+}
+
 option::ArgStatus Arg::requiresExistingFile(const option::Option &option, bool msg)
 {
     struct stat stat_buf;
@@ -24,12 +24,19 @@
 
 #include "../3rdparty/optionparser/src/optionparser.h"
 
+#include "configuration.h"
+
 class Arg
 {
 public:
 
     static void printError(const char* msg1, const option::Option& opt, const char* msg2);
     static option::ArgStatus requiresArg(const option::Option &option, bool msg);
+    static option::ArgStatus requiresPositiveNumber(const option::Option &option, bool msg);
+    static option::ArgStatus requiresSize(const option::Option &option, bool msg);
+    static option::ArgStatus requiresJobServerType(const option::Option &option, bool msg);
+    static bool parseJobServerType(const char *arg, Configuration::JobServerType *type);
+    static bool parseSize(const char *arg, unsigned long long *size);
     static option::ArgStatus requiresExistingFile(const option::Option &option, bool msg);
     static option::ArgStatus requiresNonExistingFile(const option::Option &option, bool msg);
     static option::ArgStatus requiresExistingDir(const option::Option &option, bool msg);
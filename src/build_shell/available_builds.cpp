@@ -156,6 +156,7 @@ void AvailableBuilds::flushTreeToFile(JT::ObjectNode *root) const
 JT::ObjectNode *AvailableBuilds::rootNode() const
 {
     TreeBuilder tree(m_available_builds_file);
+    tree.setUseSnapshot(true);
     tree.load();
     return tree.takeRootNode();
 }
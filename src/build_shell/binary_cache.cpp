@@ -0,0 +1,366 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "binary_cache.h"
+
+#include "tree_builder.h"
+#include "tree_writer.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <vector>
+
+static bool run_command(const std::vector<std::string> &arguments)
+{
+    std::vector<char *> argv;
+    for (auto it = arguments.begin(); it != arguments.end(); ++it) {
+        argv.push_back(const_cast<char *>(it->c_str()));
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Failed to fork for %s : %s\n", argv[0], strerror(errno));
+        return false;
+    }
+    if (pid == 0) {
+        execvp(argv[0], &argv[0]);
+        fprintf(stderr, "Failed to execute %s : %s\n", argv[0], strerror(errno));
+        _exit(1);
+    }
+
+    int status;
+    pid_t wpid;
+    do {
+        wpid = waitpid(pid, &status, 0);
+    } while (wpid < 0 && errno == EINTR);
+    return wpid == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+class CacheLock
+{
+public:
+    CacheLock(const std::string &cache_dir)
+        : m_fd(open((cache_dir + "/lock").c_str(), O_RDWR|O_CREAT|O_CLOEXEC, S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP))
+    {
+        if (m_fd >= 0)
+            while (flock(m_fd, LOCK_EX) && errno == EINTR);
+    }
+    ~CacheLock()
+    {
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+private:
+    int m_fd;
+};
+
+BinaryCache::BinaryCache(const Configuration &configuration)
+    : m_configuration(configuration)
+    , m_hits(0)
+    , m_misses(0)
+    , m_stores(0)
+{
+}
+
+bool BinaryCache::enabled() const
+{
+    return m_configuration.cacheDir().size();
+}
+
+bool BinaryCache::fetch(const std::string &project, const std::string &key)
+{
+    std::string entry = entryFile(key);
+    std::set<std::string> manifest;
+    if (access(entry.c_str(), R_OK) || !readManifest(manifestFile(key), manifest)) {
+        m_misses++;
+        updateStatistics(0, 1, 0);
+        return false;
+    }
+
+    fprintf(stdout, "Unpacking %s from binary cache\n", project.c_str());
+    if (!run_command({ "tar", "-C", m_configuration.installDir(), "-xzf", entry })) {
+        fprintf(stderr, "Failed to unpack cache entry %s for project %s\n", entry.c_str(), project.c_str());
+        m_misses++;
+        updateStatistics(0, 1, 0);
+        return false;
+    }
+
+    // The modification time of an entry is its last use
+    utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+
+    std::set<std::string> project_manifest;
+    readManifest(projectManifestFile(project), project_manifest);
+    project_manifest.insert(manifest.begin(), manifest.end());
+    writeManifest(projectManifestFile(project), project_manifest);
+
+    m_hits++;
+    updateStatistics(1, 0, 0);
+    return true;
+}
+
+bool BinaryCache::store(const std::string &project, const std::string &key)
+{
+    std::set<std::string> manifest;
+    if (!readManifest(projectManifestFile(project), manifest))
+        return false;
+
+    std::set<std::string> existing;
+    for (auto it = manifest.begin(); it != manifest.end(); ++it) {
+        struct stat buf;
+        if (lstat((m_configuration.installDir() + "/" + *it).c_str(), &buf) == 0)
+            existing.insert(*it);
+    }
+    if (existing.empty())
+        return false;
+
+    if (!Configuration::ensurePath(m_configuration.cacheDir()))
+        return false;
+
+    std::string entry = entryFile(key);
+    std::string temp_entry = entry + ".tmp." + std::to_string(getpid());
+    std::string temp_manifest = manifestFile(key) + ".tmp." + std::to_string(getpid());
+    if (!writeManifest(temp_manifest, existing))
+        return false;
+
+    bool success = run_command({ "tar", "-C", m_configuration.installDir(), "--null", "--no-recursion",
+                                 "-czf", temp_entry, "-T", temp_manifest });
+    if (!success) {
+        fprintf(stderr, "Failed to pack install tree of %s into the binary cache\n", project.c_str());
+    } else {
+        CacheLock lock(m_configuration.cacheDir());
+        success = rename(temp_manifest.c_str(), manifestFile(key).c_str()) == 0
+            && rename(temp_entry.c_str(), entry.c_str()) == 0;
+    }
+    unlink(temp_entry.c_str());
+    unlink(temp_manifest.c_str());
+
+    if (success) {
+        m_stores++;
+        updateStatistics(0, 0, 1);
+        evict();
+    }
+    return success;
+}
+
+static void collectFiles(const std::string &root, const std::string &relative, std::set<std::string> &entries)
+{
+    std::string dir_path = relative.size() ? root + "/" + relative : root;
+    DIR *dir = opendir(dir_path.c_str());
+    if (!dir)
+        return;
+    while (struct dirent *ent = readdir(dir)) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        std::string entry = relative.size() ? relative + "/" + ent->d_name : std::string(ent->d_name);
+        struct stat buf;
+        if (lstat((root + "/" + entry).c_str(), &buf))
+            continue;
+        if (S_ISDIR(buf.st_mode))
+            collectFiles(root, entry, entries);
+        else
+            entries.insert(entry);
+    }
+    closedir(dir);
+}
+
+std::string BinaryCache::stagingDir(const std::string &project) const
+{
+    return m_configuration.buildShellMetaDir() + "/install_staging/" + project;
+}
+
+bool BinaryCache::beginInstall(const std::string &project)
+{
+    std::string staging_dir = stagingDir(project);
+    if (!run_command({ "rm", "-rf", staging_dir }) || !Configuration::ensurePath(staging_dir)) {
+        fprintf(stderr, "Failed to create install staging dir %s\n", staging_dir.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool BinaryCache::finishInstall(const std::string &project)
+{
+    std::string staging_dir = stagingDir(project);
+    std::string staged_install_dir = staging_dir + "/" + m_configuration.installDir();
+
+    // A manifest from an earlier install must not describe this one
+    unlink(projectManifestFile(project).c_str());
+
+    bool success = true;
+    if (!Configuration::isDir(staged_install_dir)) {
+        fprintf(stderr, "The install step of %s did not use DESTDIR, it is not stored in the binary cache\n",
+                project.c_str());
+    } else {
+        std::set<std::string> manifest;
+        collectFiles(staged_install_dir, std::string(), manifest);
+        success = Configuration::ensurePath(m_configuration.installDir())
+            && run_command({ "cp", "-a", staged_install_dir + "/.", m_configuration.installDir() });
+        if (!success) {
+            fprintf(stderr, "Failed to move the staged install of %s into %s\n",
+                    project.c_str(), m_configuration.installDir().c_str());
+        } else if (manifest.size()) {
+            Configuration::ensurePath(m_configuration.installManifestDir());
+            writeManifest(projectManifestFile(project), manifest);
+        }
+    }
+
+    run_command({ "rm", "-rf", staging_dir });
+    return success;
+}
+
+void BinaryCache::printStatistics() const
+{
+    if (!enabled())
+        return;
+    fprintf(stdout, "Binary cache: %d hits, %d misses, %d stored\n",
+            m_hits.load(), m_misses.load(), m_stores.load());
+}
+
+std::string BinaryCache::entryFile(const std::string &key) const
+{
+    return m_configuration.cacheDir() + "/" + key + ".tar.gz";
+}
+
+std::string BinaryCache::manifestFile(const std::string &key) const
+{
+    return m_configuration.cacheDir() + "/" + key + ".manifest";
+}
+
+std::string BinaryCache::projectManifestFile(const std::string &project) const
+{
+    return m_configuration.installManifestDir() + "/" + project;
+}
+
+bool BinaryCache::readManifest(const std::string &file, std::set<std::string> &entries) const
+{
+    FILE *manifest = fopen(file.c_str(), "re");
+    if (!manifest)
+        return false;
+
+    char *line = nullptr;
+    size_t line_size = 0;
+    ssize_t read_size;
+    while ((read_size = getdelim(&line, &line_size, '\0', manifest)) > 0) {
+        if (read_size > 1)
+            entries.insert(std::string(line, read_size - 1));
+    }
+    free(line);
+    fclose(manifest);
+    return true;
+}
+
+bool BinaryCache::writeManifest(const std::string &file, const std::set<std::string> &entries) const
+{
+    FILE *manifest = fopen(file.c_str(), "we");
+    if (!manifest) {
+        fprintf(stderr, "Failed to write manifest %s : %s\n", file.c_str(), strerror(errno));
+        return false;
+    }
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        fwrite(it->c_str(), 1, it->size() + 1, manifest);
+    }
+    return fclose(manifest) == 0;
+}
+
+void BinaryCache::updateStatistics(int hits, int misses, int stores)
+{
+    if (!Configuration::ensurePath(m_configuration.cacheDir()))
+        return;
+
+    CacheLock lock(m_configuration.cacheDir());
+    std::string stats_file = m_configuration.cacheDir() + "/stats.json";
+
+    double previous[3] = { 0, 0, 0 };
+    static const char *names[3] = { "hits", "misses", "stores" };
+    if (access(stats_file.c_str(), F_OK) == 0) {
+        TreeBuilder builder(stats_file);
+        builder.load();
+        if (JT::ObjectNode *root = builder.rootNode()) {
+            for (int i = 0; i < 3; i++) {
+                JT::Node *node = root->nodeAt(names[i]);
+                if (node && node->asNumberNode())
+                    previous[i] = node->asNumberNode()->number();
+            }
+        }
+    }
+
+    int updated[3] = { hits, misses, stores };
+    JT::ObjectNode root;
+    for (int i = 0; i < 3; i++) {
+        root.addValueToObject(names[i], std::to_string((long long) previous[i] + updated[i]), JT::Token::Number);
+    }
+    TreeWriter writer(stats_file);
+    writer.write(&root);
+}
+
+struct CacheEntry
+{
+    std::string name;
+    off_t size;
+    time_t used;
+};
+
+void BinaryCache::evict()
+{
+    if (!m_configuration.cacheSize())
+        return;
+
+    CacheLock lock(m_configuration.cacheDir());
+    DIR *dir = opendir(m_configuration.cacheDir().c_str());
+    if (!dir)
+        return;
+
+    std::vector<CacheEntry> entries;
+    unsigned long long total_size = 0;
+    static const std::string suffix = ".tar.gz";
+    while (struct dirent *ent = readdir(dir)) {
+        std::string name = ent->d_name;
+        if (name.size() <= suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix))
+            continue;
+        struct stat buf;
+        if (stat((m_configuration.cacheDir() + "/" + name).c_str(), &buf))
+            continue;
+        CacheEntry entry = { name.substr(0, name.size() - suffix.size()), buf.st_size, buf.st_mtime };
+        entries.push_back(entry);
+        total_size += buf.st_size;
+    }
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end(), [](const CacheEntry &a, const CacheEntry &b) {
+            return a.used < b.used;
+        });
+    for (auto it = entries.begin(); it != entries.end() && total_size > m_configuration.cacheSize(); ++it) {
+        unlink(entryFile(it->name).c_str());
+        unlink(manifestFile(it->name).c_str());
+        total_size -= it->size;
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef BINARY_CACHE_H
+#define BINARY_CACHE_H
+
+#include "configuration.h"
+
+#include <string>
+#include <set>
+#include <vector>
+#include <atomic>
+
+class BinaryCache
+{
+public:
+    BinaryCache(const Configuration &configuration);
+
+    bool enabled() const;
+
+    bool fetch(const std::string &project, const std::string &key);
+    bool store(const std::string &project, const std::string &key);
+
+    // With the cache enabled the install step installs into a staging dir
+    // through DESTDIR. finishInstall records everything found there as
+    // what the project installs and moves it into the install dir
+    std::string stagingDir(const std::string &project) const;
+    bool beginInstall(const std::string &project);
+    bool finishInstall(const std::string &project);
+
+    void printStatistics() const;
+
+private:
+    std::string entryFile(const std::string &key) const;
+    std::string manifestFile(const std::string &key) const;
+    std::string projectManifestFile(const std::string &project) const;
+
+    bool readManifest(const std::string &file, std::set<std::string> &entries) const;
+    bool writeManifest(const std::string &file, const std::set<std::string> &entries) const;
+
+    void updateStatistics(int hits, int misses, int stores);
+    void evict();
+
+    const Configuration &m_configuration;
+    std::atomic<int> m_hits;
+    std::atomic<int> m_misses;
+    std::atomic<int> m_stores;
+};
+
+#endif
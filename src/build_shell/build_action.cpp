@@ -26,8 +26,16 @@
 #include "available_builds.h"
 #include "temp_file.h"
 #include "pull_action.h"
+#include "pull_pipeline.h"
 #include "process.h"
-#include "reset_path.h"
+#include "dependency_scheduler.h"
+#include "job_server.h"
+#include "shell_coprocess.h"
+#include "project_node_snapshot.h"
+#include "output_reactor.h"
+#include "build_report.h"
+#include "timing_history.h"
+#include "build_trace.h"
 
 #include <unistd.h>
 #include <sys/stat.h>
@@ -38,6 +46,8 @@
 #include <fcntl.h>
 #include <time.h>
 #include <libgen.h>
+#include <limits.h>
+#include <stdlib.h>
 
 #include <memory>
 #include <algorithm>
@@ -48,11 +58,24 @@ class ProcessBuilder
 public:
     ProcessBuilder(const Configuration &configuration)
         : configuration(configuration)
+        , shell(nullptr)
+        , snapshot(nullptr)
+        , environment(nullptr)
+        , output_reactor(nullptr)
+        , build_report(nullptr)
+        , build_trace(nullptr)
     { }
     const Configuration &configuration;
     std::string env_script;
     std::string project_name;
     std::string fallback;
+    std::string working_directory;
+    ShellCoprocess *shell;
+    const ProjectNodeSnapshot *snapshot;
+    const std::vector<std::string> *environment;
+    OutputReactor *output_reactor;
+    BuildReport *build_report;
+    BuildTrace *build_trace;
 
     Process build() const
     {
@@ -60,6 +83,13 @@ public:
         process.setEnvironmentScript(env_script);
         process.setProjectName(project_name);
         process.setFallback(fallback);
+        process.setWorkingDirectory(working_directory);
+        process.setShell(shell);
+        process.setProjectNodeSnapshot(snapshot);
+        process.setEnvironment(environment);
+        process.setOutputReactor(output_reactor);
+        process.setBuildReport(build_report);
+        process.setBuildTrace(build_trace);
         return process;
     }
 };
@@ -68,6 +98,16 @@ BuildAction::BuildAction(const Configuration &configuration)
     : Action(configuration)
     , m_build_environment(configuration)
     , m_buildset_tree_builder(m_build_environment, configuration.buildsetFile(), true, false)
+    , m_direct_env(false)
+    , m_scheduler(nullptr)
+    , m_job_server(nullptr)
+    , m_output_reactor(nullptr)
+    , m_build_report(nullptr)
+    , m_build_trace(nullptr)
+    , m_pull_pipeline(nullptr)
+    , m_fingerprint_store(configuration)
+    , m_binary_cache(configuration)
+    , m_setup_error(false)
 {
     if (m_buildset_tree_builder.error()) {
         m_error = true;
@@ -75,15 +115,8 @@ BuildAction::BuildAction(const Configuration &configuration)
     }
 
     m_buildset_tree = m_buildset_tree_builder.treeBuilder.rootNode();
-
-    if (m_configuration.pullFirst()) {
-        PullAction pull_action(configuration);
-        if (pull_action.error()) {
-            m_error = true;
-            return;
-        }
-        m_error = !pull_action.execute();
-    }
+    if (m_buildset_tree)
+        m_env_script_builder.reset(new EnvScriptBuilder(m_configuration, m_build_environment, m_buildset_tree));
 }
 
 
@@ -192,6 +225,151 @@ bool BuildAction::execute()
 
     ArgumentsCleanup argCleanup(m_buildset_tree);
 
+    DependencyScheduler scheduler;
+    if (!scheduleProjects(scheduler)) {
+        m_error = true;
+        return false;
+    }
+    scheduler.setMaxParallel(m_configuration.jobs());
+
+    TimingHistory timing_history(m_configuration);
+    timing_history.load();
+    scheduleByHistory(scheduler, timing_history);
+
+    std::unique_ptr<BuildTrace> build_trace;
+    if (m_configuration.traceFile().size())
+        build_trace.reset(new BuildTrace());
+    m_build_trace = build_trace.get();
+
+    // With --pull-first the projects are pulled in the background while
+    // the ones already pulled are being built
+    std::unique_ptr<PullPipeline> pull_pipeline;
+    if (m_configuration.pullFirst()) {
+        pull_pipeline.reset(new PullPipeline(m_configuration));
+        if (pull_pipeline->error()) {
+            m_error = true;
+            return false;
+        }
+        pull_pipeline->setBuildTrace(m_build_trace);
+    }
+
+    bool use_fifo = m_configuration.jobServerType() == Configuration::JobServerFifo
+        || (m_configuration.jobServerType() == Configuration::JobServerAuto && JobServer::makeSupportsFifo());
+    JobServer job_server(m_configuration.makeJobs(), use_fifo, m_configuration.tempFilePath());
+    if (job_server.error()) {
+        m_error = true;
+        return false;
+    }
+    m_job_server = &job_server;
+
+    // Concurrently built projects share one thread for their output
+    std::unique_ptr<OutputReactor> output_reactor;
+    if (m_configuration.jobs() > 1) {
+        output_reactor.reset(new OutputReactor());
+        if (output_reactor->error())
+            output_reactor.reset();
+    }
+    m_output_reactor = output_reactor.get();
+
+    BuildReport build_report(m_configuration);
+    m_build_report = &build_report;
+
+    // The environment of the projects is derived from this one, after the
+    // job server has exported MAKEFLAGS
+    m_direct_env = m_configuration.directEnv() && EnvScriptBuilder::currentEnvironment(m_base_environment);
+
+    m_scheduler = &scheduler;
+    m_pull_pipeline = pull_pipeline.get();
+    if (m_pull_pipeline)
+        m_pull_pipeline->start();
+
+    bool success = scheduler.run([this](const std::string &project_name) {
+            if (m_pull_pipeline && !m_pull_pipeline->waitForProject(project_name)) {
+                m_setup_error = true;
+                return false;
+            }
+            JobServer::Slot slot(*m_job_server);
+            return buildProject(project_name, m_scheduled_projects.find(project_name)->second);
+        });
+    m_job_server = nullptr;
+    m_output_reactor = nullptr;
+    m_build_report = nullptr;
+    m_scheduler = nullptr;
+    m_pull_pipeline = nullptr;
+
+    if (success && pull_pipeline && !pull_pipeline->finish()) {
+        m_setup_error = true;
+        success = false;
+    }
+    // Stop pulling before the job server restores the environment
+    pull_pipeline.reset();
+
+    m_binary_cache.printStatistics();
+    build_report.write(success);
+    timing_history.update(build_report);
+    if (build_trace)
+        build_trace->write(m_configuration.traceFile());
+    m_build_trace = nullptr;
+
+    if (m_setup_error)
+        m_error = true;
+
+    if (!success)
+        return false;
+
+    reporter.markSuccess();
+    return true;
+}
+
+static bool addProjectDependency(DependencyScheduler &scheduler,
+                                 JT::ObjectNode *buildset_tree,
+                                 const std::string &project_name,
+                                 const std::string &depends_on)
+{
+    if (!buildset_tree->objectNodeAt(depends_on)) {
+        fprintf(stderr, "Project %s depends on unknown project %s\n",
+                project_name.c_str(), depends_on.c_str());
+        return false;
+    }
+    // Projects outside the --from/--only-one range or skipped by default
+    // are not built in this run, so there is nothing to wait for
+    if (!scheduler.hasJob(depends_on))
+        return true;
+    return scheduler.addDependency(project_name, depends_on);
+}
+
+// Projects that took long before start first, together with the ones they
+// hold up. Projects without a history are assumed to take the average time
+void BuildAction::scheduleByHistory(DependencyScheduler &scheduler, const TimingHistory &timing_history)
+{
+    std::map<std::string, double> estimates;
+    double known_seconds = 0;
+    int known = 0;
+    for (auto it = m_scheduled_projects.begin(); it != m_scheduled_projects.end(); ++it) {
+        double estimate = timing_history.estimate(it->first);
+        if (estimate < 0)
+            continue;
+        estimates[it->first] = estimate;
+        known_seconds += estimate;
+        known++;
+    }
+    double default_estimate = known ? known_seconds / known : 1;
+
+    for (auto it = m_scheduled_projects.begin(); it != m_scheduled_projects.end(); ++it) {
+        auto estimate = estimates.find(it->first);
+        scheduler.setCost(it->first, estimate != estimates.end() ? estimate->second : default_estimate);
+
+        JT::Node *priority = it->second->nodeAt("priority");
+        if (priority && priority->asNumberNode())
+            scheduler.setPriority(it->first, int(priority->asNumberNode()->number()));
+    }
+}
+
+bool BuildAction::scheduleProjects(DependencyScheduler &scheduler)
+{
+    m_scheduled_projects.clear();
+
+    std::vector<std::pair<std::string, JT::ObjectNode *>> projects;
     auto end_it = endIterator(m_buildset_tree);
     for (auto it = startIterator(m_buildset_tree); it != end_it; ++it) {
         JT::ObjectNode *project_node = it->second->asObjectNode();
@@ -203,58 +381,282 @@ bool BuildAction::execute()
         if (skip_project)
             continue;
 
-        if (!handlePrebuild(project_name, project_node))
+        scheduler.addJob(project_name);
+        m_scheduled_projects[project_name] = project_node;
+        projects.push_back(std::make_pair(project_name, project_node));
+    }
+
+    // A project without depends_on keeps the buildset ordering and waits for
+    // every project listed before it. That is the last such project plus all
+    // the projects with explicit dependencies that came after it.
+    std::vector<std::string> implicit_dependencies;
+    for (auto it = projects.begin(); it != projects.end(); ++it) {
+        const std::string &project_name = it->first;
+        JT::Node *depends_on = it->second->nodeAt("depends_on");
+        if (!depends_on) {
+            for (auto dep_it = implicit_dependencies.begin(); dep_it != implicit_dependencies.end(); ++dep_it) {
+                scheduler.addDependency(project_name, *dep_it);
+            }
+            implicit_dependencies.clear();
+        } else if (JT::StringNode *depends_on_string = depends_on->asStringNode()) {
+            if (!addProjectDependency(scheduler, m_buildset_tree, project_name, depends_on_string->string()))
+                return false;
+        } else if (JT::ArrayNode *depends_on_array = depends_on->asArrayNode()) {
+            for (size_t i = 0; i < depends_on_array->size(); i++) {
+                JT::StringNode *dependency = depends_on_array->index(i)->asStringNode();
+                if (!dependency) {
+                    fprintf(stderr, "depends_on for project %s has to be an array of strings\n", project_name.c_str());
+                    return false;
+                }
+                if (!addProjectDependency(scheduler, m_buildset_tree, project_name, dependency->string()))
+                    return false;
+            }
+        } else {
+            fprintf(stderr, "depends_on for project %s has to be a string or an array of strings\n", project_name.c_str());
             return false;
+        }
+        implicit_dependencies.push_back(project_name);
+    }
 
-        const std::string &project_build_path = project_node->stringAt("arguments.build_path");
-        const std::string &project_build_system = project_node->stringAt("arguments.build_system");
+    return scheduler.validate();
+}
 
-        const std::string &move_to_dir = project_build_path.size() ? project_build_path : m_configuration.buildDir();
+bool BuildAction::buildProject(const std::string &project_name, JT::ObjectNode *project_node)
+{
+    TraceSpan project_span(m_build_trace, project_name, "project", project_name);
+    ProjectNodeSnapshot snapshot(m_configuration, project_name);
+    if (!handlePrebuild(project_name, project_node, &snapshot))
+        return false;
 
-        if (chdir(move_to_dir.c_str())) {
-            fprintf(stderr, "Failed to move into directory %s to build\n", project_build_path.c_str());
-            m_error = true;
-            return false;
+    const std::string &project_build_path = project_node->stringAt("arguments.build_path");
+    const std::string &project_build_system = project_node->stringAt("arguments.build_system");
+
+    const std::string &working_dir = project_build_path.size() ? project_build_path : m_configuration.buildDir();
+
+    TempFile env_script(project_name + "_env");
+    std::list<EnvVariable> direct_variables;
+    bool use_direct_environment = false;
+    {
+        std::unique_lock<std::mutex> lock(m_tree_mutex);
+        m_env_script_builder->setToProject(project_name);
+        m_env_script_builder->writeSetScript(env_script);
+        if (m_direct_env) {
+            direct_variables = m_env_script_builder->variables();
+            use_direct_environment = !EnvScriptBuilder::expandsInShell(direct_variables);
         }
-        if (!handleBuildForProject(project_name, project_build_system, project_node)) {
+    }
+    env_script.close();
+    if (m_build_trace)
+        m_build_trace->instant("environment script", "environment", project_name);
+
+    std::string content_key = projectContentKey(project_name, project_build_system, project_node, env_script.name());
+    {
+        std::unique_lock<std::mutex> lock(m_tree_mutex);
+        m_content_keys[project_name] = content_key;
+    }
+
+    // The content key is independent of where the project is built, the
+    // fingerprint for skipping also has to match the source and build dir
+    std::string fingerprint;
+    if (content_key.size()) {
+        Fingerprint local_fingerprint;
+        local_fingerprint.add("content", content_key);
+        local_fingerprint.add("src_path", project_node->stringAt("arguments.src_path"));
+        local_fingerprint.add("build_path", project_build_path);
+        fingerprint = local_fingerprint.toString();
+    }
+
+    bool can_skip = !m_configuration.force() && !m_configuration.clean() && !m_configuration.deepClean();
+    if (can_skip && fingerprint.size() && fingerprint == m_fingerprint_store.fingerprint(project_name)) {
+        fprintf(stdout, "Project %s is up to date\n", project_name.c_str());
+        if (m_build_trace)
+            m_build_trace->instant("up to date", "skip", project_name);
+        return true;
+    }
+    m_fingerprint_store.remove(project_name);
+
+    // pre_build is only run for projects that are built, like the phases
+    // after it
+    {
+        Process process(m_configuration);
+        process.setPhase("pre_build");
+        process.setProjectName(project_name);
+        process.setProjectNodeSnapshot(&snapshot);
+        process.setOutputReactor(m_output_reactor);
+        process.setBuildReport(m_build_report);
+        process.setBuildTrace(m_build_trace);
+        process.setWorkingDirectory(working_dir);
+        process.setProjectNode(project_node, &m_build_environment);
+        process.setPrint(true);
+        process.setScriptHasToExist(false);
+        if (!process.run()) {
+            fprintf(stderr, "Failed to run process\n");
             return false;
         }
+    }
 
-        if (chdir(move_to_dir.c_str())) {
-            fprintf(stderr, "Failed to move into directory %s to do post build scripts\n", project_build_path.c_str());
-            m_error = true;
+    bool complete_build = m_configuration.configure() && m_configuration.build() && m_configuration.install();
+    bool use_cache = m_binary_cache.enabled() && content_key.size() && complete_build
+        && !project_node->nodeAt("no_install");
+
+    if (!(use_cache && can_skip && m_binary_cache.fetch(project_name, content_key))) {
+        std::unique_ptr<ShellCoprocess> shell;
+        if (m_configuration.persistentShell())
+            shell.reset(new ShellCoprocess(m_configuration, env_script.name()));
+        if (!handleBuildForProject(project_name, project_build_system, project_node, env_script.name(), shell.get(), &snapshot,
+                                   use_direct_environment ? &direct_variables : nullptr)) {
             return false;
         }
-        {
-            Process process(m_configuration);
-            process.setEnvironmentScript(m_configuration.buildShellSetEnvFile());
-            process.setPhase("post_build");
-            process.setProjectName(project_name);
-            process.setFallback(project_build_system);
-            process.setProjectNode(project_node, &m_build_environment);
-            process.setPrint(true);
-            process.setScriptHasToExist(false);
-            if (!process.run()) {
-                return false;
-            }
-        }
-
-        if (m_configuration.onlyOne())
-            break;
+        if (use_cache)
+            m_binary_cache.store(project_name, content_key);
+    } else if (m_build_trace) {
+        m_build_trace->instant("cache hit", "skip", project_name);
     }
-    reporter.markSuccess();
+
+    Process process(m_configuration);
+    process.setEnvironmentScript(m_configuration.buildShellSetEnvFile());
+    process.setPhase("post_build");
+    process.setProjectName(project_name);
+    process.setFallback(project_build_system);
+    process.setWorkingDirectory(working_dir);
+    process.setProjectNode(project_node, &m_build_environment);
+    process.setProjectNodeSnapshot(&snapshot);
+    process.setOutputReactor(m_output_reactor);
+    process.setBuildReport(m_build_report);
+    process.setBuildTrace(m_build_trace);
+    process.setPrint(true);
+    process.setScriptHasToExist(false);
+    if (!process.run())
+        return false;
+
+    if (complete_build && fingerprint.size())
+        m_fingerprint_store.store(project_name, fingerprint);
+
     return true;
 }
 
-bool BuildAction::handlePrebuild(const std::string &project_name, JT::ObjectNode *project_node)
+// The environment script mentions the source and build dir. They are replaced
+// so that the same project built in different build dirs shares its key
+static bool readEnvironmentScript(const Configuration &configuration, const std::string &file, std::string &environment)
 {
-    if (chdir(m_configuration.buildDir().c_str())) {
-        fprintf(stderr, "Could not move into build dir:%s\n%s\n",
-                m_configuration.buildDir().c_str(), strerror(errno));
-        m_error = true;
+    FILE *script = fopen(file.c_str(), "re");
+    if (!script)
         return false;
+    char buffer[4096];
+    size_t read_size;
+    while ((read_size = fread(buffer, 1, sizeof buffer, script)) > 0)
+        environment.append(buffer, read_size);
+    fclose(script);
+
+    std::vector<std::pair<std::string, std::string>> replacements;
+    replacements.push_back(std::make_pair(configuration.installDir(), std::string("${BUILD_SHELL_INSTALL_DIR}")));
+    replacements.push_back(std::make_pair(configuration.buildDir(), std::string("${BUILD_SHELL_BUILD_DIR}")));
+    replacements.push_back(std::make_pair(configuration.srcDir(), std::string("${BUILD_SHELL_SRC_DIR}")));
+    std::stable_sort(replacements.begin(), replacements.end(),
+                     [](const std::pair<std::string, std::string> &a, const std::pair<std::string, std::string> &b) {
+                         return a.first.size() > b.first.size();
+                     });
+    for (auto it = replacements.begin(); it != replacements.end(); ++it) {
+        if (!it->first.size())
+            continue;
+        size_t pos = 0;
+        while ((pos = environment.find(it->first, pos)) != std::string::npos) {
+            environment.replace(pos, it->first.size(), it->second);
+            pos += it->second.size();
+        }
+    }
+    return true;
+}
+
+std::string BuildAction::projectContentKey(const std::string &project_name,
+                                            const std::string &build_system,
+                                            JT::ObjectNode *project_node,
+                                            const std::string &env_script)
+{
+    const std::string &project_src_path = project_node->stringAt("arguments.src_path");
+    const std::string &scm_type = project_node->stringAt("scm.type");
+    if (!project_src_path.size() || !scm_type.size())
+        return std::string();
+
+    // Projects whose dependencies can not be fingerprinted are always built
+    Fingerprint fingerprint;
+    std::vector<std::string> dependencies = m_scheduler->dependencies(project_name);
+    for (auto it = dependencies.begin(); it != dependencies.end(); ++it) {
+        std::string dependency_key;
+        {
+            std::unique_lock<std::mutex> lock(m_tree_mutex);
+            dependency_key = m_content_keys[*it];
+        }
+        if (!dependency_key.size())
+            return std::string();
+        fingerprint.add(*it, dependency_key);
+    }
+
+    auto fingerprint_scm = [&](const std::string &type, const std::string &dir) {
+        JT::ObjectNode *scm_node = nullptr;
+        Process process(m_configuration);
+        process.setPhase("fingerprint");
+        process.setProjectName(project_name);
+        process.setFallback(type);
+        process.setWorkingDirectory(dir);
+        process.setOutputReactor(m_output_reactor);
+        process.setProjectNode(project_node, &m_build_environment);
+        process.setScriptHasToExist(false);
+        if (!process.run(&scm_node))
+            return std::string();
+        std::unique_ptr<JT::ObjectNode> scm_node_cleanup(scm_node);
+        return scm_node ? scm_node->stringAt("arguments.scm_fingerprint") : std::string();
+    };
+
+    std::string scm_fingerprint = fingerprint_scm(scm_type, project_src_path);
+    if (!scm_fingerprint.size())
+        return std::string();
+    fingerprint.add("project", project_name);
+    fingerprint.add("scm", scm_fingerprint);
+
+    // Sub repos are repositories of their own inside the project, the scm
+    // of the project does not see their changes
+    JT::ArrayNode *sub_repos = project_node->arrayNodeAt("scm.sub_repos");
+    for (size_t i = 0; sub_repos && i < sub_repos->size(); i++) {
+        JT::ObjectNode *sub_repo = sub_repos->index(i)->asObjectNode();
+        if (!sub_repo)
+            continue;
+        const std::string &path = sub_repo->stringAt("path");
+        const std::string &name = sub_repo->stringAt("name");
+        const std::string &sub_repo_type = sub_repo->stringAt("type");
+        std::string sub_repo_path = path + "/" + name;
+        std::string sub_repo_fingerprint = fingerprint_scm(sub_repo_type.size() ? sub_repo_type : scm_type,
+                                                          m_configuration.srcDir() + "/" + project_name + "/" + sub_repo_path);
+        if (!sub_repo_fingerprint.size())
+            return std::string();
+        fingerprint.add("sub_repo " + sub_repo_path, sub_repo_fingerprint);
+    }
+    fingerprint.add("configure_args", project_node->stringAt("configure_args"));
+    fingerprint.add("no_install", project_node->nodeAt("no_install") ? "true" : "false");
+    fingerprint.add("install_path", m_configuration.installDir());
+    fingerprint.add("build_system", build_system);
+    std::string environment;
+    if (!readEnvironmentScript(m_configuration, env_script, environment))
+        return std::string();
+    fingerprint.add("environment", environment);
+
+    static const char *phases[] = { "pre_build", "configure", "build", "install", "post_build" };
+    for (size_t i = 0; i < sizeof phases / sizeof *phases; i++) {
+        std::string phase = phases[i];
+        std::string fallback = build_system.size() ? phase + "_" + build_system : std::string();
+        auto scripts = m_configuration.findScript(phase + "_" + project_name, fallback);
+        for (auto it = scripts.begin(); it != scripts.end(); ++it) {
+            std::string script_path = *it;
+            if (!fingerprint.addFile(basename(&script_path[0]), *it))
+                return std::string();
+        }
     }
 
+    return fingerprint.toString();
+}
+
+bool BuildAction::handlePrebuild(const std::string &project_name, JT::ObjectNode *project_node, ProjectNodeSnapshot *snapshot)
+{
     std::string project_src_path = m_configuration.srcDir() + "/" + project_name;
     std::string project_build_path;
     bool dont_shadow = project_node->booleanAt("no_shadow");
@@ -268,22 +670,20 @@ bool BuildAction::handlePrebuild(const std::string &project_name, JT::ObjectNode
         fprintf(stderr, "Problem accessing source path: %s for project %s. Running pull action\n",
                 project_src_path.c_str(), project_name.c_str());
         {
+            std::unique_lock<std::mutex> lock(m_pull_mutex);
             Configuration clone_conf = m_configuration;
             clone_conf.setBuildFromProject(project_name);
             clone_conf.setOnlyOne(true);
             PullAction pull_action(clone_conf);
-            if (pull_action.error()) {
-                m_error = true;
+            if (pull_action.error() || !pull_action.execute()) {
+                m_setup_error = true;
                 return false;
             }
-            m_error = !pull_action.execute();
-            if (m_error)
-                return false;
         }
         if (access(project_src_path.c_str(), X_OK|R_OK)) {
             fprintf(stderr, "Problem accessing source path: %s for project %s. Can not complete build\n",
                     project_src_path.c_str(), project_name.c_str());
-            m_error = true;
+            m_setup_error = true;
             return false;
         }
     }
@@ -298,7 +698,7 @@ bool BuildAction::handlePrebuild(const std::string &project_name, JT::ObjectNode
         if (failed_mkdir) {
             fprintf(stderr, "Failed to verify build path %s for project %s. Can not complete build\n",
                     project_build_path.c_str(), project_name.c_str());
-            m_error = true;
+            m_setup_error = true;
             return false;
         }
     }
@@ -314,37 +714,47 @@ bool BuildAction::handlePrebuild(const std::string &project_name, JT::ObjectNode
             std::string project_mer_src_path = project_src_path + "/" + base_name;
             build_system = Configuration::findBuildSystem(project_mer_src_path);
             if (build_system != Configuration::NotRecognizedBuildSystem) {
-                std::string tmp_build_path;
-                Configuration::getAbsPath(project_build_path + "/" + base_name, true, tmp_build_path);
-                std::string tmp_src_path;
-                Configuration::getAbsPath(project_mer_src_path, false, tmp_src_path);
-                project_src_path = tmp_src_path;
-                project_build_path = tmp_build_path;
+                std::string mer_build_path = project_build_path + "/" + base_name;
+                Configuration::ensurePath(mer_build_path);
+                char real_path[PATH_MAX];
+                if (realpath(project_mer_src_path.c_str(), real_path))
+                    project_src_path = real_path;
+                if (realpath(mer_build_path.c_str(), real_path))
+                    project_build_path = real_path;
             }
         }
         std::string build_system_string = Configuration::BuildSystemStringMap[build_system];
         arguments->addValueToObject("build_system", build_system_string, JT::Token::String);
     }
 
-    bool should_chdir_to_build = false;
     if (access(project_src_path.c_str(), X_OK|R_OK) == 0) {
         arguments->addValueToObject("src_path", project_src_path, JT::Token::String);
         arguments->addValueToObject("build_path", project_build_path, JT::Token::String);
-        should_chdir_to_build = true;
     }
 
-    project_node->insertNode(std::string("arguments"), arguments, true);
-
-    static const long num_cpu = sysconf( _SC_NPROCESSORS_ONLN );
-    char cpu_buf[4];
-    snprintf(cpu_buf, sizeof cpu_buf, "%ld", num_cpu);
+    char cpu_buf[12];
+    snprintf(cpu_buf, sizeof cpu_buf, "%d", m_configuration.makeJobs());
     arguments->addValueToObject("cpu_count", cpu_buf, JT::Token::Number);
     JT::ObjectNode *env_variables = m_build_environment.copyEnvironmentTree();
     arguments->insertNode(std::string("environment"), env_variables);
 
+    std::string build_system_string = arguments->stringAt("build_system");
+    {
+        std::unique_lock<std::mutex> lock(m_tree_mutex);
+        project_node->insertNode(std::string("arguments"), arguments, true);
+        // The node does not change after this, all phases can share it. If
+        // the snapshot fails the phases write their own temporary file
+        snapshot->write(project_node, &m_build_environment);
+    }
+
     ProcessBuilder processBuilder(m_configuration);
     processBuilder.project_name = project_name;
-    processBuilder.fallback = project_node->stringAt("arguments.build_system");
+    processBuilder.fallback = build_system_string;
+    processBuilder.working_directory = m_configuration.buildDir();
+    processBuilder.snapshot = snapshot;
+    processBuilder.output_reactor = m_output_reactor;
+    processBuilder.build_report = m_build_report;
+    processBuilder.build_trace = m_build_trace;
 
     if (m_configuration.clean()) {
         Process process = processBuilder.build();
@@ -361,78 +771,66 @@ bool BuildAction::handlePrebuild(const std::string &project_name, JT::ObjectNode
             scm_type = "regular";
         }
 
-        ResetPath resetPath;
-        (void) resetPath;
-
         if (project_build_path.size() && project_build_path != project_src_path) {
             if (!Configuration::removeRecursive(project_build_path.c_str())) {
                 fprintf(stderr, "Failed to remove build dir %s\n", project_build_path.c_str());
-                m_error = true;
+                m_setup_error = true;
                 return false;
             }
             Configuration::ensurePath(project_build_path);
         }
 
         if (project_src_path.size()) {
-            if (chdir(project_src_path.c_str())) {
-                fprintf(stderr, "Failed to change to source directory. Deep clean failed%s\n", strerror(errno));
-                m_error = true;
+            PhaseReporter reporter("deep-clean", project_name);
+            Process process = processBuilder.build();
+            process.setPhase("deep_clean");
+            process.setFallback(scm_type);
+            process.setWorkingDirectory(project_src_path);
+            process.setProjectNode(project_node, &m_build_environment);
+            process.setPrint(true);
+            if (!process.run()) {
                 return false;
-            } else {
-                PhaseReporter reporter("deep-clean", project_name);
-                Process process = processBuilder.build();
-                process.setPhase("deep_clean");
-                process.setFallback(scm_type);
-                process.setProjectNode(project_node, &m_build_environment);
-                process.setPrint(true);
-                if (!process.run()) {
-                    return false;
-                }
-                reporter.markSuccess();
             }
-        }
-    }
-
-    if (should_chdir_to_build) {
-        chdir(project_build_path.c_str());
-    } else {
-        chdir(m_configuration.buildDir().c_str());
-    }
-
-    {
-        Process process(m_configuration);
-        process.setPhase("pre_build");
-        process.setProjectName(project_name);
-        process.setProjectNode(project_node, &m_build_environment);
-        process.setPrint(true);
-        process.setScriptHasToExist(false);
-        if (!process.run()) {
-            fprintf(stderr, "Failed to run process\n");
-            return false;
+            reporter.markSuccess();
         }
     }
 
     return true;
 }
 
-bool BuildAction::handleBuildForProject(const std::string &projectName, const std::string &buildSystem, JT::ObjectNode *projectNode)
+bool BuildAction::handleBuildForProject(const std::string &projectName, const std::string &buildSystem, JT::ObjectNode *projectNode, const std::string &envScript, ShellCoprocess *shell, const ProjectNodeSnapshot *snapshot, const std::list<EnvVariable> *environmentVariables)
 {
-    TempFile temp_file(projectName + "_env");
-    EnvScriptBuilder env_script_builder(m_configuration, m_build_environment, m_buildset_tree);
-    env_script_builder.setToProject(projectName);
-    env_script_builder.writeSetScript(temp_file);
-    temp_file.close();
+    const std::string &project_build_path = projectNode->stringAt("arguments.build_path");
 
     ProcessBuilder processBuilder(m_configuration);
     processBuilder.project_name = projectName;
-    processBuilder.env_script = temp_file.name();
+    processBuilder.env_script = envScript;
+    processBuilder.shell = shell;
+    processBuilder.snapshot = snapshot;
+    processBuilder.output_reactor = m_output_reactor;
+    processBuilder.build_report = m_build_report;
+    processBuilder.build_trace = m_build_trace;
     processBuilder.fallback = buildSystem;
+    processBuilder.working_directory = project_build_path.size() ? project_build_path : m_configuration.buildDir();
+
+    // Like the set script the environment is made when each phase starts,
+    // so directories made by the phases before it are in it
+    std::vector<std::string> phase_environment;
+    auto apply_phase_environment = [&]() {
+        if (!environmentVariables)
+            return;
+        EnvScriptBuilder::Environment environment(m_base_environment);
+        EnvScriptBuilder::applyEnvironment(m_configuration, *environmentVariables, processBuilder.working_directory, environment);
+        phase_environment = EnvScriptBuilder::environmentStrings(environment);
+        processBuilder.environment = &phase_environment;
+    };
 
     std::unique_ptr<JT::ObjectNode> temp_pointer(nullptr);
     JT::ObjectNode *project_node = projectNode;
 
     if (m_configuration.configure()) {
         PhaseReporter reporter("configure", projectName);
+        apply_phase_environment();
         Process process = processBuilder.build();
         process.setPhase("configure");
         process.setProjectNode(project_node, &m_build_environment);
@@ -446,6 +844,7 @@ bool BuildAction::handleBuildForProject(const std::string &projectName, const st
     if (m_configuration.build()) {
         {
             PhaseReporter reporter("build", projectName);
+            apply_phase_environment();
             Process process = processBuilder.build();
             process.setPhase("build");
             process.setProjectNode(project_node, &m_build_environment);
@@ -457,13 +856,24 @@ bool BuildAction::handleBuildForProject(const std::string &projectName, const st
         }
         if (m_configuration.install() && project_node->nodeAt("no_install") == nullptr) {
             PhaseReporter reporter("install", projectName);
+            apply_phase_environment();
             Process process = processBuilder.build();
             process.setPhase("install");
             process.setProjectNode(project_node, &m_build_environment);
             process.setPrint(false);
+            // With the binary cache the project installs into a staging dir
+            // first, so what it installs is known. qmake uses INSTALL_ROOT
+            if (m_binary_cache.enabled()) {
+                if (!m_binary_cache.beginInstall(projectName))
+                    return false;
+                process.addEnvironment("DESTDIR", m_binary_cache.stagingDir(projectName));
+                process.addEnvironment("INSTALL_ROOT", m_binary_cache.stagingDir(projectName));
+            }
             if (!process.run()) {
                 return false;
             }
+            if (m_binary_cache.enabled() && !m_binary_cache.finishInstall(projectName))
+                return false;
             reporter.markSuccess();
         }
     }
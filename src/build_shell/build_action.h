@@ -25,6 +25,24 @@
 #include "create_action.h"
 
 #include "json_tokenizer.h"
+#include "fingerprint_store.h"
+#include "binary_cache.h"
+#include "env_script_builder.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+class DependencyScheduler;
+class JobServer;
+class PullPipeline;
+class ShellCoprocess;
+class ProjectNodeSnapshot;
+class OutputReactor;
+class BuildReport;
+class TimingHistory;
+class BuildTrace;
 
 class BuildAction : public Action
 {
@@ -35,12 +53,32 @@ public:
     bool execute();
 
 private:
-    bool handlePrebuild(const std::string &project_name, JT::ObjectNode *project_node);
-    bool handleBuildForProject(const std::string &projectName, const std::string &buildSystem, JT::ObjectNode *projectNode);
+    bool scheduleProjects(DependencyScheduler &scheduler);
+    void scheduleByHistory(DependencyScheduler &scheduler, const TimingHistory &timing_history);
+    bool buildProject(const std::string &project_name, JT::ObjectNode *project_node);
+    bool handlePrebuild(const std::string &project_name, JT::ObjectNode *project_node, ProjectNodeSnapshot *snapshot);
+    bool handleBuildForProject(const std::string &projectName, const std::string &buildSystem, JT::ObjectNode *projectNode, const std::string &envScript, ShellCoprocess *shell, const ProjectNodeSnapshot *snapshot, const std::list<EnvVariable> *environmentVariables);
+    std::string projectContentKey(const std::string &project_name, const std::string &build_system, JT::ObjectNode *project_node, const std::string &env_script);
 
     BuildEnvironment m_build_environment;
     BuildsetTreeBuilder m_buildset_tree_builder;
     JT::ObjectNode *m_buildset_tree;
+    std::unique_ptr<EnvScriptBuilder> m_env_script_builder;
+    EnvScriptBuilder::Environment m_base_environment;
+    bool m_direct_env;
+    std::map<std::string, JT::ObjectNode *> m_scheduled_projects;
+    DependencyScheduler *m_scheduler;
+    JobServer *m_job_server;
+    OutputReactor *m_output_reactor;
+    BuildReport *m_build_report;
+    BuildTrace *m_build_trace;
+    PullPipeline *m_pull_pipeline;
+    FingerprintStore m_fingerprint_store;
+    std::map<std::string, std::string> m_content_keys;
+    BinaryCache m_binary_cache;
+    std::mutex m_tree_mutex;
+    std::mutex m_pull_mutex;
+    std::atomic<bool> m_setup_error;
 };
 
 #endif
@@ -21,12 +21,15 @@
 */
 
 #include "build_environment.h"
+#include "fingerprint_store.h"
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
 
+#include <functional>
+
 #include "json_tree.h"
 #include "tree_builder.h"
 #include "tree_writer.h"
@@ -60,6 +63,7 @@ BuildEnvironment::BuildEnvironment(const Configuration &configuration)
 {
     if (access(m_environment_file.c_str(), R_OK) == 0) {
         TreeBuilder tree_builder(m_environment_file);
+        tree_builder.setUseSnapshot(true);
         if (!tree_builder.load()) {
             m_error = true;
             return;
@@ -92,38 +96,85 @@ bool BuildEnvironment::error()
     return m_error;
 }
 
-std::string BuildEnvironment::getVariable(const std::string &variable, const std::string &project) const
+bool BuildEnvironment::VariableName::operator==(const VariableName &other) const
 {
-    JT::ObjectNode *projects_node = m_environment_node->objectNodeAt("projects");
-    if (projects_node) {
-        JT::ObjectNode *project_environment = projects_node->objectNodeAt(project);
-        if (project_environment) {
-            JT::StringNode *variable_node = project_environment->stringNodeAt(variable);
-            if (variable_node)
-                return variable_node->string();
+    return size == other.size && memcmp(data, other.data, size) == 0;
+}
 
-        }
+size_t BuildEnvironment::VariableNameHash::operator()(const VariableName &name) const
+{
+    return fnv1a(name.data, name.size);
+}
+
+void BuildEnvironment::ResolutionTable::set(const std::string &name, const std::string &value)
+{
+    auto it = m_index.find(VariableName { name.c_str(), name.size() });
+    if (it != m_index.end()) {
+        *it->second = value;
+        return;
     }
+    // Elements of a deque do not move when it grows, so the index can
+    // point into them
+    m_variables.push_back(std::make_pair(name, value));
+    auto &variable = m_variables.back();
+    m_index[VariableName { variable.first.c_str(), variable.first.size() }] = &variable.second;
+}
 
-    JT::ObjectNode *default_node = m_environment_node->objectNodeAt("default");
-    if (default_node) {
-        JT::StringNode *variable_node = default_node->stringNodeAt(variable);
-        if (variable_node)
-            return variable_node->string();
+const std::string *BuildEnvironment::ResolutionTable::find(const char *name, size_t size) const
+{
+    auto it = m_index.find(VariableName { name, size });
+    return it != m_index.end() ? it->second : nullptr;
+}
+
+static void setStringVariables(const JT::ObjectNode *node, std::function<void(const std::string &, const std::string &)> set)
+{
+    if (!node)
+        return;
+    for (auto it = node->begin(); it != node->end(); ++it) {
+        if (const JT::StringNode *string = it->second->asStringNode())
+            set(it->first.string(), string->string());
     }
+}
 
-    if (variable == "project_src_path") {
-        return m_configuration.srcDir() + "/" + project;
-    } else if (variable == "project_build_path") {
-        return m_configuration.buildDir() + "/" + project;
-    } else if (variable == "build_path") {
-        return m_configuration.buildDir();
-    } else if (variable == "src_path") {
-        return m_configuration.srcDir();
-    } else if (variable == "install_path") {
-        return m_configuration.installDir();
+const BuildEnvironment::ResolutionTable &BuildEnvironment::resolutionTable(const std::string &project) const
+{
+    std::unique_lock<std::mutex> lock(m_resolution_mutex);
+    auto it = m_resolution_tables.find(project);
+    if (it != m_resolution_tables.end())
+        return *it->second;
+
+    std::unique_ptr<ResolutionTable> table(new ResolutionTable());
+    table->set("project_src_path", m_configuration.srcDir() + "/" + project);
+    table->set("project_build_path", m_configuration.buildDir() + "/" + project);
+    table->set("build_path", m_configuration.buildDir());
+    table->set("src_path", m_configuration.srcDir());
+    table->set("install_path", m_configuration.installDir());
+
+    auto set = [&table](const std::string &name, const std::string &value) { table->set(name, value); };
+    setStringVariables(m_environment_node->objectNodeAt("default"), set);
+
+    JT::ObjectNode *projects_node = m_environment_node->objectNodeAt("projects");
+    if (projects_node) {
+        for (auto project_it = projects_node->begin(); project_it != projects_node->end(); ++project_it) {
+            if (project_it->first.string() == project)
+                setStringVariables(project_it->second->asObjectNode(), set);
+        }
     }
-    return std::string();
+
+    const ResolutionTable &ret = *table;
+    m_resolution_tables[project] = std::move(table);
+    return ret;
+}
+
+const std::string *BuildEnvironment::resolveVariable(const char *name, size_t size, const std::string &project) const
+{
+    return resolutionTable(project).find(name, size);
+}
+
+std::string BuildEnvironment::getVariable(const std::string &variable, const std::string &project) const
+{
+    const std::string *value = resolveVariable(variable.c_str(), variable.size(), project);
+    return value ? *value : std::string();
 }
 
 void BuildEnvironment::setVariable(const std::string &variable, const std::string &value, const std::string &project)
@@ -156,6 +207,9 @@ void BuildEnvironment::setVariable(const std::string &variable, const std::strin
     token.value.size = value.size();
     JT::Node *value_node = JT::Node::createValueNode(&token);
     insert_object->insertNode(variable, value_node, true);
+
+    std::unique_lock<std::mutex> lock(m_resolution_mutex);
+    m_resolution_tables.clear();
 }
 
 const std::set<std::string> &BuildEnvironment::staticVariables() const
@@ -221,46 +275,63 @@ static Variable next_variable(const char *data, size_t length)
 
 const std::string BuildEnvironment::expandVariablesInString(const std::string &str, const std::string &project) const
 {
-    auto variables = findVariables(str.c_str(), str.size());
-    if (!variables.size())
+    size_t offset = 0;
+    Variable variable;
+    if (!nextVariable(str.c_str(), str.size(), &offset, &variable))
         return str;
 
-    std::string return_str = str;
-    size_t diff = 0;
-    for (auto it = variables.begin(); it != variables.end(); ++it) {
-        std::string variable_name(it->start, it->size);
-        std::string variable_value = getVariable(variable_name, project);
-        if (!variable_value.size()) {
-            fprintf(stderr, "Could not expand variable %s for project %s\n", variable_name.c_str(), project.c_str());
+    const ResolutionTable &table = resolutionTable(project);
+    std::string return_str;
+    return_str.reserve(str.size());
+    size_t copied = 0;
+    do {
+        const std::string *value = table.find(variable.start, variable.size);
+        if (!value || !value->size()) {
+            fprintf(stderr, "Could not expand variable %.*s for project %s\n", int(variable.size), variable.start, project.c_str());
             continue;
         }
-        size_t pos = it->start - str.c_str() + diff;
-        return_str.replace(pos - 2, it->size + 3,variable_value);
-        diff += variable_value.size() - (variable_name.size() + 3);
-    }
+        size_t variable_start = variable.start - str.c_str() - 2;
+        return_str.append(str, copied, variable_start - copied);
+        return_str.append(*value);
+        copied = variable_start + variable.size + 3;
+    } while (nextVariable(str.c_str(), str.size(), &offset, &variable));
+    return_str.append(str, copied, std::string::npos);
 
     return return_str;
 }
 
 bool BuildEnvironment::canResolveVariable(const std::string &variable, const std::string &project) const
 {
-    return getVariable(variable, project).size();
+    const std::string *value = resolveVariable(variable.c_str(), variable.size(), project);
+    return value && value->size();
+}
+
+bool BuildEnvironment::nextVariable(const char *str, size_t size, size_t *offset, Variable *variable)
+{
+    if (*offset >= size)
+        return false;
+    Variable found = next_variable(str + *offset, size - *offset);
+    if (!found.start)
+        return false;
+    *variable = found;
+    *offset = found.start + found.size + 1 - str;
+    return true;
+}
+
+bool BuildEnvironment::hasVariables(const char *str, size_t size)
+{
+    size_t offset = 0;
+    Variable variable;
+    return nextVariable(str, size, &offset, &variable);
 }
 
 const std::list<Variable> BuildEnvironment::findVariables(const char *str, const size_t size)
 {
     std::list<Variable> return_list;
-    const char *start = str;
-    size_t size_left = size;
-    while (start && size_left) {
-        Variable variable = next_variable(start, size_left);
-        if (!variable.start)
-            break;
+    size_t offset = 0;
+    Variable variable;
+    while (nextVariable(str, size, &offset, &variable))
         return_list.push_back(variable);
-
-        start = variable.start + variable.size + 1;
-        size_left = size - (start - str);
-    }
     return return_list;
 }
 
@@ -27,6 +27,9 @@
 #include <string>
 #include <list>
 #include <memory>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
 
 #include "configuration.h"
 
@@ -61,16 +64,51 @@ public:
 
     bool canResolveVariable(const std::string &variable, const std::string &project) const;
     static const std::list<Variable> findVariables(const char *str, const size_t size);
+    // Finds the next ${variable} in str at or after offset, and moves offset
+    // past it. Unlike findVariables it does not allocate
+    static bool nextVariable(const char *str, size_t size, size_t *offset, Variable *variable);
+    static bool hasVariables(const char *str, size_t size);
 
     JT::ObjectNode *copyEnvironmentTree() const;
     const Configuration &configuration() const;
 private:
+    struct VariableName
+    {
+        const char *data;
+        size_t size;
+        bool operator==(const VariableName &other) const;
+    };
+    struct VariableNameHash
+    {
+        size_t operator()(const VariableName &name) const;
+    };
+
+    // The value of every variable a project can use: its own variables,
+    // the default ones and the static ones, in that order
+    class ResolutionTable
+    {
+    public:
+        void set(const std::string &name, const std::string &value);
+        const std::string *find(const char *name, size_t size) const;
+    private:
+        std::deque<std::pair<std::string, std::string>> m_variables;
+        std::unordered_map<VariableName, std::string *, VariableNameHash> m_index;
+    };
+
+    const ResolutionTable &resolutionTable(const std::string &project) const;
+    const std::string *resolveVariable(const char *name, size_t size, const std::string &project) const;
+
     const Configuration &m_configuration;
     const std::string m_environment_file;
 
     std::unique_ptr<JT::ObjectNode> m_environment_node;
     std::set<std::string> m_static_variables;
 
+    // Built the first time a project resolves a variable, and dropped by
+    // setVariable. Projects are built on several threads
+    mutable std::unordered_map<std::string, std::unique_ptr<ResolutionTable>> m_resolution_tables;
+    mutable std::mutex m_resolution_mutex;
+
     bool m_error;
 };
 
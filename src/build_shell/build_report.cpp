@@ -0,0 +1,150 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "build_report.h"
+
+#include "json_tree.h"
+#include "tree_writer.h"
+
+#include <map>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+
+static std::string dateString()
+{
+    time_t actual_time = time(0);
+    struct tm *local_tm = localtime(&actual_time);
+    char date[20];
+    snprintf(date, sizeof date, "%04d-%02d-%02d-%02d:%02d:%02d",
+             1900 + local_tm->tm_year, local_tm->tm_mon+1, local_tm->tm_mday,
+             local_tm->tm_hour, local_tm->tm_min, local_tm->tm_sec);
+    return date;
+}
+
+static double secondsSince(const struct timespec &start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1000000000.0;
+}
+
+static std::string number(double value)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof buffer, "%.3f", value);
+    return buffer;
+}
+
+static std::string number(long long value)
+{
+    return std::to_string(value);
+}
+
+BuildReport::BuildReport(const Configuration &configuration)
+    : m_configuration(configuration)
+    , m_date(dateString())
+{
+    clock_gettime(CLOCK_MONOTONIC, &m_start);
+}
+
+void BuildReport::add(const std::string &project, const std::string &phase, bool success, const ProcessUsage &usage)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Phase entry;
+    entry.project = project;
+    entry.phase = phase;
+    entry.success = success;
+    entry.usage = usage;
+    m_entries.push_back(entry);
+}
+
+std::vector<BuildReport::Phase> BuildReport::phases() const
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_entries;
+}
+
+bool BuildReport::write(bool success)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!Configuration::ensurePath(m_configuration.buildReportDir())) {
+        fprintf(stderr, "Failed to create report dir %s\n", m_configuration.buildReportDir().c_str());
+        return false;
+    }
+
+    JT::ObjectNode root;
+    root.addValueToObject("started", m_date, JT::Token::String);
+    root.addValueToObject("success", success ? "true" : "false", JT::Token::Bool);
+    root.addValueToObject("wall_seconds", number(secondsSince(m_start)), JT::Token::Number);
+
+    JT::ObjectNode *projects = new JT::ObjectNode();
+    std::map<std::string, JT::ObjectNode *> project_nodes;
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        JT::ObjectNode *&project_node = project_nodes[it->project];
+        if (!project_node) {
+            project_node = new JT::ObjectNode();
+            projects->insertNode(it->project, project_node);
+        }
+        JT::ObjectNode *phase = new JT::ObjectNode();
+        const ProcessUsage &usage = it->usage;
+        phase->addValueToObject("success", it->success ? "true" : "false", JT::Token::Bool);
+        phase->addValueToObject("wall_seconds", number(usage.wall_seconds), JT::Token::Number);
+        phase->addValueToObject("user_seconds", number(usage.user_seconds), JT::Token::Number);
+        phase->addValueToObject("system_seconds", number(usage.system_seconds), JT::Token::Number);
+        phase->addValueToObject("max_rss_kb", number((long long) usage.max_rss_kb), JT::Token::Number);
+        phase->addValueToObject("block_input", number((long long) usage.block_input), JT::Token::Number);
+        phase->addValueToObject("block_output", number((long long) usage.block_output), JT::Token::Number);
+        phase->addValueToObject("output_bytes", number((long long) usage.output_bytes), JT::Token::Number);
+        phase->addValueToObject("processes", number((long long) usage.processes), JT::Token::Number);
+        project_node->insertNode(it->phase, phase, true);
+    }
+    root.insertNode(std::string("projects"), projects);
+
+    std::string report_file = m_configuration.buildReportDir() + "/" + m_date + ".json";
+    TreeWriter writer(report_file);
+    writer.write(&root);
+    if (writer.error()) {
+        fprintf(stderr, "Failed to write build report %s\n", report_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string BuildReport::latestReport(const Configuration &configuration)
+{
+    DIR *dir = opendir(configuration.buildReportDir().c_str());
+    if (!dir)
+        return std::string();
+
+    // The names are dates, the last one sorted is the newest
+    std::string latest;
+    while (struct dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > 5 && name.compare(name.size() - 5, 5, ".json") == 0 && name > latest)
+            latest = name;
+    }
+    closedir(dir);
+    if (!latest.size())
+        return std::string();
+    return configuration.buildReportDir() + "/" + latest;
+}
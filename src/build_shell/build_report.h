@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef BUILD_REPORT_H
+#define BUILD_REPORT_H
+
+#include "configuration.h"
+#include "process_usage.h"
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+#include <time.h>
+
+// Collects the resource usage of every phase run during a build and writes
+// it to a json file in the reports dir when the build is done
+class BuildReport
+{
+public:
+    BuildReport(const Configuration &configuration);
+
+    struct Phase
+    {
+        std::string project;
+        std::string phase;
+        bool success;
+        ProcessUsage usage;
+    };
+
+    void add(const std::string &project, const std::string &phase, bool success, const ProcessUsage &usage);
+    std::vector<Phase> phases() const;
+    bool write(bool success);
+
+    static std::string latestReport(const Configuration &configuration);
+
+private:
+    const Configuration &m_configuration;
+    std::string m_date;
+    struct timespec m_start;
+    std::vector<Phase> m_entries;
+    mutable std::mutex m_mutex;
+};
+
+#endif //BUILD_REPORT_H
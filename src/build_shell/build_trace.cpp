@@ -0,0 +1,139 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "build_trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+static std::string escaped(const std::string &string)
+{
+    std::string escaped_string;
+    for (auto it = string.begin(); it != string.end(); ++it) {
+        switch (*it) {
+        case '"':
+            escaped_string += "\\\"";
+            break;
+        case '\\':
+            escaped_string += "\\\\";
+            break;
+        case '\n':
+            escaped_string += "\\n";
+            break;
+        default:
+            if ((unsigned char) *it < 0x20) {
+                char buffer[8];
+                snprintf(buffer, sizeof buffer, "\\u%04x", *it);
+                escaped_string += buffer;
+            } else {
+                escaped_string += *it;
+            }
+        }
+    }
+    return escaped_string;
+}
+
+BuildTrace::BuildTrace()
+    : m_start(now())
+{
+}
+
+struct timespec BuildTrace::now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time;
+}
+
+void BuildTrace::span(const std::string &name, const std::string &category, const std::string &project,
+                      const struct timespec &start, const struct timespec &end)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Event event = { 'X', name, category, project, microseconds(start), microseconds(end) - microseconds(start), track() };
+    m_events.push_back(event);
+}
+
+void BuildTrace::instant(const std::string &name, const std::string &category, const std::string &project)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Event event = { 'i', name, category, project, microseconds(now()), 0, track() };
+    m_events.push_back(event);
+}
+
+void BuildTrace::nameTrack(const std::string &name)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_track_names[track()] = name;
+}
+
+int BuildTrace::track()
+{
+    auto it = m_tracks.find(std::this_thread::get_id());
+    if (it != m_tracks.end())
+        return it->second;
+    int new_track = m_tracks.size() + 1;
+    m_tracks[std::this_thread::get_id()] = new_track;
+    return new_track;
+}
+
+long long BuildTrace::microseconds(const struct timespec &time) const
+{
+    return (time.tv_sec - m_start.tv_sec) * 1000000LL + (time.tv_nsec - m_start.tv_nsec) / 1000;
+}
+
+bool BuildTrace::write(const std::string &file) const
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    FILE *out_file = fopen(file.c_str(), "we");
+    if (!out_file) {
+        fprintf(stderr, "Failed to open trace file %s : %s\n", file.c_str(), strerror(errno));
+        return false;
+    }
+
+    fprintf(out_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out_file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"build_shell\"}}");
+    for (auto it = m_tracks.begin(); it != m_tracks.end(); ++it) {
+        auto name = m_track_names.find(it->second);
+        std::string track_name = name != m_track_names.end() ? name->second : "job slot " + std::to_string(it->second);
+        fprintf(out_file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                it->second, escaped(track_name).c_str());
+        fprintf(out_file, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"sort_index\":%d}}",
+                it->second, it->second);
+    }
+    for (auto it = m_events.begin(); it != m_events.end(); ++it) {
+        std::string name = escaped(it->project.size() ? it->name + " " + it->project : it->name);
+        fprintf(out_file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%lld,",
+                name.c_str(), escaped(it->category).c_str(), it->type, it->timestamp);
+        if (it->type == 'X')
+            fprintf(out_file, "\"dur\":%lld,", it->duration);
+        else
+            fprintf(out_file, "\"s\":\"t\",");
+        fprintf(out_file, "\"pid\":1,\"tid\":%d,\"args\":{\"project\":\"%s\"}}",
+                it->track, escaped(it->project).c_str());
+    }
+    fprintf(out_file, "\n]}\n");
+    if (fclose(out_file)) {
+        fprintf(stderr, "Failed to write trace file %s : %s\n", file.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
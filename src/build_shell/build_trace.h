@@ -0,0 +1,97 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef BUILD_TRACE_H
+#define BUILD_TRACE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <time.h>
+
+// Collects the phases of a build as trace events, written in the Chrome
+// trace event format that chrome://tracing and Perfetto open. Every thread
+// running projects gets a track of its own.
+class BuildTrace
+{
+public:
+    BuildTrace();
+
+    static struct timespec now();
+
+    void span(const std::string &name, const std::string &category, const std::string &project,
+              const struct timespec &start, const struct timespec &end);
+    void instant(const std::string &name, const std::string &category, const std::string &project);
+    // Names the track of the calling thread
+    void nameTrack(const std::string &name);
+
+    bool write(const std::string &file) const;
+
+private:
+    struct Event
+    {
+        char type;
+        std::string name;
+        std::string category;
+        std::string project;
+        long long timestamp;
+        long long duration;
+        int track;
+    };
+
+    int track();
+    long long microseconds(const struct timespec &time) const;
+
+    struct timespec m_start;
+    std::vector<Event> m_events;
+    std::map<std::thread::id, int> m_tracks;
+    std::map<int, std::string> m_track_names;
+    mutable std::mutex m_mutex;
+};
+
+// Adds a span from construction to destruction, if there is a trace
+class TraceSpan
+{
+public:
+    TraceSpan(BuildTrace *trace, const std::string &name, const std::string &category, const std::string &project)
+        : m_trace(trace)
+        , m_name(name)
+        , m_category(category)
+        , m_project(project)
+        , m_start(BuildTrace::now())
+    { }
+    ~TraceSpan()
+    {
+        if (m_trace)
+            m_trace->span(m_name, m_category, m_project, m_start, BuildTrace::now());
+    }
+private:
+    BuildTrace *m_trace;
+    const std::string m_name;
+    const std::string m_category;
+    const std::string m_project;
+    const struct timespec m_start;
+};
+
+#endif //BUILD_TRACE_H
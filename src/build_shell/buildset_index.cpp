@@ -0,0 +1,234 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "buildset_index.h"
+
+#include "mmapped_file.h"
+#include "../jsonmod/json_scanner.h"
+
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <set>
+
+static bool NO_SNAPSHOT = getenv("BUILD_SHELL_NO_SNAPSHOT") != 0;
+
+static const char INDEX_MAGIC[8] = { 'B', 'S', 'I', 'N', 'D', 'E', 'X', 1 };
+
+struct IndexHeader
+{
+    char magic[8];
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t path_size;
+    uint32_t count;
+};
+
+struct IndexEntry
+{
+    uint64_t offset;
+    uint64_t size;
+    uint32_t name_size;
+};
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+BuildsetIndex::BuildsetIndex(const std::string &file)
+    : m_index(file, ".index")
+{
+}
+
+bool BuildsetIndex::load(const char *data, size_t size)
+{
+    if (m_index.hasStat() && size_t(m_index.fileStat().st_size) == size && read(size))
+        return true;
+    if (!scan(data, size))
+        return false;
+    store();
+    return true;
+}
+
+const std::vector<BuildsetIndex::Project> &BuildsetIndex::projects() const
+{
+    return m_projects;
+}
+
+const BuildsetIndex::Project *BuildsetIndex::project(const std::string &name) const
+{
+    for (auto it = m_projects.begin(); it != m_projects.end(); ++it) {
+        if (it->name == name)
+            return &*it;
+    }
+    return nullptr;
+}
+
+bool BuildsetIndex::read(size_t size)
+{
+    if (NO_SNAPSHOT || access(m_index.path().c_str(), R_OK))
+        return false;
+
+    const std::string &file = m_index.file();
+    const struct stat &file_stat = m_index.fileStat();
+    MmappedReadFile index(m_index.path());
+    const char *pos = static_cast<const char *>(index.map());
+    if (!pos || index.size() < sizeof(IndexHeader))
+        return false;
+    const char *end = pos + index.size();
+
+    IndexHeader header;
+    memcpy(&header, pos, sizeof header);
+    pos += sizeof header;
+    if (memcmp(header.magic, INDEX_MAGIC, sizeof header.magic)
+            || header.size != size
+            || header.mtime_sec != file_stat.st_mtim.tv_sec
+            || header.mtime_nsec != file_stat.st_mtim.tv_nsec
+            || size_t(end - pos) < header.path_size
+            || file.compare(0, std::string::npos, pos, header.path_size)) {
+        return false;
+    }
+    pos += header.path_size;
+
+    std::vector<Project> projects;
+    projects.reserve(header.count);
+    for (uint32_t i = 0; i < header.count; i++) {
+        IndexEntry entry;
+        if (size_t(end - pos) < sizeof entry)
+            return false;
+        memcpy(&entry, pos, sizeof entry);
+        pos += sizeof entry;
+        if (size_t(end - pos) < entry.name_size || entry.offset > size || entry.size > size - entry.offset)
+            return false;
+        Project project;
+        project.name.assign(pos, entry.name_size);
+        project.offset = entry.offset;
+        project.size = entry.size;
+        projects.push_back(project);
+        pos += entry.name_size;
+    }
+    if (pos != end)
+        return false;
+
+    m_projects.swap(projects);
+    return true;
+}
+
+// Only objects in the top level object are indexed. The names are kept as
+// they are written, escapes are not resolved
+bool BuildsetIndex::scan(const char *data, size_t size)
+{
+    const char *pos = data;
+    const char *end = data + size;
+    while (pos < end && isSpace(*pos))
+        pos++;
+    if (pos == end || *pos != '{')
+        return false;
+    pos++;
+
+    std::vector<Project> projects;
+    std::set<std::string> names;
+    while (true) {
+        while (pos < end && (isSpace(*pos) || *pos == ','))
+            pos++;
+        if (pos == end)
+            return false;
+        if (*pos == '}')
+            break;
+
+        Project project;
+        project.offset = pos - data;
+        if (*pos == '"') {
+            const char *name_end = JsonScanner::skipString(pos + 1, end);
+            if (!name_end)
+                return false;
+            project.name.assign(pos + 1, name_end - pos - 2);
+            pos = name_end;
+        } else {
+            const char *name_start = pos;
+            while (pos < end && !isSpace(*pos) && *pos != ':' && *pos != '{' && *pos != '}'
+                   && *pos != '"' && *pos != ',') {
+                pos++;
+            }
+            if (pos == name_start)
+                return false;
+            project.name.assign(name_start, pos - name_start);
+        }
+
+        while (pos < end && isSpace(*pos))
+            pos++;
+        if (pos == end || *pos != ':')
+            return false;
+        pos++;
+        while (pos < end && isSpace(*pos))
+            pos++;
+        if (pos == end || *pos != '{')
+            return false;
+        pos = JsonScanner::skipContainer(pos + 1, end);
+        if (!pos || !names.insert(project.name).second)
+            return false;
+
+        project.size = pos - data - project.offset;
+        projects.push_back(project);
+    }
+
+    for (pos++; pos < end; pos++) {
+        if (!isSpace(*pos))
+            return false;
+    }
+
+    m_projects.swap(projects);
+    return true;
+}
+
+void BuildsetIndex::store() const
+{
+    if (NO_SNAPSHOT || !m_index.hasStat())
+        return;
+
+    const std::string &file = m_index.file();
+    const struct stat &file_stat = m_index.fileStat();
+    IndexHeader header;
+    memcpy(header.magic, INDEX_MAGIC, sizeof header.magic);
+    header.size = file_stat.st_size;
+    header.mtime_sec = file_stat.st_mtim.tv_sec;
+    header.mtime_nsec = file_stat.st_mtim.tv_nsec;
+    header.path_size = file.size();
+    header.count = m_projects.size();
+
+    std::string content(reinterpret_cast<const char *>(&header), sizeof header);
+    content += file;
+    for (auto it = m_projects.begin(); it != m_projects.end(); ++it) {
+        IndexEntry entry;
+        memset(&entry, 0, sizeof entry);
+        entry.offset = it->offset;
+        entry.size = it->size;
+        entry.name_size = it->name.size();
+        content.append(reinterpret_cast<const char *>(&entry), sizeof entry);
+        content += it->name;
+    }
+
+    m_index.write(content);
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef BUILDSET_INDEX_H
+#define BUILDSET_INDEX_H
+
+#include "side_file.h"
+
+#include <string>
+#include <vector>
+
+// The byte ranges of the top level members of a buildset, so single
+// projects can be parsed without parsing the rest of the file. The index is
+// built with one scan over the file and stored next to it as
+// .<name>.index, which is used as long as the path, size and modification
+// time of the file are unchanged. BUILD_SHELL_NO_SNAPSHOT also turns off
+// storing the index.
+class BuildsetIndex
+{
+public:
+    struct Project
+    {
+        std::string name;
+        // offset is where the name of the member starts, size covers the
+        // name and the object
+        size_t offset;
+        size_t size;
+    };
+
+    BuildsetIndex(const std::string &file);
+
+    // data is the content of the file. Returns false if the file is not an
+    // object of objects the scanner understands
+    bool load(const char *data, size_t size);
+
+    const std::vector<Project> &projects() const;
+    const Project *project(const std::string &name) const;
+
+private:
+    bool read(size_t size);
+    bool scan(const char *data, size_t size);
+    void store() const;
+
+    SideFile m_index;
+    std::vector<Project> m_projects;
+};
+
+#endif //BUILDSET_INDEX_H
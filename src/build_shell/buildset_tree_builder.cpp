@@ -27,15 +27,24 @@
 #include "json_tree.h"
 #include "build_environment.h"
 
-BuildsetTreeBuilder::BuildsetTreeBuilder(const BuildEnvironment &buildEnv, const std::string &file, bool print, bool allowMissingVariables)
+BuildsetTreeBuilder::BuildsetTreeBuilder(const BuildEnvironment &buildEnv, const std::string &file, bool print, bool allowMissingVariables,
+                                         const std::vector<std::string> &projects)
     : treeBuilder(file,
         std::bind(&BuildsetTreeBuilder::filterTokens, this, std::placeholders::_1))
     , m_build_environment(buildEnv)
     , m_transformer_state(m_build_environment)
     , m_print(print)
     , m_allow_missing_variables(allowMissingVariables)
-    , m_error(!treeBuilder.load())
+    , m_error(false)
 {
+    // Which variables are defined depends on the build environment, so the
+    // references are stored in the snapshot and checked again
+    treeBuilder.setUseSnapshot(true, &m_variable_references);
+    treeBuilder.setProjects(projects);
+    m_error = !treeBuilder.load();
+    if (!m_error && treeBuilder.loadedFromSnapshot())
+        checkVariableReferences();
+
     if (!m_allow_missing_variables && !m_missing_variables.empty()) {
         if (m_print) {
             fprintf(stderr, "Build set mode: %s does not allow to proceed with undefined variablees\n\n", buildEnv.configuration().modeString().c_str());
@@ -80,18 +89,41 @@ void BuildsetTreeBuilder::filterTokens(JT::Token *next_token)
 
     JT::Token::Type value_type = next_token->value_type;
     if (value_type == JT::Token::String || value_type == JT::Token::Ascii) {
-        auto variable_list = BuildEnvironment::findVariables(next_token->value.data, next_token->value.size);
-        for (auto it = variable_list.begin(); it != variable_list.end(); ++it) {
-            std::string variable(it->start,it->size);
+        size_t offset = 0;
+        Variable found;
+        while (BuildEnvironment::nextVariable(next_token->value.data, next_token->value.size, &offset, &found)) {
+            std::string variable(found.start, found.size);
             if (!m_build_environment.isStaticVariable(variable)){
-                if (!m_build_environment.canResolveVariable(variable, m_transformer_state.current_project)) {
-                    m_missing_variables.push_back(variable);
-                }
-
-                m_required_variables.insert(variable);
+                checkVariable(variable, m_transformer_state.current_project);
+                m_variable_references += m_transformer_state.current_project + '\t' + variable + '\n';
             }
         }
 
     }
     printMissingVariablesMessage();
 }
+
+void BuildsetTreeBuilder::checkVariable(const std::string &variable, const std::string &project)
+{
+    if (!m_build_environment.canResolveVariable(variable, project)) {
+        m_missing_variables.push_back(variable);
+    }
+
+    m_required_variables.insert(variable);
+}
+
+// The references are stored as project<tab>variable lines
+void BuildsetTreeBuilder::checkVariableReferences()
+{
+    size_t line_start = 0;
+    while (line_start < m_variable_references.size()) {
+        size_t tab = m_variable_references.find('\t', line_start);
+        size_t line_end = m_variable_references.find('\n', line_start);
+        if (tab == std::string::npos || line_end == std::string::npos || tab > line_end)
+            break;
+        checkVariable(m_variable_references.substr(tab + 1, line_end - tab - 1),
+                      m_variable_references.substr(line_start, tab - line_start));
+        line_start = line_end + 1;
+    }
+    printMissingVariablesMessage();
+}
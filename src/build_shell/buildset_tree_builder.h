@@ -33,7 +33,10 @@
 class BuildsetTreeBuilder
 {
 public:
-    BuildsetTreeBuilder(const BuildEnvironment &buildEnv, const std::string &file, bool print, bool allowMissingVariables);
+    // When projects is not empty only those projects are parsed, see
+    // TreeBuilder::setProjects
+    BuildsetTreeBuilder(const BuildEnvironment &buildEnv, const std::string &file, bool print, bool allowMissingVariables,
+                        const std::vector<std::string> &projects = std::vector<std::string>());
 
     bool error() const;
     TreeBuilder treeBuilder;
@@ -44,6 +47,9 @@ public:
     void printMissingVariablesMessage();
 private:
     void filterTokens(JT::Token *next_token);
+    void checkVariable(const std::string &variable, const std::string &project);
+    void checkVariableReferences();
+    std::string m_variable_references;
     std::set<std::string> m_required_variables;
     std::list<std::string> m_missing_variables;
     const BuildEnvironment &m_build_environment;
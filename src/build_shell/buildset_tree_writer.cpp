@@ -44,7 +44,7 @@ BuildsetTreeWriter::BuildsetTreeWriter(const BuildEnvironment &buildEnvironment,
 
 const JT::Token &BuildsetTreeWriter::token_transformer(const JT::Token &next_token)
 {
-    if (BuildEnvironment::findVariables(next_token.value.data, next_token.value.size).size()) {
+    if (BuildEnvironment::hasVariables(next_token.value.data, next_token.value.size)) {
         m_transformer_state.cacheAndExpandToken(next_token);
         return m_transformer_state.temp_token;
     }
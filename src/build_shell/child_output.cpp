@@ -0,0 +1,86 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "child_output.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+static bool ALLWAYS_PRINT = getenv("BUILD_SHELL_ALLWAYS_PRINT") != 0;
+static bool NO_SPLICE = getenv("BUILD_SHELL_NO_SPLICE") != 0;
+
+const int ChildOutput::PIPE_SIZE;
+const size_t ChildOutput::BUFFER_SIZE;
+
+bool ChildOutput::alwaysPrint()
+{
+    return ALLWAYS_PRINT;
+}
+
+bool ChildOutput::spliceEnabled()
+{
+    return !NO_SPLICE;
+}
+
+ChildOutput::SpliceResult ChildOutput::splice(int fd, int out_file, unsigned long long *bytes)
+{
+    ssize_t s = ::splice(fd, nullptr, out_file, nullptr, PIPE_SIZE, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    if (s == 0)
+        return EndOfInput;
+    if (s > 0) {
+        if (bytes)
+            *bytes += s;
+        return Spliced;
+    }
+    if (errno == EAGAIN || errno == EINTR)
+        return Spliced;
+    return SpliceFailed;
+}
+
+bool ChildOutput::flushToFile(int file, const char *buffer, size_t size)
+{
+    if (file < 0)
+        return true;
+
+    size_t written = 0;
+    while (written < size) {
+        ssize_t w = write(file, buffer + written, size - written);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        written += w;
+    }
+    return true;
+}
+
+int ChildOutput::exitCode(int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return -1;
+}
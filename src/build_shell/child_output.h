@@ -0,0 +1,62 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef CHILD_OUTPUT_H
+#define CHILD_OUTPUT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Moving the output of children to their log file and stdout, shared by
+// ChildProcessIoHandler and OutputReactor
+class ChildOutput
+{
+public:
+    static const int PIPE_SIZE = 1024 * 1024;
+    static const size_t BUFFER_SIZE = 64 * 1024;
+
+    // BUILD_SHELL_ALLWAYS_PRINT prints all output, not only the output of
+    // the phases that print it
+    static bool alwaysPrint();
+    // BUILD_SHELL_NO_SPLICE always copies the output through build_shell
+    static bool spliceEnabled();
+
+    enum SpliceResult {
+        Spliced,
+        EndOfInput,
+        SpliceFailed
+    };
+    // Moves what can be read from fd to out_file in the kernel, adding the
+    // number of bytes to bytes. Output only going to the log file does not
+    // have to be copied through this process. splice does not work for all
+    // files, ie. files opened with O_APPEND. After SpliceFailed the data
+    // has to be read and written instead
+    static SpliceResult splice(int fd, int out_file, unsigned long long *bytes);
+
+    // Writes all of buffer to file. A file < 0 is ignored
+    static bool flushToFile(int file, const char *buffer, size_t size);
+
+    // The exit code of a child from its wait status. A child killed by a
+    // signal gets 128 + the signal, like bash reports it
+    static int exitCode(int status);
+};
+
+#endif //CHILD_OUTPUT_H
@@ -20,6 +20,7 @@
  * OF THIS SOFTWARE.
 */
 #include "child_process_io_handler.h"
+#include "child_output.h"
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -29,8 +30,6 @@
 
 #include <vector>
 
-static bool ALLWAYS_PRINT = getenv("BUILD_SHELL_ALLWAYS_PRINT") != 0;
-
 ChildProcessIoHandler::ChildProcessIoHandler(const std::string &phase, const std::string &projectName, int out_file)
     : m_out_file(out_file)
     , m_stdout_pipe{-1,-1}
@@ -43,17 +42,57 @@ ChildProcessIoHandler::ChildProcessIoHandler(const std::string &phase, const std
     , m_use_roller(isatty(STDOUT_FILENO))
     , m_phase(phase)
     , m_project_name(projectName)
+    , m_splice(true)
+    , m_byte_counter(nullptr)
 {
-    if (::pipe(m_stderr_pipe)) {
+    if (::pipe2(m_stderr_pipe, O_CLOEXEC)) {
         fprintf(stderr, "Failed to open pipe for stderr redirection %s\n", strerror(errno));
         return;
     }
 
-    if (::pipe(m_stdout_pipe)) {
+    if (::pipe2(m_stdout_pipe, O_CLOEXEC)) {
         fprintf(stderr, "Failed to open pipe for stdout redirection %s\n", strerror(errno));
         return;
     }
 
+    // Larger pipes let the child write more before the reading thread has
+    // to wake up. Failing is fine, the default size is used then
+    fcntl(m_stdout_pipe[0], F_SETPIPE_SZ, ChildOutput::PIPE_SIZE);
+    fcntl(m_stderr_pipe[0], F_SETPIPE_SZ, ChildOutput::PIPE_SIZE);
+
+    m_error = false;
+}
+
+ChildProcessIoHandler::ChildProcessIoHandler(const std::string &phase, const std::string &projectName, int out_file,
+                                             const std::string &stdout_fifo, const std::string &stderr_fifo)
+    : m_out_file(out_file)
+    , m_stdout_pipe{-1,-1}
+    , m_stderr_pipe{-1,-1}
+    , m_error(true)
+    , m_print_stdout(false)
+    , m_print_stderr(true)
+    , m_roller_state(0)
+    , m_rooler_active(false)
+    , m_use_roller(isatty(STDOUT_FILENO))
+    , m_phase(phase)
+    , m_project_name(projectName)
+    , m_splice(true)
+    , m_byte_counter(nullptr)
+{
+    // Opening the read end non blocking returns at once, and poll will not
+    // report a hangup before a writer has opened and closed the fifo
+    m_stderr_pipe[0] = open(stderr_fifo.c_str(), O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+    if (m_stderr_pipe[0] < 0) {
+        fprintf(stderr, "Failed to open fifo %s for stderr redirection %s\n", stderr_fifo.c_str(), strerror(errno));
+        return;
+    }
+
+    m_stdout_pipe[0] = open(stdout_fifo.c_str(), O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+    if (m_stdout_pipe[0] < 0) {
+        fprintf(stderr, "Failed to open fifo %s for stdout redirection %s\n", stdout_fifo.c_str(), strerror(errno));
+        return;
+    }
+
     m_error = false;
 }
 
@@ -66,13 +105,27 @@ ChildProcessIoHandler::~ChildProcessIoHandler()
         close(m_stdout_pipe[1]);
     }
 
-    m_thread.join();
+    if (m_thread.joinable())
+        m_thread.join();
+
+    if (m_stderr_pipe[0] >= 0) {
+        close(m_stderr_pipe[0]);
+    }
+    if (m_stdout_pipe[0] >= 0) {
+        close(m_stdout_pipe[0]);
+    }
 }
 
 void ChildProcessIoHandler::setupMasterProcessState()
 {
-    close(m_stderr_pipe[1]);
-    close(m_stdout_pipe[1]);
+    if (m_stderr_pipe[1] >= 0) {
+        close(m_stderr_pipe[1]);
+        m_stderr_pipe[1] = -1;
+    }
+    if (m_stdout_pipe[1] >= 0) {
+        close(m_stdout_pipe[1]);
+        m_stdout_pipe[1] = -1;
+    }
 
     m_thread = std::thread(&ChildProcessIoHandler::run,this);
 }
@@ -99,57 +152,75 @@ void ChildProcessIoHandler::setPrintStdOut(bool print)
     m_print_stdout = print;
 }
 
-static bool flushToFile(int file, char *buffer, ssize_t size)
+void ChildProcessIoHandler::setPrintStdErr(bool print)
 {
-    if (file < 0)
-        return true;
-
-    ssize_t written = 0;
-    while (written < size) {
-        ssize_t w = write(file, buffer, size);
-        if (w < 0) {
-            return false;
-        }
-        written+=w;
-    }
-    return true;
+    m_print_stderr = print;
+}
+
+void ChildProcessIoHandler::setUseRoller(bool use)
+{
+    m_use_roller = use && isatty(STDOUT_FILENO);
+}
+
+void ChildProcessIoHandler::setByteCounter(unsigned long long *counter)
+{
+    m_byte_counter = counter;
 }
 
 static const char roller[] = { '|', '/', '-', '\\' };
 
-bool ChildProcessIoHandler::handle_events(const pollfd &poll_data, int out_file, bool print, int *active_connections) const
+bool ChildProcessIoHandler::handle_events(pollfd &poll_data, int out_file, bool print, int *active_connections)
 {
     if (!poll_data.revents) {
         return false;
     }
-    if (poll_data.revents & POLLHUP) {
-        (*active_connections)--;
-    }
 
     bool return_val = false;
     if (poll_data.revents & POLLIN) {
-        char in_buffer[1024];
-        ssize_t r = read(poll_data.fd, in_buffer, sizeof in_buffer);
+        bool print_data = ChildOutput::alwaysPrint() || print || out_file < 0;
+
+        if (!print_data && m_splice) {
+            ChildOutput::SpliceResult result = ChildOutput::splice(poll_data.fd, out_file, m_byte_counter);
+            if (result == ChildOutput::EndOfInput) {
+                poll_data.fd = -1;
+                (*active_connections)--;
+                return false;
+            } else if (result == ChildOutput::Spliced) {
+                return false;
+            }
+            m_splice = false;
+        }
+
+        ssize_t r = read(poll_data.fd, m_buffer.data(), m_buffer.size());
 
         if (r == 0) {
+            poll_data.fd = -1;
             (*active_connections)--;
-        } else {
+        } else if (r > 0) {
+            if (m_byte_counter)
+                *m_byte_counter += r;
             if (out_file >= 0) {
-                if (!flushToFile(out_file, in_buffer, r))
+                if (!ChildOutput::flushToFile(out_file, m_buffer.data(), r))
                     fprintf(stderr, "Failed to write to out_file %s\n", strerror(errno));
             }
-            if (ALLWAYS_PRINT || print || out_file < 0) {
-                if (!flushToFile(STDOUT_FILENO, in_buffer, r))
+            if (print_data) {
+                if (!ChildOutput::flushToFile(STDOUT_FILENO, m_buffer.data(), r))
                     fprintf(stderr, "Failed to write to stderr %s\n", strerror(errno));
                 return_val = true;
             }
         }
+    } else if (poll_data.revents & (POLLHUP | POLLERR | POLLNVAL)) {
+        poll_data.fd = -1;
+        (*active_connections)--;
     }
     return return_val;
 }
 
 void ChildProcessIoHandler::run()
 {
+    m_buffer.resize(ChildOutput::BUFFER_SIZE);
+    m_splice = ChildOutput::spliceEnabled();
+
     pollfd poll_data[2];
     poll_data[0].fd = m_stdout_pipe[0];
     poll_data[0].events = POLLHUP | POLLIN;
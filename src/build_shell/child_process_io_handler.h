@@ -24,6 +24,7 @@
 
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <poll.h>
 
@@ -31,6 +32,8 @@ class ChildProcessIoHandler
 {
 public:
     ChildProcessIoHandler(const std::string &phase, const std::string &projectName, int out_file);
+    ChildProcessIoHandler(const std::string &phase, const std::string &projectName, int out_file,
+                          const std::string &stdout_fifo, const std::string &stderr_fifo);
     ~ChildProcessIoHandler();
 
     void setupMasterProcessState();
@@ -39,11 +42,16 @@ public:
     bool error() const { return m_error; }
 
     void setPrintStdOut(bool print);
+    void setPrintStdErr(bool print);
+    void setUseRoller(bool use);
+    // Adds the number of bytes the child wrote to counter. It is complete
+    // when the handler is destroyed
+    void setByteCounter(unsigned long long *counter);
 private:
-    bool handle_events(const pollfd &poll_data,
+    bool handle_events(pollfd &poll_data,
                        int out_file,
                        bool print,
-                       int *active_connections) const;
+                       int *active_connections);
     void run();
     int m_out_file;
     int m_stdout_pipe[2];
@@ -58,6 +66,9 @@ private:
     const std::string &m_phase;
     const std::string &m_project_name;
     std::string m_roller_string;
+    bool m_splice;
+    unsigned long long *m_byte_counter;
+    std::vector<char> m_buffer;
 };
 
 #endif
@@ -54,6 +54,10 @@ const char *Configuration::ScmTypeStringMap[ScmTypeSize] =
                                       { "git",
                                         "svn",
                                         "not_recognized"};
+const char *Configuration::JobServerTypeStringMap[JobServerTypeSize] =
+                                      { "auto",
+                                        "fifo",
+                                        "pipe" };
 Configuration::Configuration()
     : m_mode(Invalid)
     , m_reset_to_sha(false)
@@ -73,6 +77,14 @@ Configuration::Configuration()
     , m_register(true)
     , m_print(false)
     , m_correct_branch(false)
+    , m_jobs(1)
+    , m_make_jobs(sysconf(_SC_NPROCESSORS_ONLN))
+    , m_job_server_type(JobServerAuto)
+    , m_force(false)
+    , m_pull_ahead(2)
+    , m_persistent_shell(false)
+    , m_direct_env(false)
+    , m_cache_size(10ULL * 1024 * 1024 * 1024)
     , m_sane(false)
 {
     struct passwd *pw = getpwuid(getuid());
@@ -305,6 +317,106 @@ bool Configuration::correctBranch() const
     return m_correct_branch;
 }
 
+void Configuration::setJobs(int jobs)
+{
+    m_jobs = jobs > 0 ? jobs : 1;
+}
+
+int Configuration::jobs() const
+{
+    return m_jobs;
+}
+
+void Configuration::setMakeJobs(int make_jobs)
+{
+    m_make_jobs = make_jobs > 0 ? make_jobs : 1;
+}
+
+int Configuration::makeJobs() const
+{
+    return m_make_jobs;
+}
+
+void Configuration::setJobServerType(JobServerType job_server_type)
+{
+    m_job_server_type = job_server_type;
+}
+
+Configuration::JobServerType Configuration::jobServerType() const
+{
+    return m_job_server_type;
+}
+
+void Configuration::setForce(bool force)
+{
+    m_force = force;
+}
+
+bool Configuration::force() const
+{
+    return m_force;
+}
+
+void Configuration::setPullAhead(int pull_ahead)
+{
+    m_pull_ahead = pull_ahead > 0 ? pull_ahead : 1;
+}
+
+int Configuration::pullAhead() const
+{
+    return m_pull_ahead;
+}
+
+void Configuration::setPersistentShell(bool persistent_shell)
+{
+    m_persistent_shell = persistent_shell;
+}
+
+bool Configuration::persistentShell() const
+{
+    return m_persistent_shell;
+}
+
+void Configuration::setDirectEnv(bool direct_env)
+{
+    m_direct_env = direct_env;
+}
+
+bool Configuration::directEnv() const
+{
+    return m_direct_env;
+}
+
+void Configuration::setTraceFile(const std::string &trace_file)
+{
+    m_trace_file = trace_file;
+}
+
+const std::string &Configuration::traceFile() const
+{
+    return m_trace_file;
+}
+
+void Configuration::setCacheDir(const std::string &cache_dir)
+{
+    m_cache_dir = cache_dir;
+}
+
+const std::string &Configuration::cacheDir() const
+{
+    return m_cache_dir;
+}
+
+void Configuration::setCacheSize(unsigned long long cache_size)
+{
+    m_cache_size = cache_size;
+}
+
+unsigned long long Configuration::cacheSize() const
+{
+    return m_cache_size;
+}
+
 void Configuration::validate()
 {
     m_sane = false;
@@ -394,10 +506,29 @@ void Configuration::validate()
         m_install_dir = m_build_dir;
     }
 
+    if (m_cache_dir.length()) {
+        std::string new_cache_dir;
+        if (!Configuration::getAbsPath(m_cache_dir, true, new_cache_dir)) {
+            fprintf(stderr, "Failed to verify cache dir path. Is it a valid directory name? %s\n",
+                    m_cache_dir.c_str());
+            return;
+        }
+        m_cache_dir = std::move(new_cache_dir);
+    }
+
+    if (m_trace_file.size() && m_trace_file[0] != '/') {
+        char current_wd[PATH_MAX];
+        if (getcwd(current_wd, sizeof current_wd))
+            m_trace_file = std::string(current_wd) + "/" + m_trace_file;
+    }
+
     initializeScriptSearchPaths();
 
     m_build_shell_meta_dir = m_build_dir + "/build_shell";
     m_script_log_path = m_build_shell_meta_dir + "/logs";
+    m_fingerprint_dir = m_build_shell_meta_dir + "/fingerprints";
+    m_build_report_dir = m_build_shell_meta_dir + "/reports";
+    m_install_manifest_dir = m_build_shell_meta_dir + "/install_manifests";
     m_build_shell_set_env_file = m_build_shell_meta_dir + "/set_build_env.sh";
     m_build_shell_unset_env_file = m_build_shell_meta_dir + "/unset_build_env.sh";
     m_current_buildset_file = m_build_shell_meta_dir + "/current_buildset";
@@ -430,6 +561,21 @@ const std::string &Configuration::buildShellMetaDir() const
     return m_build_shell_meta_dir;
 }
 
+const std::string &Configuration::fingerprintDir() const
+{
+    return m_fingerprint_dir;
+}
+
+const std::string &Configuration::buildReportDir() const
+{
+    return m_build_report_dir;
+}
+
+const std::string &Configuration::installManifestDir() const
+{
+    return m_install_manifest_dir;
+}
+
 const std::string &Configuration::buildShellSetEnvFile() const
 {
     return m_build_shell_set_env_file;
@@ -598,33 +744,15 @@ bool Configuration::ensurePath(const std::string &path)
         return true;
     }
 
-    ResetPath resetPath;
-    (void) resetPath;
-
-    std::list<std::string>dirs;
-
-    size_t first_slash;
-    size_t current_pos = 0;
-
-    if (path[0] == '/') {
-        if (chdir("/")) {
-            fprintf(stderr, "change dir into root %s\n", strerror(errno));
+    size_t slash = 0;
+    while (slash != std::string::npos) {
+        slash = path.find('/', slash + 1);
+        std::string dir = path.substr(0, slash);
+        if (mkdir(dir.c_str(),S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH) && errno != EEXIST && !isDir(dir)) {
+            fprintf(stderr, "Failed to create directory %s : %s\n", dir.c_str(), strerror(errno));
             return false;
         }
     }
-    while ((first_slash = path.find('/', current_pos)) != std::string::npos) {
-        if (first_slash > current_pos) {
-            std::string dir = path.substr(current_pos, first_slash - current_pos);
-            if (!change_to_dir(dir,true))
-                return false;
-        }
-        current_pos = first_slash + 1;
-    }
-    if (current_pos < path.size() -1) {
-        std::string dir = path.substr(current_pos, first_slash - current_pos);
-        if (dir.size() && !change_to_dir(dir,true))
-            return false;
-    }
 
     return true;
 }
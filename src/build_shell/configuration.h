@@ -42,7 +42,8 @@ public:
         Status,
         Print,
         PrintEnv,
-        CorrectBranch
+        CorrectBranch,
+        Report
     };
 
     enum BuildSystem {
@@ -64,6 +65,14 @@ public:
     };
     static const char *ScmTypeStringMap[ScmTypeSize];
 
+    enum JobServerType {
+        JobServerAuto,
+        JobServerFifo,
+        JobServerPipe,
+        JobServerTypeSize
+    };
+    static const char *JobServerTypeStringMap[JobServerTypeSize];
+
     void setMode(Mode mode, std::string mode_string);
     Mode mode() const;
     std::string modeString() const;
@@ -121,6 +130,36 @@ public:
     void setCorrectBranch(bool correctBranch);
     bool correctBranch() const;
 
+    void setJobs(int jobs);
+    int jobs() const;
+
+    void setMakeJobs(int make_jobs);
+    int makeJobs() const;
+
+    void setJobServerType(JobServerType job_server_type);
+    JobServerType jobServerType() const;
+
+    void setForce(bool force);
+    bool force() const;
+
+    void setPullAhead(int pull_ahead);
+    int pullAhead() const;
+
+    void setPersistentShell(bool persistent_shell);
+    bool persistentShell() const;
+
+    void setDirectEnv(bool direct_env);
+    bool directEnv() const;
+
+    void setTraceFile(const std::string &trace_file);
+    const std::string &traceFile() const;
+
+    void setCacheDir(const std::string &cache_dir);
+    const std::string &cacheDir() const;
+
+    void setCacheSize(unsigned long long cache_size);
+    unsigned long long cacheSize() const;
+
     void validate();
     bool sane() const;
 
@@ -130,6 +169,9 @@ public:
     const std::string &buildShellConfigDir() const;
     const std::string &scriptExecutionLogDir() const;
     const std::string &buildShellMetaDir() const;
+    const std::string &fingerprintDir() const;
+    const std::string &buildReportDir() const;
+    const std::string &installManifestDir() const;
     const std::string &buildShellSetEnvFile() const;
     const std::string &buildShellUnsetEnvFile() const;
     const std::string &currentBuildsetFile() const;
@@ -171,6 +213,9 @@ private:
     std::string m_script_log_path;
     std::string m_tmp_file_path;
     std::string m_build_shell_meta_dir;
+    std::string m_fingerprint_dir;
+    std::string m_build_report_dir;
+    std::string m_install_manifest_dir;
     std::string m_build_shell_set_env_file;
     std::string m_build_shell_unset_env_file;
     std::string m_current_buildset_file;
@@ -191,6 +236,16 @@ private:
     bool m_register;
     bool m_print;
     bool m_correct_branch;
+    int m_jobs;
+    int m_make_jobs;
+    JobServerType m_job_server_type;
+    bool m_force;
+    int m_pull_ahead;
+    bool m_persistent_shell;
+    bool m_direct_env;
+    std::string m_trace_file;
+    std::string m_cache_dir;
+    unsigned long long m_cache_size;
 
     std::list<std::string> m_script_search_paths;
 
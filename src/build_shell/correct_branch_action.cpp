@@ -38,6 +38,7 @@ CorrectBranchAction::CorrectBranchAction(const Configuration &configuration)
     : Action(configuration)
     , m_buildset_tree_builder(configuration.buildsetFile())
 {
+    m_buildset_tree_builder.setProjects(selectedProjects());
     m_buildset_tree_builder.load();
     m_buildset_tree = m_buildset_tree_builder.rootNode();
     if (!m_buildset_tree) {
@@ -58,25 +59,17 @@ bool CorrectBranchAction::execute()
 
     std::unique_ptr<JT::ObjectNode> arguments(new JT::ObjectNode());
 
-    char cwd[PATH_MAX];
-    getcwd(cwd, sizeof(cwd));
-
     auto end_it = endIterator(m_buildset_tree);
     for (auto it = startIterator(m_buildset_tree); it != end_it; ++it) {
         JT::ObjectNode *project_node = it->second->asObjectNode();
         if (!project_node)
             continue;
 
-        if (chdir(m_configuration.srcDir().c_str())) {
-            fprintf(stderr, "Could not move into src dir:%s\n%s\n",
-                    m_configuration.srcDir().c_str(), strerror(errno));
-            return false;
-        }
-
         project_node->insertNode(std::string("arguments"), arguments.get(), true);
         const std::string &project_name = it->first.string();
 
-        bool success = handleProjectNode(m_configuration, project_name, project_node);
+        bool success = handleProjectNode(m_configuration, project_name, project_node,
+                                         m_configuration.srcDir() + "/" + project_name);
 
         //have to remove the project node, so it will not be deleted multiple times
         JT::Node *removed_argnode = project_node->take("arguments");
@@ -91,15 +84,13 @@ bool CorrectBranchAction::execute()
     return true;
 }
 
-bool CorrectBranchAction::handleProjectNode(const Configuration &configuration, const std::string &project_name, JT::ObjectNode *project_node)
+bool CorrectBranchAction::handleProjectNode(const Configuration &configuration, const std::string &project_name, JT::ObjectNode *project_node, const std::string &project_dir, int output_file)
 {
-    if (chdir(project_name.c_str())) {
-        fprintf(stderr, "Failed to move into directory %s : %s\n",
-                project_name.c_str(), strerror(errno));
+    if (!Configuration::isDir(project_dir)) {
+        fprintf(stderr, "Failed to find project directory %s\n", project_dir.c_str());
         return false;
     }
 
-
     std::string fallback_script;
     std::string mode = "correct_branch";
     JT::StringNode *string_node = project_node->stringNodeAt("scm.type");
@@ -117,8 +108,15 @@ bool CorrectBranchAction::handleProjectNode(const Configuration &configuration,
     process.setPhase(mode);
     process.setProjectName(project_name);
     process.setFallback(fallback_script);
+    process.setWorkingDirectory(project_dir);
     process.setProjectNode(project_node);
-    process.setPrint(true);
+    if (output_file >= 0) {
+        process.setLogFile(output_file, false);
+        process.setPrint(false);
+        process.setPrintErrors(false);
+    } else {
+        process.setPrint(true);
+    }
     return  process.run(nullptr);
 }
 
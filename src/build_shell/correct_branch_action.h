@@ -33,7 +33,7 @@ public:
 
     bool execute();
 
-    static bool handleProjectNode(const Configuration &configuration, const std::string &project_name, JT::ObjectNode *project_node);
+    static bool handleProjectNode(const Configuration &configuration, const std::string &project_name, JT::ObjectNode *project_node, const std::string &project_dir, int output_file = -1);
 private:
     TreeBuilder m_buildset_tree_builder;
     JT::ObjectNode *m_buildset_tree;
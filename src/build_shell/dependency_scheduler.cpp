@@ -0,0 +1,266 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "dependency_scheduler.h"
+
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include <stdio.h>
+
+DependencyScheduler::DependencyScheduler()
+    : m_max_parallel(1)
+    , m_stop_on_failure(true)
+{
+}
+
+DependencyScheduler::~DependencyScheduler()
+{
+}
+
+void DependencyScheduler::addJob(const std::string &name)
+{
+    if (hasJob(name))
+        return;
+    m_job_index[name] = m_jobs.size();
+    m_jobs.push_back(Job(name));
+}
+
+bool DependencyScheduler::hasJob(const std::string &name) const
+{
+    return m_job_index.find(name) != m_job_index.end();
+}
+
+bool DependencyScheduler::addDependency(const std::string &job, const std::string &depends_on)
+{
+    auto job_it = m_job_index.find(job);
+    auto depends_on_it = m_job_index.find(depends_on);
+    if (job_it == m_job_index.end() || depends_on_it == m_job_index.end())
+        return false;
+    if (job_it->second == depends_on_it->second)
+        return false;
+
+    Job &dependent = m_jobs[job_it->second];
+    if (std::find(dependent.dependencies.begin(), dependent.dependencies.end(), depends_on_it->second) != dependent.dependencies.end())
+        return true;
+    dependent.dependencies.push_back(depends_on_it->second);
+    m_jobs[depends_on_it->second].dependents.push_back(job_it->second);
+    return true;
+}
+
+std::vector<std::string> DependencyScheduler::dependencies(const std::string &job) const
+{
+    std::vector<std::string> return_list;
+    auto job_it = m_job_index.find(job);
+    if (job_it == m_job_index.end())
+        return return_list;
+    for (size_t dependency : m_jobs[job_it->second].dependencies)
+        return_list.push_back(m_jobs[dependency].name);
+    return return_list;
+}
+
+void DependencyScheduler::setCost(const std::string &job, double cost)
+{
+    auto job_it = m_job_index.find(job);
+    if (job_it != m_job_index.end())
+        m_jobs[job_it->second].cost = cost;
+}
+
+void DependencyScheduler::setPriority(const std::string &job, int priority)
+{
+    auto job_it = m_job_index.find(job);
+    if (job_it != m_job_index.end())
+        m_jobs[job_it->second].priority = priority;
+}
+
+double DependencyScheduler::criticalPath(const std::string &job) const
+{
+    auto job_it = m_job_index.find(job);
+    if (job_it == m_job_index.end())
+        return 0;
+    return m_jobs[job_it->second].critical_path;
+}
+
+void DependencyScheduler::setMaxParallel(int max_parallel)
+{
+    m_max_parallel = std::max(max_parallel, 1);
+}
+
+int DependencyScheduler::maxParallel() const
+{
+    return m_max_parallel;
+}
+
+void DependencyScheduler::setStopOnFailure(bool stop)
+{
+    m_stop_on_failure = stop;
+}
+
+bool DependencyScheduler::validate() const
+{
+    std::vector<size_t> order;
+    return topologicalOrder(order);
+}
+
+bool DependencyScheduler::topologicalOrder(std::vector<size_t> &order) const
+{
+    order.clear();
+    std::vector<size_t> unfinished(m_jobs.size());
+    std::vector<size_t> ready;
+    for (size_t i = 0; i < m_jobs.size(); i++) {
+        unfinished[i] = m_jobs[i].dependencies.size();
+        if (!unfinished[i])
+            ready.push_back(i);
+    }
+
+    while (ready.size()) {
+        size_t job = ready.back();
+        ready.pop_back();
+        order.push_back(job);
+        for (size_t dependent : m_jobs[job].dependents) {
+            if (--unfinished[dependent] == 0)
+                ready.push_back(dependent);
+        }
+    }
+
+    if (order.size() != m_jobs.size()) {
+        fprintf(stderr, "Dependency cycle detected between:");
+        for (size_t i = 0; i < m_jobs.size(); i++) {
+            if (unfinished[i])
+                fprintf(stderr, " %s", m_jobs[i].name.c_str());
+        }
+        fprintf(stderr, "\n");
+        return false;
+    }
+    return true;
+}
+
+void DependencyScheduler::updateCriticalPaths()
+{
+    std::vector<size_t> order;
+    topologicalOrder(order);
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        Job &job = m_jobs[*it];
+        double longest_dependent = 0;
+        for (size_t dependent : job.dependents)
+            longest_dependent = std::max(longest_dependent, m_jobs[dependent].critical_path);
+        job.critical_path = job.cost + longest_dependent;
+    }
+}
+
+void DependencyScheduler::skipDependents(size_t job)
+{
+    for (size_t dependent : m_jobs[job].dependents) {
+        if (m_jobs[dependent].skipped)
+            continue;
+        m_jobs[dependent].skipped = true;
+        m_skipped_jobs.push_back(m_jobs[dependent].name);
+        skipDependents(dependent);
+    }
+}
+
+bool DependencyScheduler::run(std::function<bool(const std::string &)> job_function)
+{
+    m_failed_jobs.clear();
+    m_skipped_jobs.clear();
+
+    if (!validate())
+        return false;
+    updateCriticalPaths();
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    auto starts_before = [this](size_t a, size_t b) {
+        if (m_jobs[a].priority != m_jobs[b].priority)
+            return m_jobs[a].priority > m_jobs[b].priority;
+        if (m_jobs[a].critical_path != m_jobs[b].critical_path)
+            return m_jobs[a].critical_path > m_jobs[b].critical_path;
+        return a < b;
+    };
+    std::set<size_t, std::function<bool(size_t, size_t)>> ready(starts_before);
+    int running = 0;
+    bool stopping = false;
+
+    for (size_t i = 0; i < m_jobs.size(); i++) {
+        m_jobs[i].skipped = false;
+        m_jobs[i].unfinished_dependencies = m_jobs[i].dependencies.size();
+        if (!m_jobs[i].unfinished_dependencies)
+            ready.insert(i);
+    }
+
+    auto worker = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            condition.wait(lock, [&]() { return stopping || ready.size() || !running; });
+            if (stopping || ready.empty())
+                break;
+
+            size_t job = *ready.begin();
+            ready.erase(ready.begin());
+            running++;
+
+            lock.unlock();
+            bool success = job_function(m_jobs[job].name);
+            lock.lock();
+
+            running--;
+            if (success) {
+                for (size_t dependent : m_jobs[job].dependents) {
+                    if (--m_jobs[dependent].unfinished_dependencies == 0 && !m_jobs[dependent].skipped)
+                        ready.insert(dependent);
+                }
+            } else {
+                m_failed_jobs.push_back(m_jobs[job].name);
+                if (m_stop_on_failure)
+                    stopping = true;
+                else
+                    skipDependents(job);
+            }
+            condition.notify_all();
+        }
+    };
+
+    size_t thread_count = std::min(size_t(m_max_parallel), m_jobs.size());
+    if (thread_count <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < thread_count; i++)
+            threads.push_back(std::thread(worker));
+        for (auto it = threads.begin(); it != threads.end(); ++it)
+            it->join();
+    }
+
+    return m_failed_jobs.empty();
+}
+
+const std::vector<std::string> &DependencyScheduler::failedJobs() const
+{
+    return m_failed_jobs;
+}
+
+const std::vector<std::string> &DependencyScheduler::skippedJobs() const
+{
+    return m_skipped_jobs;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef DEPENDENCY_SCHEDULER_H
+#define DEPENDENCY_SCHEDULER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+
+class DependencyScheduler
+{
+public:
+    DependencyScheduler();
+    ~DependencyScheduler();
+
+    void addJob(const std::string &name);
+    bool hasJob(const std::string &name) const;
+    bool addDependency(const std::string &job, const std::string &depends_on);
+    std::vector<std::string> dependencies(const std::string &job) const;
+
+    // Of the jobs ready to run, the ones with the highest priority start
+    // first. Among those the ones with the longest chain of cost through
+    // their dependents, so the critical path of the build starts early
+    void setCost(const std::string &job, double cost);
+    void setPriority(const std::string &job, int priority);
+    double criticalPath(const std::string &job) const;
+
+    void setMaxParallel(int max_parallel);
+    int maxParallel() const;
+
+    void setStopOnFailure(bool stop);
+
+    bool validate() const;
+
+    bool run(std::function<bool(const std::string &)> job_function);
+
+    const std::vector<std::string> &failedJobs() const;
+    const std::vector<std::string> &skippedJobs() const;
+private:
+    struct Job
+    {
+        Job(const std::string &name)
+            : name(name)
+            , unfinished_dependencies(0)
+            , skipped(false)
+            , cost(1)
+            , critical_path(0)
+            , priority(0)
+        { }
+        std::string name;
+        std::vector<size_t> dependencies;
+        std::vector<size_t> dependents;
+        size_t unfinished_dependencies;
+        bool skipped;
+        double cost;
+        double critical_path;
+        int priority;
+    };
+
+    bool topologicalOrder(std::vector<size_t> &order) const;
+    void updateCriticalPaths();
+    void skipDependents(size_t job);
+
+    std::vector<Job> m_jobs;
+    std::map<std::string, size_t> m_job_index;
+    int m_max_parallel;
+    bool m_stop_on_failure;
+    std::vector<std::string> m_failed_jobs;
+    std::vector<std::string> m_skipped_jobs;
+};
+
+#endif
@@ -24,6 +24,7 @@
 #include "json_tree.h"
 #include "tree_builder.h"
 #include "tree_writer.h"
+#include "shell_coprocess.h"
 
 #include <algorithm>
 
@@ -33,11 +34,14 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <stdlib.h>
 
 EnvScriptBuilder::EnvScriptBuilder(const Configuration &configuration, const BuildEnvironment &buildEnvironment, JT::ObjectNode *buildset_node)
     : m_configuration(configuration)
     , m_build_environment(buildEnvironment)
     , m_buildset_node(buildset_node)
+    , m_has_project_order(false)
+    , m_prefix_size(0)
 {
 }
 
@@ -92,22 +96,63 @@ void EnvScriptBuilder::writeScripts(const std::string &setFileName, const std::s
     }
 }
 
-class RemoveVariable
+EnvVariableList::EnvVariableList()
 {
-public:
-    RemoveVariable(const EnvVariable &variable)
-        : m_variable(variable)
-    { }
-    bool operator() (const EnvVariable& variable){
-        if (m_variable.overwrite && m_variable.name == variable.name)
-            return true;
-        if (variable.singular && m_variable.name == variable.name)
-            return true;
-        return false;
+}
+
+EnvVariableList::EnvVariableList(const EnvVariableList &other)
+{
+    for (auto it = other.m_variables.begin(); it != other.m_variables.end(); ++it)
+        append(*it, m_index[it->name]);
+}
+
+void EnvVariableList::append(const EnvVariable &variable, SameName &same_name)
+{
+    m_variables.push_back(variable);
+    same_name.variables.push_back(std::prev(m_variables.end()));
+    if (variable.singular)
+        same_name.singular++;
+}
+
+// A variable replaces the earlier ones with the same name if it overwrites
+// them, or if they are singular. Names that accumulate values, like PATH,
+// are only appended to
+void EnvVariableList::add(const EnvVariable &variable)
+{
+    auto &same_name = m_index[variable.name];
+    if (variable.overwrite || same_name.singular) {
+        auto &variables = same_name.variables;
+        for (auto it = variables.begin(); it != variables.end(); ) {
+            if (variable.overwrite || (*it)->singular) {
+                m_variables.erase(*it);
+                it = variables.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        same_name.singular = 0;
     }
-private:
-    const EnvVariable &m_variable;
-};
+    append(variable, same_name);
+}
+
+void EnvVariableList::add(const std::vector<EnvVariable> &variables)
+{
+    for (auto it = variables.begin(); it != variables.end(); ++it)
+        add(*it);
+}
+
+void EnvVariableList::addIfNotExistent(const EnvVariable &variable)
+{
+    auto &same_name = m_index[variable.name];
+    for (auto it = same_name.variables.begin(); it != same_name.variables.end(); ++it) {
+        const std::list<std::string> &values = (*it)->values;
+        for (auto value = variable.values.begin(); value != variable.values.end(); ++value) {
+            if (std::find(values.begin(), values.end(), *value) != values.end())
+                return;
+        }
+    }
+    append(variable, same_name);
+}
 
 static std::list<std::string> get_variable_values(const std::string &values, const std::string &seperator)
 {
@@ -147,7 +192,7 @@ static std::list<std::string> get_variable_values(JT::Node *variable_node, const
     return return_variables;
 }
 
-void EnvScriptBuilder::populateListFromVariableNode(const std::string &projectName, JT::ObjectNode *variableNode, std::list<EnvVariable> &variables) const
+void EnvScriptBuilder::populateListFromVariableNode(const std::string &projectName, JT::ObjectNode *variableNode, std::vector<EnvVariable> &variables) const
 {
     std::list<std::string> value_list;
     for (auto it = variableNode->begin(); it != variableNode->end(); ++it) {
@@ -168,17 +213,15 @@ void EnvScriptBuilder::populateListFromVariableNode(const std::string &projectNa
                 variable.values.push_back(m_build_environment.expandVariablesInString(un_expanded_variable, projectName));
             }
 
-            variables.remove_if(RemoveVariable(variable));
-
             variables.push_back(variable);
         }
     }
 }
 
-void EnvScriptBuilder::populateListFromEnvironmentNode(const std::string &projectName, JT::ObjectNode *environmentNode, std::list<EnvVariable> &variables) const
+void EnvScriptBuilder::populateListFromEnvironmentNode(const std::string &projectName, JT::ObjectNode *environmentNode, bool toProject, std::vector<EnvVariable> &variables) const
 {
     JT::ObjectNode *local_variable = environmentNode->objectNodeAt("local");
-    if (local_variable && projectName == m_to_project) {
+    if (local_variable && toProject) {
         populateListFromVariableNode(projectName, local_variable, variables);
     }
 
@@ -188,12 +231,12 @@ void EnvScriptBuilder::populateListFromEnvironmentNode(const std::string &projec
     }
 
     JT::ObjectNode *post_variable = environmentNode->objectNodeAt("post");
-    if (post_variable && projectName != m_to_project) {
+    if (post_variable && !toProject) {
         populateListFromVariableNode(projectName, post_variable, variables);
     }
 }
 
-void EnvScriptBuilder::populateListFromProjectNode(const std::string &projectName, JT::ObjectNode *projectNode, std::list<EnvVariable> &variables) const
+void EnvScriptBuilder::populateListFromProjectNode(const std::string &projectName, JT::ObjectNode *projectNode, bool toProject, std::vector<EnvVariable> &variables) const
 {
     for (auto it = projectNode->begin(); it != projectNode->end(); ++it) {
         if (it->first.string() != "env")
@@ -201,62 +244,69 @@ void EnvScriptBuilder::populateListFromProjectNode(const std::string &projectNam
         JT::ObjectNode *env_node = it->second->asObjectNode();
         if (!env_node)
             continue;
-        populateListFromEnvironmentNode(projectName, env_node, variables);
+        populateListFromEnvironmentNode(projectName, env_node, toProject, variables);
     }
 }
 
-class RemoveVariableIfInList
+const std::vector<EnvVariable> &EnvScriptBuilder::prefixVariables(size_t index) const
 {
-public:
-    RemoveVariableIfInList(const EnvVariable &variable)
-        : m_variable(variable)
-    {
+    while (m_prefix_variables.size() <= index) {
+        size_t project = m_prefix_variables.size();
+        m_prefix_variables.push_back(std::vector<EnvVariable>());
+        populateListFromProjectNode(m_project_order[project], m_project_nodes[project], false, m_prefix_variables.back());
     }
+    return m_prefix_variables[index];
+}
 
-    bool operator() (const EnvVariable& variable) {
-        if (m_variable.name == variable.name) {
-            for (auto it = m_variable.values.begin(); it != m_variable.values.end(); ++it) {
-                if (std::find(variable.values.begin(), variable.values.end(), *it) != variable.values.end()) {
-                    return true;
-                }
-            }
+const EnvVariableList &EnvScriptBuilder::prefixFor(const std::string &project_name) const
+{
+    if (!m_has_project_order) {
+        for (auto it = m_buildset_node->begin(); it != m_buildset_node->end(); ++it) {
+            if (!it->second->asObjectNode())
+                continue;
+            m_project_index.insert(std::make_pair(it->first.string(), m_project_order.size()));
+            m_project_order.push_back(it->first.string());
+            m_project_nodes.push_back(it->second->asObjectNode());
         }
-        return false;
+        m_has_project_order = true;
     }
-private:
-    const EnvVariable &m_variable;
-};
 
-static void add_if_not_existent(std::list<EnvVariable> &to_add, std::list<EnvVariable> &target)
-{
-    for (auto it = target.begin(); it != target.end(); ++it) {
-        to_add.remove_if(RemoveVariableIfInList(*it));
-    }
+    size_t index = m_project_order.size();
+    auto found = m_project_index.find(project_name);
+    if (found != m_project_index.end())
+        index = found->second;
 
-    target.splice(target.end(), to_add);
+    if (!m_prefix || m_prefix_size > index) {
+        m_prefix.reset(new EnvVariableList());
+        m_prefix_size = 0;
+    }
+    for (; m_prefix_size < index; m_prefix_size++)
+        m_prefix->add(prefixVariables(m_prefix_size));
+    return *m_prefix;
 }
 
 std::list<EnvVariable> EnvScriptBuilder::make_variable_list_for(const std::string &project_name, bool clean_environment) const
 {
-    std::list<EnvVariable> return_list;
     if (clean_environment) {
+        EnvVariableList variables;
         JT::ObjectNode *project_node = m_buildset_node->objectNodeAt(project_name);
         if (project_node) {
-            populateListFromProjectNode(project_name, project_node, return_list);
-        }
-    } else {
-        for (auto it = m_buildset_node->begin(); it != m_buildset_node->end(); ++it) {
-            if (!it->second->asObjectNode())
-                continue;
-            JT::ObjectNode *project_node = it->second->asObjectNode();
-            populateListFromProjectNode(it->first.string(), project_node, return_list);
-            if (project_name.size() && it->first.compareString(project_name))
-                break;
+            std::vector<EnvVariable> project_variables;
+            populateListFromProjectNode(project_name, project_node, true, project_variables);
+            variables.add(project_variables);
         }
+        return variables.variables();
+    }
+
+    EnvVariableList variables(prefixFor(project_name));
+    auto found = m_project_index.find(project_name);
+    if (found != m_project_index.end()) {
+        std::vector<EnvVariable> project_variables;
+        populateListFromProjectNode(project_name, m_project_nodes[found->second], true, project_variables);
+        variables.add(project_variables);
     }
 
-    if (!clean_environment && m_configuration.installDir() != "/usr" && m_configuration.installDir() != "/usr/local") {
-        std::list<EnvVariable> build_shell_variables;
+    if (m_configuration.installDir() != "/usr" && m_configuration.installDir() != "/usr/local") {
 #ifdef __APPLE__
         const std::string library_path("DYLD_LIBRARY_PATH");
 #else
@@ -268,19 +318,17 @@ std::list<EnvVariable> EnvScriptBuilder::make_variable_list_for(const std::strin
 
         EnvVariable library_path_variable("build_shell", library_path, install_lib);
         library_path_variable.directory = true;
-        build_shell_variables.push_back(library_path_variable);
+        variables.addIfNotExistent(library_path_variable);
 
         EnvVariable bin_path_variable("build_shell", "PATH", install_bin);
         bin_path_variable.directory = true;
-        build_shell_variables.push_back(bin_path_variable);
+        variables.addIfNotExistent(bin_path_variable);
 
         EnvVariable pkg_config_variable("build_shell", "PKG_CONFIG_PATH", install_pkg_config);
         pkg_config_variable.directory = true;
-        build_shell_variables.push_back(pkg_config_variable);
-
-        add_if_not_existent(build_shell_variables, return_list);
+        variables.addIfNotExistent(pkg_config_variable);
     }
-    return return_list;
+    return variables.variables();
 }
 
 static void writeEnvironmentVariable(FILE *file, const EnvVariable &variable, const std::string &requested_indent = "")
@@ -391,3 +439,129 @@ bool EnvScriptBuilder::clean_environment() const
     JT::ObjectNode *project_node = m_buildset_node->objectNodeAt(m_to_project);
     return project_node && project_node->booleanAt("clean_environment");
 }
+
+static std::string joinedValue(const EnvVariable &variable)
+{
+    std::string value;
+    for (auto it = variable.values.begin(); it != variable.values.end(); ++it) {
+        if (it != variable.values.begin())
+            value += variable.seperator;
+        value += *it;
+    }
+    return value;
+}
+
+std::list<EnvVariable> EnvScriptBuilder::variables() const
+{
+    return make_variable_list_for(m_to_project, clean_environment());
+}
+
+bool EnvScriptBuilder::expandsInShell(const std::list<EnvVariable> &variables)
+{
+    // The set script writes the values in double quotes
+    for (auto it = variables.begin(); it != variables.end(); ++it) {
+        for (auto value = it->values.begin(); value != it->values.end(); ++value) {
+            if (value->find_first_of("$`\\\"") != std::string::npos)
+                return true;
+        }
+    }
+    return false;
+}
+
+void EnvScriptBuilder::applyEnvironment(const Configuration &configuration, const std::list<EnvVariable> &variables,
+                                        const std::string &working_directory, Environment &environment)
+{
+    environment["BUILD_SHELL_SRC_DIR"] = configuration.srcDir();
+    environment["BUILD_SHELL_BUILD_DIR"] = configuration.buildDir();
+    environment["BUILD_SHELL_INSTALL_DIR"] = configuration.installDir();
+
+    for (auto it = variables.begin(); it != variables.end(); ++it) {
+        if (it->values.empty())
+            continue;
+        // The set script tests the directory with [ -d ] from the working
+        // directory of the phase
+        if (it->directory) {
+            const std::string &directory = it->values.front();
+            if (!Configuration::isDir(directory.size() && directory[0] != '/' && working_directory.size()
+                                      ? working_directory + "/" + directory : directory)) {
+                continue;
+            }
+        }
+        const std::string build_shell_project_variable = "BUILD_SHELL_" + it->project + "_" + it->name;
+        const std::string current = environment[it->name];
+        environment[build_shell_project_variable] = current;
+        environment[build_shell_project_variable + "_SET"] = "1";
+        if (it->overwrite || it->singular) {
+            environment[it->name] = joinedValue(*it);
+        } else {
+            environment[it->name] = joinedValue(*it) + it->seperator + current;
+        }
+    }
+}
+
+static void addEnvironmentEntry(const char *entry, size_t size, EnvScriptBuilder::Environment &environment)
+{
+    const char *equal = static_cast<const char *>(memchr(entry, '=', size));
+    if (!equal || equal == entry)
+        return;
+    environment[std::string(entry, equal - entry)] = std::string(equal + 1, entry + size - (equal + 1));
+}
+
+bool EnvScriptBuilder::currentEnvironment(Environment &environment)
+{
+    environment.clear();
+
+    std::string unset_file;
+    const char *unset_env_file = getenv("BUILD_SHELL_UNSET_ENV_FILE");
+    const char *build_dir = getenv("BUILD_SHELL_BUILD_DIR");
+    if (unset_env_file && *unset_env_file) {
+        unset_file = unset_env_file;
+    } else if (build_dir && *build_dir) {
+        std::string candidate = std::string(build_dir) + "/build_shell/unset_build_env.sh";
+        if (access(candidate.c_str(), F_OK) == 0)
+            unset_file = candidate;
+    }
+
+    if (!unset_file.size()) {
+        for (char **entry = environ; *entry; ++entry)
+            addEnvironmentEntry(*entry, strlen(*entry), environment);
+        return true;
+    }
+
+    // The unset script is a shell script, let bash run it once and report
+    // the environment it leaves behind
+    std::string command = "bash --noprofile --norc -c 'source \"$0\" && exec env -0' " + ShellCoprocess::quote(unset_file);
+    FILE *env_output = popen(command.c_str(), "r");
+    if (!env_output) {
+        fprintf(stderr, "Failed to read the environment without %s : %s\n", unset_file.c_str(), strerror(errno));
+        return false;
+    }
+    std::string output;
+    char buffer[4096];
+    size_t read_size;
+    while ((read_size = fread(buffer, 1, sizeof buffer, env_output)) > 0)
+        output.append(buffer, read_size);
+    if (pclose(env_output) != 0) {
+        fprintf(stderr, "Failed to read the environment without %s\n", unset_file.c_str());
+        return false;
+    }
+
+    size_t start = 0;
+    while (start < output.size()) {
+        size_t end = output.find('\0', start);
+        if (end == std::string::npos)
+            end = output.size();
+        addEnvironmentEntry(output.data() + start, end - start, environment);
+        start = end + 1;
+    }
+    return true;
+}
+
+std::vector<std::string> EnvScriptBuilder::environmentStrings(const Environment &environment)
+{
+    std::vector<std::string> strings;
+    strings.reserve(environment.size());
+    for (auto it = environment.begin(); it != environment.end(); ++it)
+        strings.push_back(it->first + "=" + it->second);
+    return strings;
+}
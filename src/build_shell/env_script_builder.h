@@ -30,6 +30,9 @@
 #include <memory>
 #include <list>
 #include <set>
+#include <map>
+#include <vector>
+#include <unordered_map>
 
 namespace JT {
     class ObjectNode;
@@ -66,9 +69,46 @@ public:
 
 };
 
+// An ordered list of variables indexed by name, so that replacing and
+// deduplicating a variable only looks at the variables with the same name
+class EnvVariableList
+{
+public:
+    EnvVariableList();
+    EnvVariableList(const EnvVariableList &other);
+
+    void add(const EnvVariable &variable);
+    void add(const std::vector<EnvVariable> &variables);
+    void addIfNotExistent(const EnvVariable &variable);
+
+    const std::list<EnvVariable> &variables() const { return m_variables; }
+
+private:
+    EnvVariableList &operator=(const EnvVariableList &other);
+
+    struct SameName
+    {
+        SameName() : singular(0) { }
+        std::vector<std::list<EnvVariable>::iterator> variables;
+        size_t singular;
+    };
+    void append(const EnvVariable &variable, SameName &same_name);
+
+    std::list<EnvVariable> m_variables;
+    std::unordered_map<std::string, SameName> m_index;
+};
+
+// The environment of a project is built from the pre and post variables of
+// all the projects before it in the buildset. The variables each project
+// adds to that prefix are kept, and one prefix is moved along the buildset.
+// Asking for the projects in buildset order only costs their own variables,
+// asking for an earlier project replays the prefix from the start. The
+// builder is not thread safe.
 class EnvScriptBuilder
 {
 public:
+    typedef std::map<std::string, std::string> Environment;
+
     EnvScriptBuilder(const Configuration &configuration, const BuildEnvironment &buildEnvironment, JT::ObjectNode *buildset_node);
     ~EnvScriptBuilder();
 
@@ -78,22 +118,55 @@ public:
     void writeSetScript(FILE *file);
     void writeScripts(const std::string &setFileName, const std::string &unsetFileName);
 
+    // The variables the set script of the project exports
+    std::list<EnvVariable> variables() const;
+
+    // True if a value has to be expanded by the shell, then the set script
+    // has to be sourced instead of applying the variables
+    static bool expandsInShell(const std::list<EnvVariable> &variables);
+    // Applies variables to environment like the set script would when it is
+    // sourced in working_directory. Directory variables are only applied if
+    // the directory exists at the time of the call, so the environment of
+    // each phase has to be applied when the phase starts
+    static void applyEnvironment(const Configuration &configuration, const std::list<EnvVariable> &variables,
+                                 const std::string &working_directory, Environment &environment);
+
+    // The environment of this process, without the variables of an active
+    // build_shell environment, as the set script would see it
+    static bool currentEnvironment(Environment &environment);
+    static std::vector<std::string> environmentStrings(const Environment &environment);
+
 private:
     std::list<EnvVariable> make_variable_list_for(const std::string &project_name, bool clean_environment) const;
+    const EnvVariableList &prefixFor(const std::string &project_name) const;
+    const std::vector<EnvVariable> &prefixVariables(size_t index) const;
 
     void writeSetScript(const std::string &unsetFileName, const std::list<EnvVariable> &variables, FILE *file, bool close);
     void writeUnsetScript(const std::string &file, const std::list<EnvVariable> &variables);
     void writeUnsetScript(FILE *file, bool close, const std::list<EnvVariable> &variables);
 
-    void populateListFromVariableNode(const std::string &projectName, JT::ObjectNode *variableNode, std::list<EnvVariable> &variables) const;
-    void populateListFromEnvironmentNode(const std::string &projectName, JT::ObjectNode *environmentNode, std::list<EnvVariable> &variables) const;
-    void populateListFromProjectNode(const std::string &projectName, JT::ObjectNode *projectNode, std::list<EnvVariable> &variables) const;
+    // The variables are appended in the order they have to be added to an
+    // EnvVariableList
+    void populateListFromVariableNode(const std::string &projectName, JT::ObjectNode *variableNode, std::vector<EnvVariable> &variables) const;
+    void populateListFromEnvironmentNode(const std::string &projectName, JT::ObjectNode *environmentNode, bool toProject, std::vector<EnvVariable> &variables) const;
+    void populateListFromProjectNode(const std::string &projectName, JT::ObjectNode *projectNode, bool toProject, std::vector<EnvVariable> &variables) const;
     bool clean_environment() const;
 
     const Configuration &m_configuration;
     const BuildEnvironment &m_build_environment;
     const JT::ObjectNode * const m_buildset_node;
     std::string m_to_project;
+
+    // m_prefix_variables[i] holds what project i in m_project_order adds to
+    // the prefix of the projects after it. m_prefix holds the variables of
+    // the first m_prefix_size projects
+    mutable bool m_has_project_order;
+    mutable std::vector<std::string> m_project_order;
+    mutable std::vector<JT::ObjectNode *> m_project_nodes;
+    mutable std::unordered_map<std::string, size_t> m_project_index;
+    mutable std::vector<std::vector<EnvVariable>> m_prefix_variables;
+    mutable std::unique_ptr<EnvVariableList> m_prefix;
+    mutable size_t m_prefix_size;
 };
 
 #endif
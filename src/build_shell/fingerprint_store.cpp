@@ -0,0 +1,130 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "fingerprint_store.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+Fingerprint::Fingerprint()
+    : m_hash(fnv1a_offset_basis)
+{
+}
+
+void Fingerprint::add(const std::string &name, const std::string &value)
+{
+    hash(name.c_str(), name.size() + 1);
+    hash(value.c_str(), value.size() + 1);
+}
+
+bool Fingerprint::addFile(const std::string &name, const std::string &file)
+{
+    int fd = open(file.c_str(), O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    hash(name.c_str(), name.size() + 1);
+    char buffer[4096];
+    ssize_t read_bytes;
+    while ((read_bytes = read(fd, buffer, sizeof buffer)) != 0) {
+        if (read_bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            close(fd);
+            return false;
+        }
+        hash(buffer, read_bytes);
+    }
+    close(fd);
+    hash("", 1);
+    return true;
+}
+
+std::string Fingerprint::toString() const
+{
+    char buffer[17];
+    snprintf(buffer, sizeof buffer, "%016llx", (unsigned long long) m_hash);
+    return std::string(buffer);
+}
+
+void Fingerprint::hash(const char *data, size_t size)
+{
+    m_hash = fnv1a(data, size, m_hash);
+}
+
+FingerprintStore::FingerprintStore(const Configuration &configuration)
+    : m_configuration(configuration)
+{
+}
+
+std::string FingerprintStore::fingerprint(const std::string &project) const
+{
+    std::string file = fileForProject(project);
+    FILE *stored = fopen(file.c_str(), "re");
+    if (!stored)
+        return std::string();
+
+    char buffer[64];
+    std::string fingerprint;
+    if (fgets(buffer, sizeof buffer, stored)) {
+        fingerprint = buffer;
+        size_t new_line = fingerprint.find('\n');
+        if (new_line != std::string::npos)
+            fingerprint.resize(new_line);
+    }
+    fclose(stored);
+    return fingerprint;
+}
+
+bool FingerprintStore::store(const std::string &project, const std::string &fingerprint) const
+{
+    if (!Configuration::ensurePath(m_configuration.fingerprintDir()))
+        return false;
+
+    std::string file = fileForProject(project);
+    std::string temp_file = file + ".tmp";
+    FILE *out = fopen(temp_file.c_str(), "we");
+    if (!out) {
+        fprintf(stderr, "Failed to open fingerprint file %s : %s\n", temp_file.c_str(), strerror(errno));
+        return false;
+    }
+    fprintf(out, "%s\n", fingerprint.c_str());
+    if (fclose(out) || rename(temp_file.c_str(), file.c_str())) {
+        fprintf(stderr, "Failed to write fingerprint file %s : %s\n", file.c_str(), strerror(errno));
+        unlink(temp_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+void FingerprintStore::remove(const std::string &project) const
+{
+    unlink(fileForProject(project).c_str());
+}
+
+std::string FingerprintStore::fileForProject(const std::string &project) const
+{
+    return m_configuration.fingerprintDir() + "/" + project;
+}
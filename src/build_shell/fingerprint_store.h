@@ -0,0 +1,71 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef FINGERPRINT_STORE_H
+#define FINGERPRINT_STORE_H
+
+#include "configuration.h"
+
+#include <string>
+#include <stdint.h>
+
+// 64 bit FNV-1a of size bytes of data, continuing from hash. Used for the
+// fingerprints, the tree snapshots and the variable names of the build
+// environment
+static const uint64_t fnv1a_offset_basis = 14695981039346656037ULL;
+
+inline uint64_t fnv1a(const char *data, size_t size, uint64_t hash = fnv1a_offset_basis)
+{
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+class Fingerprint
+{
+public:
+    Fingerprint();
+
+    void add(const std::string &name, const std::string &value);
+    bool addFile(const std::string &name, const std::string &file);
+
+    std::string toString() const;
+private:
+    void hash(const char *data, size_t size);
+    uint64_t m_hash;
+};
+
+class FingerprintStore
+{
+public:
+    FingerprintStore(const Configuration &configuration);
+
+    std::string fingerprint(const std::string &project) const;
+    bool store(const std::string &project, const std::string &fingerprint) const;
+    void remove(const std::string &project) const;
+private:
+    std::string fileForProject(const std::string &project) const;
+    const Configuration &m_configuration;
+};
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "job_server.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+JobServer::JobServer(int budget, bool use_fifo, const std::string &temp_dir)
+    : m_budget(budget > 0 ? budget : 1)
+    , m_read_fd(-1)
+    , m_write_fd(-1)
+    , m_had_makeflags(false)
+    , m_implicit_token_taken(false)
+    , m_implicit_token_in_pool(false)
+    , m_waiting_slots(0)
+    , m_error(true)
+{
+    std::string auth;
+    if (use_fifo) {
+        if (!setupFifo(temp_dir))
+            return;
+        auth = "fifo:" + m_fifo_path;
+    } else {
+        if (!setupPipe())
+            return;
+        auth = std::to_string(m_read_fd) + "," + std::to_string(m_write_fd);
+    }
+
+    for (int i = 1; i < m_budget; i++) {
+        releaseToken();
+    }
+
+    const char *makeflags = getenv("MAKEFLAGS");
+    if (makeflags) {
+        m_had_makeflags = true;
+        m_old_makeflags = makeflags;
+    }
+    std::string new_makeflags = m_old_makeflags + " -j" + std::to_string(m_budget) + " --jobserver-auth=" + auth;
+    setenv("MAKEFLAGS", new_makeflags.c_str(), 1);
+
+    m_error = false;
+}
+
+JobServer::~JobServer()
+{
+    if (m_had_makeflags)
+        setenv("MAKEFLAGS", m_old_makeflags.c_str(), 1);
+    else
+        unsetenv("MAKEFLAGS");
+
+    if (m_read_fd >= 0)
+        close(m_read_fd);
+    if (m_write_fd >= 0 && m_write_fd != m_read_fd)
+        close(m_write_fd);
+    if (m_fifo_path.size())
+        unlink(m_fifo_path.c_str());
+    if (m_fifo_dir.size())
+        rmdir(m_fifo_dir.c_str());
+}
+
+bool JobServer::makeSupportsFifo()
+{
+    FILE *make_version = popen("make --version 2>/dev/null", "r");
+    if (!make_version)
+        return true;
+    char line[256];
+    int major = 0;
+    int minor = 0;
+    bool gnu_make = fgets(line, sizeof line, make_version)
+        && sscanf(line, "GNU Make %d.%d", &major, &minor) >= 1;
+    pclose(make_version);
+    if (!gnu_make)
+        return true;
+    return major > 4 || (major == 4 && minor >= 4);
+}
+
+bool JobServer::setupPipe()
+{
+    // The pipe is inherited on purpose, make finds it through MAKEFLAGS
+    int fds[2];
+    if (pipe(fds)) {
+        fprintf(stderr, "Failed to create jobserver pipe: %s\n", strerror(errno));
+        return false;
+    }
+    m_read_fd = fds[0];
+    m_write_fd = fds[1];
+    return true;
+}
+
+bool JobServer::setupFifo(const std::string &temp_dir)
+{
+    std::string dir_template = temp_dir + "/build_shell_jobserver_XXXXXX";
+    if (!mkdtemp(&dir_template[0])) {
+        fprintf(stderr, "Failed to create jobserver directory %s: %s\n", dir_template.c_str(), strerror(errno));
+        return false;
+    }
+    m_fifo_dir = dir_template;
+    std::string fifo_path = m_fifo_dir + "/fifo";
+    if (mkfifo(fifo_path.c_str(), S_IRUSR|S_IWUSR)) {
+        fprintf(stderr, "Failed to create jobserver fifo %s: %s\n", fifo_path.c_str(), strerror(errno));
+        return false;
+    }
+    m_fifo_path = fifo_path;
+    m_read_fd = open(m_fifo_path.c_str(), O_RDWR|O_CLOEXEC);
+    if (m_read_fd < 0) {
+        fprintf(stderr, "Failed to open jobserver fifo %s: %s\n", m_fifo_path.c_str(), strerror(errno));
+        return false;
+    }
+    m_write_fd = m_read_fd;
+    return true;
+}
+
+bool JobServer::acquireToken()
+{
+    char token;
+    while (true) {
+        ssize_t r = read(m_read_fd, &token, 1);
+        if (r == 1)
+            return true;
+        if (r < 0 && errno == EINTR)
+            continue;
+        fprintf(stderr, "Failed to read token from jobserver: %s\n", r < 0 ? strerror(errno) : "end of file");
+        return false;
+    }
+}
+
+void JobServer::releaseToken()
+{
+    const char token = '+';
+    while (write(m_write_fd, &token, 1) < 0 && errno == EINTR)
+        ;
+}
+
+JobServer::Slot::Slot(JobServer &job_server)
+    : m_job_server(job_server)
+    , m_implicit(false)
+    , m_has_token(false)
+{
+    if (m_job_server.m_error)
+        return;
+    {
+        std::unique_lock<std::mutex> lock(m_job_server.m_mutex);
+        if (!m_job_server.m_implicit_token_taken) {
+            m_job_server.m_implicit_token_taken = true;
+            m_implicit = true;
+            return;
+        }
+        m_job_server.m_waiting_slots++;
+    }
+    m_has_token = m_job_server.acquireToken();
+    std::unique_lock<std::mutex> lock(m_job_server.m_mutex);
+    m_job_server.m_waiting_slots--;
+}
+
+JobServer::Slot::~Slot()
+{
+    std::unique_lock<std::mutex> lock(m_job_server.m_mutex);
+    if (m_implicit) {
+        // Projects blocked on the pool would never see the implicit token,
+        // so lend it to the pool and take it back on the next release
+        if (m_job_server.m_waiting_slots) {
+            m_job_server.m_implicit_token_in_pool = true;
+            m_job_server.releaseToken();
+        } else {
+            m_job_server.m_implicit_token_taken = false;
+        }
+    } else if (m_has_token) {
+        if (m_job_server.m_implicit_token_in_pool && !m_job_server.m_waiting_slots) {
+            m_job_server.m_implicit_token_in_pool = false;
+            m_job_server.m_implicit_token_taken = false;
+        } else {
+            m_job_server.releaseToken();
+        }
+    }
+}
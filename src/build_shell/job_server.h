@@ -0,0 +1,77 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef JOB_SERVER_H
+#define JOB_SERVER_H
+
+#include <string>
+#include <mutex>
+
+// A GNU make compatible jobserver. The token pool is exported through
+// MAKEFLAGS, so every make started by build_shell shares the same budget.
+class JobServer
+{
+public:
+    JobServer(int budget, bool use_fifo, const std::string &temp_dir);
+    ~JobServer();
+
+    // Ninja only understands a fifo, but make older than 4.4 fails to
+    // start when it is given one. True unless the make in PATH is older
+    static bool makeSupportsFifo();
+
+    bool error() const { return m_error; }
+    int budget() const { return m_budget; }
+
+    // Like make itself build_shell owns one implicit token. The first
+    // project to start uses it, every other concurrently running project
+    // has to take a token from the pool.
+    class Slot
+    {
+    public:
+        Slot(JobServer &job_server);
+        ~Slot();
+    private:
+        JobServer &m_job_server;
+        bool m_implicit;
+        bool m_has_token;
+    };
+
+private:
+    bool acquireToken();
+    void releaseToken();
+    bool setupPipe();
+    bool setupFifo(const std::string &temp_dir);
+
+    int m_budget;
+    int m_read_fd;
+    int m_write_fd;
+    std::string m_fifo_dir;
+    std::string m_fifo_path;
+    bool m_had_makeflags;
+    std::string m_old_makeflags;
+    bool m_implicit_token_taken;
+    bool m_implicit_token_in_pool;
+    int m_waiting_slots;
+    std::mutex m_mutex;
+    bool m_error;
+};
+
+#endif
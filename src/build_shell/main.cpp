@@ -31,8 +31,10 @@
 #include "correct_branch_action.h"
 #include "buildset_printer_action.h"
 #include "print_environment_action.h"
+#include "report_action.h"
 
 #include <vector>
+#include <stdlib.h>
 #include <iostream>
 
 #include "../3rdparty/optionparser/src/optionparser.h"
@@ -57,7 +59,17 @@ enum optionIndex {
     SKIP_CONFIGURE,
     SKIP_BUILD,
     NO_REGISTER,
-    PRINT
+    PRINT,
+    JOBS,
+    MAKE_JOBS,
+    JOB_SERVER,
+    FORCE,
+    CACHE_DIR,
+    CACHE_SIZE,
+    PULL_AHEAD,
+    PERSISTENT_SHELL,
+    DIRECT_ENV,
+    TRACE
 };
 
 const option::Descriptor usage[] =
@@ -67,7 +79,8 @@ const option::Descriptor usage[] =
                                                                             "  generate\t generate a new buildset file\n"
                                                                             "  create\t create a buildset environment\n\n"
                                                                             "  pull\t pulls sources specified in buildsetfile\n"
-                                                                            "  build\t builds a buildset file\n\n"
+                                                                            "  build\t builds a buildset file\n"
+                                                                            "  report\t summarises the resources used by the last build\n\n"
                                                                             "Options:" },
   {HELP,          0, "h" , "help",            option::Arg::None,            "  --help, -h\tPrint usage and exit." },
   {SRC_DIR,       0, "s", "src-dir",          Arg::requiresArg,             "  --src-dir, -s  \tSource dir, where projects are cloned\v"
@@ -94,6 +107,27 @@ const option::Descriptor usage[] =
   {SKIP_BUILD,    0, "" , "skip-build",       option::Arg::None,            "  --skip-build     \tSkipping the build step when running in build mode"},
   {NO_REGISTER,   0, "" , "no-register",      option::Arg::None,            "  --no-register    \tDon't register the build"},
   {PRINT,         0, "" , "print",            option::Arg::None,            "  --print          \tPrint all output"},
+  {JOBS,          0, "j", "jobs",             Arg::requiresPositiveNumber,  "  --jobs, -j       \tNumber of projects to build or pull concurrently.\v"
+                                                                            "     Builds are ordered by the depends_on property. Defaults to 1"},
+  {MAKE_JOBS,     0, "" , "make-jobs",        Arg::requiresPositiveNumber,  "  --make-jobs      \tTotal number of make jobs shared by all projects\v"
+                                                                            "     being built. Defaults to the number of cpus"},
+  {JOB_SERVER,    0, "" , "jobserver",        Arg::requiresJobServerType,   "  --jobserver      \tHow the make jobs are shared: fifo, pipe or auto.\v"
+                                                                            "     Only Ninja and GNU make 4.4 or newer understand a fifo.\v"
+                                                                            "     auto uses it unless make is older. Defaults to auto"},
+  {FORCE,         0, "" , "force",            option::Arg::None,            "  --force          \tBuild projects even if nothing changed since their\v"
+                                                                            "     last successful build"},
+  {CACHE_DIR,     0, "" , "cache-dir",        Arg::requiresArg,             "  --cache-dir      \tDirectory used as binary cache for installed projects.\v"
+                                                                            "     Can be shared between build dirs"},
+  {CACHE_SIZE,    0, "" , "cache-size",       Arg::requiresSize,            "  --cache-size     \tMaximum size of the binary cache, ie. 20G. Least\v"
+                                                                            "     recently used entries are evicted. Defaults to 10G"},
+  {PULL_AHEAD,    0, "" , "pull-ahead",       Arg::requiresPositiveNumber,  "  --pull-ahead     \tWith --pull-first, number of projects pulled in the\v"
+                                                                            "     background ahead of the builds. Defaults to 2"},
+  {PERSISTENT_SHELL, 0, "" , "persistent-shell", option::Arg::None,         "  --persistent-shell \tSource the environment of a project once and run\v"
+                                                                            "     its configure, build and install scripts in the same shell"},
+  {DIRECT_ENV,    0, "" , "direct-env",       option::Arg::None,            "  --direct-env     \tPass the environment of a project to the scripts\v"
+                                                                            "     directly instead of sourcing the environment script"},
+  {TRACE,         0, "" , "trace",            Arg::requiresArg,             "  --trace          \tWrite the phases of the build to a file in Chrome trace\v"
+                                                                            "     event format, for chrome://tracing or Perfetto"},
 
   {UNKNOWN, 0,"" ,  ""   ,                    option::Arg::None,            "\nExamples:\n"
                                                                             "  build_shell --src-dir /some/file -f ../some/buildset_file pull\n"},
@@ -148,6 +182,8 @@ int main(int argc, char **argv)
             configuration.setMode(Configuration::PrintEnv, mode);
         } else if (mode == "correct-branch") {
             configuration.setMode(Configuration::CorrectBranch, mode);
+        } else if (mode == "report") {
+            configuration.setMode(Configuration::Report, mode);
         } else {
             fprintf(stderr, "\nFailed to recognize mode: %s\n\n", mode.c_str());
             return 1;
@@ -229,6 +265,42 @@ int main(int argc, char **argv)
             case CORRECT_BRANCH:
                 configuration.setCorrectBranch(true);
                 break;
+            case JOBS:
+                configuration.setJobs(atoi(opt.arg));
+                break;
+            case MAKE_JOBS:
+                configuration.setMakeJobs(atoi(opt.arg));
+                break;
+            case JOB_SERVER: {
+                Configuration::JobServerType job_server_type = Configuration::JobServerAuto;
+                Arg::parseJobServerType(opt.arg, &job_server_type);
+                configuration.setJobServerType(job_server_type);
+                break;
+            }
+            case FORCE:
+                configuration.setForce(true);
+                break;
+            case CACHE_DIR:
+                configuration.setCacheDir(opt.arg);
+                break;
+            case PULL_AHEAD:
+                configuration.setPullAhead(atoi(opt.arg));
+                break;
+            case PERSISTENT_SHELL:
+                configuration.setPersistentShell(true);
+                break;
+            case DIRECT_ENV:
+                configuration.setDirectEnv(true);
+                break;
+            case TRACE:
+                configuration.setTraceFile(opt.arg);
+                break;
+            case CACHE_SIZE: {
+                unsigned long long cache_size = 0;
+                Arg::parseSize(opt.arg, &cache_size);
+                configuration.setCacheSize(cache_size);
+                break;
+            }
             case UNKNOWN:
                 fprintf(stderr, "UNKNOWN!");
                 // not possible because Arg::Unknown returns ARG_ILLEGAL
@@ -270,6 +342,9 @@ int main(int argc, char **argv)
             case Configuration::CorrectBranch:
                 action = new CorrectBranchAction(configuration);
                 break;
+            case Configuration::Report:
+                action = new ReportAction(configuration);
+                break;
             default:
                 fprintf(stderr, "Mode is invalid %s. Exiting\n", configuration.modeString().c_str());
                 exit(1);
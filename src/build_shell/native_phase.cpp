@@ -0,0 +1,155 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "native_phase.h"
+
+#include "build_environment.h"
+#include "json_tree.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static bool NO_NATIVE_PHASES = getenv("BUILD_SHELL_NO_NATIVE_PHASES") != 0;
+
+static const char *build_systems[] = { "cmake", "qmake", "autotools", "autoreconf" };
+static const char *phases[] = { "configure", "build", "install", "clean" };
+
+NativePhase::NativePhase(const Configuration &configuration, const std::string &phase, const std::string &build_system)
+    : m_configuration(configuration)
+    , m_phase(phase)
+    , m_build_system(build_system)
+{
+}
+
+bool NativePhase::handles(const std::string &script) const
+{
+    if (NO_NATIVE_PHASES)
+        return false;
+
+    bool known_phase = false;
+    for (size_t i = 0; i < sizeof phases / sizeof phases[0]; i++) {
+        if (m_phase == phases[i])
+            known_phase = true;
+    }
+    bool known_build_system = false;
+    for (size_t i = 0; i < sizeof build_systems / sizeof build_systems[0]; i++) {
+        if (m_build_system == build_systems[i])
+            known_build_system = true;
+    }
+    if (!known_phase || !known_build_system)
+        return false;
+
+    // Only the script we ship, a script found earlier in the search path
+    // or a project specific script is run as usual
+    std::string default_script = SCRIPTS_PATH;
+    if (default_script.back() != '/')
+        default_script.append("/");
+    default_script += m_phase + "_" + m_build_system;
+    return script == default_script;
+}
+
+static std::string projectValue(const std::string &project_name,
+                                const JT::ObjectNode *project_node,
+                                const BuildEnvironment *build_environment,
+                                const std::string &path)
+{
+    std::string value = project_node->stringAt(path);
+    if (build_environment && BuildEnvironment::hasVariables(value.c_str(), value.size()))
+        value = build_environment->expandVariablesInString(value, project_name);
+    return value;
+}
+
+// The scripts pass configure_args unquoted, so it is split on white space
+static void appendSplit(const std::string &args, std::vector<std::string> &command)
+{
+    size_t pos = 0;
+    while (pos < args.size()) {
+        size_t start = args.find_first_not_of(" \t\n", pos);
+        if (start == std::string::npos)
+            break;
+        size_t end = args.find_first_of(" \t\n", start);
+        if (end == std::string::npos)
+            end = args.size();
+        command.push_back(args.substr(start, end - start));
+        pos = end;
+    }
+}
+
+std::vector<std::vector<std::string>> NativePhase::commands(const std::string &project_name,
+                                                            const JT::ObjectNode *project_node,
+                                                            const BuildEnvironment *build_environment) const
+{
+    std::vector<std::vector<std::string>> commands;
+
+    if (m_phase == "build") {
+        std::vector<std::string> command;
+        command.push_back("make");
+        // build_shell exports a jobserver through MAKEFLAGS, passing -j would
+        // make make start its own
+        const char *make_flags = getenv("MAKEFLAGS");
+        if (!make_flags || !strstr(make_flags, "--jobserver-auth="))
+            command.push_back("-j" + std::to_string(m_configuration.makeJobs()));
+        commands.push_back(command);
+        return commands;
+    }
+
+    if (m_phase == "install" || m_phase == "clean") {
+        std::vector<std::string> command;
+        command.push_back("make");
+        command.push_back(m_phase);
+        commands.push_back(command);
+        return commands;
+    }
+
+    const std::string src_path = projectValue(project_name, project_node, build_environment, "arguments.src_path");
+    const std::string install_path = projectValue(project_name, project_node, build_environment, "arguments.install_path");
+    const std::string configure_args = projectValue(project_name, project_node, build_environment, "configure_args");
+    bool no_install = project_node->booleanAt("no_install") || project_node->stringAt("no_install") == "true";
+
+    std::vector<std::string> command;
+    if (m_build_system == "cmake") {
+        command.push_back("cmake");
+        if (!no_install)
+            command.push_back("-DCMAKE_INSTALL_PREFIX:PATH=" + install_path);
+        appendSplit(configure_args, command);
+        command.push_back(src_path);
+    } else if (m_build_system == "qmake") {
+        command.push_back("qmake");
+        command.push_back(src_path);
+        appendSplit(configure_args, command);
+    } else {
+        if (m_build_system == "autoreconf") {
+            std::vector<std::string> autoreconf;
+            autoreconf.push_back("autoreconf");
+            autoreconf.push_back("-i");
+            autoreconf.push_back(src_path);
+            commands.push_back(autoreconf);
+            command.push_back(src_path + "/configure");
+        } else {
+            command.push_back(src_path + "/autogen.sh");
+        }
+        if (!no_install)
+            command.push_back("--prefix=" + install_path);
+        appendSplit(configure_args, command);
+    }
+    commands.push_back(command);
+    return commands;
+}
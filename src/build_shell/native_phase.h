@@ -0,0 +1,56 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef NATIVE_PHASE_H
+#define NATIVE_PHASE_H
+
+#include "configuration.h"
+
+#include <string>
+#include <vector>
+
+namespace JT {
+    class ObjectNode;
+}
+class BuildEnvironment;
+
+// The configure, build, install and clean scripts shipped for cmake, qmake,
+// autotools and autoreconf only read a few values from the project node. When
+// no other script overrides them the commands are computed here instead, which
+// saves starting bash for the script and jsonmod for every value it reads.
+class NativePhase
+{
+public:
+    NativePhase(const Configuration &configuration, const std::string &phase, const std::string &build_system);
+
+    bool handles(const std::string &script) const;
+
+    std::vector<std::vector<std::string>> commands(const std::string &project_name,
+                                                   const JT::ObjectNode *project_node,
+                                                   const BuildEnvironment *build_environment) const;
+
+private:
+    const Configuration &m_configuration;
+    std::string m_phase;
+    std::string m_build_system;
+};
+
+#endif
@@ -0,0 +1,290 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "output_reactor.h"
+#include "child_output.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+static int openPidFd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void) pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+OutputReactor::OutputReactor()
+    : m_epoll_fd(-1)
+    , m_wake_fd(-1)
+    , m_stop(false)
+    , m_error(true)
+    , m_splice(ChildOutput::spliceEnabled())
+    , m_buffer(ChildOutput::BUFFER_SIZE)
+{
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd < 0) {
+        fprintf(stderr, "Failed to create epoll instance for output: %s\n", strerror(errno));
+        return;
+    }
+    m_wake_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    if (m_wake_fd < 0) {
+        fprintf(stderr, "Failed to create eventfd for output: %s\n", strerror(errno));
+        return;
+    }
+    epoll_event event;
+    memset(&event, 0, sizeof event);
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &event)) {
+        fprintf(stderr, "Failed to add eventfd to epoll: %s\n", strerror(errno));
+        return;
+    }
+    m_thread = std::thread(&OutputReactor::loop, this);
+    m_error = false;
+}
+
+OutputReactor::~OutputReactor()
+{
+    if (m_thread.joinable()) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        uint64_t wake = 1;
+        if (write(m_wake_fd, &wake, sizeof wake) < 0)
+            fprintf(stderr, "Failed to stop output reactor: %s\n", strerror(errno));
+        m_thread.join();
+    }
+    if (m_wake_fd >= 0)
+        close(m_wake_fd);
+    if (m_epoll_fd >= 0)
+        close(m_epoll_fd);
+}
+
+int OutputReactor::run(pid_t pid, int stdout_fd, int stderr_fd, int out_file,
+                       bool print_stdout, bool print_stderr, const std::string &prefix,
+                       ProcessUsage *usage)
+{
+    Job job;
+    job.pid = pid;
+    job.out_file = out_file;
+    job.prefix = "[" + prefix + "] ";
+    job.exit_code = -1;
+    memset(&job.resource_usage, 0, sizeof job.resource_usage);
+    job.output_bytes = 0;
+    job.done = false;
+
+    int fds[3] = { stdout_fd, stderr_fd, openPidFd(pid) };
+    bool prints[3] = { print_stdout, print_stderr, false };
+    // Without a pidfd the caller reaps the child itself
+    job.exited = fds[2] < 0;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (int i = 0; i < 3; i++) {
+        Source &source = job.sources[i];
+        source.job = &job;
+        source.fd = fds[i];
+        source.is_pid = i == 2;
+        source.print = prints[i];
+        source.done = fds[i] < 0;
+        if (source.done)
+            continue;
+
+        if (!source.is_pid) {
+            fcntl(source.fd, F_SETFL, fcntl(source.fd, F_GETFL) | O_NONBLOCK);
+            fcntl(source.fd, F_SETPIPE_SZ, ChildOutput::PIPE_SIZE);
+        }
+        epoll_event event;
+        memset(&event, 0, sizeof event);
+        event.events = EPOLLIN;
+        event.data.ptr = &source;
+        if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, source.fd, &event)) {
+            fprintf(stderr, "Failed to add output of %s to epoll: %s\n", prefix.c_str(), strerror(errno));
+            close(source.fd);
+            source.fd = -1;
+            source.done = true;
+            if (source.is_pid)
+                job.exited = true;
+        }
+    }
+    job.done = job.exited && job.sources[0].done && job.sources[1].done;
+
+    job.wait_condition.wait(lock, [&job] { return job.done; });
+    lock.unlock();
+
+    if (job.sources[2].fd < 0 && job.exit_code < 0) {
+        int status;
+        pid_t wpid;
+        do {
+            wpid = wait4(pid, &status, 0, &job.resource_usage);
+        } while (wpid < 0 && errno == EINTR);
+        if (wpid < 0) {
+            fprintf(stderr, "Failed to wait for %s : %s\n", prefix.c_str(), strerror(errno));
+            return -1;
+        }
+        job.exit_code = ChildOutput::exitCode(status);
+    }
+    if (usage) {
+        usage->addChild(job.resource_usage);
+        usage->output_bytes += job.output_bytes;
+    }
+    return job.exit_code;
+}
+
+void OutputReactor::loop()
+{
+    epoll_event events[64];
+    while (true) {
+        int count = epoll_wait(m_epoll_fd, events, sizeof events / sizeof events[0], -1);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Output reactor epoll_wait failed: %s\n", strerror(errno));
+            return;
+        }
+
+        // Jobs can not return while the lock is held, so sources closed
+        // earlier in this batch are still valid
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (int i = 0; i < count; i++) {
+            Source *source = static_cast<Source *>(events[i].data.ptr);
+            if (!source) {
+                uint64_t wake;
+                if (read(m_wake_fd, &wake, sizeof wake) < 0 && errno != EAGAIN)
+                    fprintf(stderr, "Failed to read output reactor eventfd: %s\n", strerror(errno));
+                if (m_stop)
+                    return;
+                continue;
+            }
+            if (source->done)
+                continue;
+            if (source->is_pid)
+                handleExit(*source);
+            else
+                handleOutput(*source);
+        }
+    }
+}
+
+void OutputReactor::handleOutput(Source &source)
+{
+    Job &job = *source.job;
+    bool print_data = ChildOutput::alwaysPrint() || source.print || job.out_file < 0;
+
+    if (!print_data && m_splice) {
+        ChildOutput::SpliceResult result = ChildOutput::splice(source.fd, job.out_file, &job.output_bytes);
+        if (result == ChildOutput::EndOfInput) {
+            closeSource(source);
+            return;
+        } else if (result == ChildOutput::Spliced) {
+            return;
+        }
+        m_splice = false;
+    }
+
+    ssize_t r = read(source.fd, m_buffer.data(), m_buffer.size());
+    if (r == 0) {
+        closeSource(source);
+        return;
+    } else if (r < 0) {
+        if (errno != EAGAIN && errno != EINTR)
+            closeSource(source);
+        return;
+    }
+
+    job.output_bytes += r;
+    if (!ChildOutput::flushToFile(job.out_file, m_buffer.data(), r))
+        fprintf(stderr, "Failed to write to out_file %s\n", strerror(errno));
+    if (print_data) {
+        source.line.append(m_buffer.data(), r);
+        printLines(source, false);
+    }
+}
+
+void OutputReactor::handleExit(Source &source)
+{
+    Job &job = *source.job;
+    int status;
+    pid_t wpid;
+    do {
+        wpid = wait4(job.pid, &status, WNOHANG, &job.resource_usage);
+    } while (wpid < 0 && errno == EINTR);
+    if (wpid == 0)
+        return;
+    if (wpid < 0)
+        fprintf(stderr, "Failed to wait for %s : %s\n", job.prefix.c_str(), strerror(errno));
+    else
+        job.exit_code = ChildOutput::exitCode(status);
+    job.exited = true;
+    closeSource(source);
+}
+
+void OutputReactor::closeSource(Source &source)
+{
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, source.fd, nullptr))
+        fprintf(stderr, "Failed to remove output from epoll: %s\n", strerror(errno));
+    if (!source.is_pid)
+        printLines(source, true);
+    close(source.fd);
+    source.done = true;
+
+    Job &job = *source.job;
+    if (job.exited && job.sources[0].done && job.sources[1].done) {
+        job.done = true;
+        job.wait_condition.notify_one();
+    }
+}
+
+void OutputReactor::printLines(Source &source, bool flush)
+{
+    const std::string &prefix = source.job->prefix;
+    std::string out;
+    size_t start = 0;
+    size_t end;
+    while ((end = source.line.find('\n', start)) != std::string::npos) {
+        out += prefix;
+        out.append(source.line, start, end + 1 - start);
+        start = end + 1;
+    }
+    // A line without newline is not held back forever
+    if (start < source.line.size() && (flush || source.line.size() - start > ChildOutput::BUFFER_SIZE)) {
+        out += prefix;
+        out.append(source.line, start, std::string::npos);
+        out += '\n';
+        start = source.line.size();
+    }
+    source.line.erase(0, start);
+    if (out.size() && !ChildOutput::flushToFile(STDOUT_FILENO, out.data(), out.size()))
+        fprintf(stderr, "Failed to write to stdout %s\n", strerror(errno));
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef OUTPUT_REACTOR_H
+#define OUTPUT_REACTOR_H
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "process_usage.h"
+
+// One thread multiplexing the output of all running children with epoll.
+// Output is written to the log file of each child as it arrives. Printed
+// output is line buffered and prefixed with the project name, so lines of
+// concurrently running projects do not mix. The exit of a child is
+// noticed through a pidfd, on kernels without pidfd_open the waiting
+// thread reaps its own child when the output is closed.
+class OutputReactor
+{
+public:
+    OutputReactor();
+    ~OutputReactor();
+
+    bool error() const { return m_error; }
+
+    // Takes ownership of the read ends of the childs stdout and stderr pipes
+    // and blocks until the child has exited and the pipes are closed.
+    // Returns the exit code of the child, or -1 if it could not be waited for.
+    // The resources used by the child are added to usage
+    int run(pid_t pid, int stdout_fd, int stderr_fd, int out_file,
+            bool print_stdout, bool print_stderr, const std::string &prefix,
+            ProcessUsage *usage = nullptr);
+
+private:
+    struct Job;
+    struct Source
+    {
+        Job *job;
+        int fd;
+        bool is_pid;
+        bool print;
+        bool done;
+        std::string line;
+    };
+    struct Job
+    {
+        pid_t pid;
+        int out_file;
+        std::string prefix;
+        Source sources[3];
+        int exit_code;
+        struct rusage resource_usage;
+        unsigned long long output_bytes;
+        bool exited;
+        bool done;
+        std::condition_variable wait_condition;
+    };
+
+    void loop();
+    void handleOutput(Source &source);
+    void handleExit(Source &source);
+    void closeSource(Source &source);
+    void printLines(Source &source, bool flush);
+
+    int m_epoll_fd;
+    int m_wake_fd;
+    bool m_stop;
+    bool m_error;
+    bool m_splice;
+    std::vector<char> m_buffer;
+    std::mutex m_mutex;
+    std::thread m_thread;
+};
+
+#endif //OUTPUT_REACTOR_H
@@ -25,6 +25,14 @@
 #include "buildset_tree_writer.h"
 #include "tree_builder.h"
 #include "child_process_io_handler.h"
+#include "child_output.h"
+#include "shell_coprocess.h"
+#include "native_phase.h"
+#include "build_environment.h"
+#include "project_node_snapshot.h"
+#include "output_reactor.h"
+#include "build_report.h"
+#include "build_trace.h"
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -32,9 +40,13 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <time.h>
 
 #include <assert.h>
 
+#include <set>
+
 static bool DEBUG_EXEC_SCRIPT = getenv("BUILD_SHELL_DEBUG_EXEC_SCRIPT") != 0;
 
 Process::Process(const Configuration &configuration)
@@ -43,8 +55,15 @@ Process::Process(const Configuration &configuration)
     , m_log_file(-1)
     , m_close_log_file(false)
     , m_print(false)
+    , m_print_errors(true)
     , m_script_has_to_exist(true)
     , m_project_node(0)
+    , m_shell(nullptr)
+    , m_snapshot(nullptr)
+    , m_environment(nullptr)
+    , m_output_reactor(nullptr)
+    , m_build_report(nullptr)
+    , m_build_trace(nullptr)
 {
 }
 
@@ -55,6 +74,43 @@ Process::~Process()
     }
 }
 
+// Scripts write path=value lines to $BS_RESULT instead of rewriting the
+// project file with jsonmod once per value. The file is emptied once merged.
+static bool mergeResultFile(const std::string &result_file, JT::ObjectNode *root)
+{
+    FILE *file = fopen(result_file.c_str(), "re");
+    if (!file)
+        return false;
+
+    bool merged = false;
+    char *line = nullptr;
+    size_t line_capacity = 0;
+    ssize_t line_size;
+    while ((line_size = getline(&line, &line_capacity, file)) > 0) {
+        std::string entry(line, line_size);
+        if (entry.back() == '\n')
+            entry.pop_back();
+        if (!entry.size())
+            continue;
+        size_t equals = entry.find('=');
+        if (equals == std::string::npos || equals == 0) {
+            fprintf(stderr, "Ignoring result line without path: %s\n", entry.c_str());
+            continue;
+        }
+        std::string path = entry.substr(0, equals);
+        std::string value = entry.substr(equals + 1);
+        JT::Token::Type type = value == "true" || value == "false" ? JT::Token::Bool : JT::Token::String;
+        root->addValueToObject(path, value, type);
+        merged = true;
+    }
+    free(line);
+    fclose(file);
+
+    if (merged)
+        truncate(result_file.c_str(), 0);
+    return merged;
+}
+
 class LogFileResetter
 {
 public:
@@ -75,6 +131,26 @@ public:
 };
 
 bool Process::run(JT::ObjectNode **returnedObjectNode)
+{
+    m_usage = ProcessUsage();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    bool success = runPhase(returnedObjectNode);
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    m_usage.wall_seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+    // Phases without a script are not reported
+    if (m_build_report && m_usage.processes)
+        m_build_report->add(m_project_name, m_phase, success, m_usage);
+    if (m_build_trace && m_usage.processes)
+        m_build_trace->span(m_phase, success ? "phase" : "failed phase", m_project_name, start, end);
+    return success;
+}
+
+bool Process::runPhase(JT::ObjectNode **returnedObjectNode)
 {
     if (returnedObjectNode)
         *returnedObjectNode = 0;
@@ -95,10 +171,6 @@ bool Process::run(JT::ObjectNode **returnedObjectNode)
         resetter.resetLog = true;
     }
 
-    std::string temp_file;
-
-    if (!flushProjectNodeToTemporaryFile(m_project_name, m_project_node, temp_file))
-        return false;
     std::string primary_script = m_phase + "_" + m_project_name;
     std::string fallback_script = m_fallback.size() ? m_phase + "_" + m_fallback : "";
 
@@ -110,17 +182,53 @@ bool Process::run(JT::ObjectNode **returnedObjectNode)
         return false;
     }
 
+    NativePhase native_phase(m_configuration, m_phase, m_fallback);
+    if (!returnedObjectNode && m_project_node && scripts.size() && native_phase.handles(scripts.front()))
+        return runNativePhase(native_phase);
+
+    // Scripts returning a node may rewrite their input, so they get a
+    // temporary file of their own
+    bool use_snapshot = m_snapshot && !m_snapshot->error() && !returnedObjectNode;
+
+    std::string temp_file;
+    ScriptEnvironment script_environment;
+    if (use_snapshot) {
+        temp_file = m_snapshot->path();
+        script_environment = m_snapshot->environment();
+    } else {
+        if (!flushProjectNodeToTemporaryFile(m_project_name, m_project_node, temp_file))
+            return false;
+        if (m_project_node)
+            ProjectNodeSnapshot::flatten(m_project_node, m_build_environment, m_project_name, "BS_ARG", script_environment);
+    }
+
+    // Only the returned node is read back, so other phases get /dev/null
+    std::string result_file;
+    if (returnedObjectNode) {
+        int result_fd = m_configuration.createTempFile(m_project_name + "_result", result_file);
+        if (result_fd < 0) {
+            fprintf(stderr, "Could not create result file for project %s\n", m_project_name.c_str());
+            unlink(temp_file.c_str());
+            return false;
+        }
+        close(result_fd);
+        script_environment.push_back(std::make_pair(std::string("BS_RESULT"), result_file));
+    } else {
+        script_environment.push_back(std::make_pair(std::string("BS_RESULT"), std::string("/dev/null")));
+    }
+    script_environment.insert(script_environment.end(), m_extra_environment.begin(), m_extra_environment.end());
+
     bool temp_file_removed = false;
 
     std::string arguments =  m_project_name + " " + temp_file;
     for (auto it = scripts.begin(); it != scripts.end(); ++it) {
-        int exit_code = runScript(m_environement_script, (*it), arguments,  m_log_file);
+        int exit_code = runScript(m_environement_script, (*it), arguments,  m_log_file, script_environment);
         if (exit_code) {
             fprintf(stderr, "Script %s for project %s failed in execution\n", it->c_str(), m_project_name.c_str());
             return_val = false;
             break;
         }
-        if (access(temp_file.c_str(), F_OK)) {
+        if (!use_snapshot && access(temp_file.c_str(), F_OK)) {
             temp_file_removed = true;
             fprintf(stderr, "The script removed the temporary input file, assuming failur\n");
             return_val = false;
@@ -131,8 +239,14 @@ bool Process::run(JT::ObjectNode **returnedObjectNode)
             tree_builder.load();
             JT::ObjectNode *root = tree_builder.rootNode();
             if (root) {
-                if (root->booleanAt("arguments.propogate_to_next_script"))
+                bool merged_results = mergeResultFile(result_file, root);
+                if (root->booleanAt("arguments.propogate_to_next_script")) {
+                    if (merged_results) {
+                        TreeWriter writer(temp_file);
+                        writer.write(root);
+                    }
                     continue;
+                }
                 *returnedObjectNode = tree_builder.takeRootNode();
             } else  {
                 fprintf(stderr, "Failed to demarshal the temporary file returned from the script %s\n", (*it).c_str());
@@ -141,9 +255,12 @@ bool Process::run(JT::ObjectNode **returnedObjectNode)
         }
         break;
     }
-    if (!temp_file_removed) {
+    if (!use_snapshot && !temp_file_removed) {
         unlink(temp_file.c_str());
     }
+    if (result_file.size()) {
+        unlink(result_file.c_str());
+    }
 
     return return_val;
 }
@@ -168,6 +285,11 @@ void Process::setFallback(const std::string &fallback)
     m_fallback = fallback;
 }
 
+void Process::setWorkingDirectory(const std::string &working_directory)
+{
+    m_working_directory = working_directory;
+}
+
 void Process::setLogFile(int logFile, bool closeFileOnDelete)
 {
     if (m_close_log_file && m_log_file >= 0) {
@@ -227,11 +349,56 @@ void Process::setPrint(bool print)
     m_print = print;
 }
 
+void Process::setPrintErrors(bool print)
+{
+    m_print_errors = print;
+}
+
 void Process::setScriptHasToExist(bool exist)
 {
     m_script_has_to_exist = exist;
 }
 
+void Process::setShell(ShellCoprocess *shell)
+{
+    m_shell = shell;
+}
+
+void Process::setProjectNodeSnapshot(const ProjectNodeSnapshot *snapshot)
+{
+    m_snapshot = snapshot;
+}
+
+void Process::setEnvironment(const std::vector<std::string> *environment)
+{
+    m_environment = environment;
+}
+
+void Process::addEnvironment(const std::string &name, const std::string &value)
+{
+    m_extra_environment.push_back(std::make_pair(name, value));
+}
+
+void Process::setOutputReactor(OutputReactor *output_reactor)
+{
+    m_output_reactor = output_reactor;
+}
+
+void Process::setBuildReport(BuildReport *build_report)
+{
+    m_build_report = build_report;
+}
+
+void Process::setBuildTrace(BuildTrace *build_trace)
+{
+    m_build_trace = build_trace;
+}
+
+const ProcessUsage &Process::usage() const
+{
+    return m_usage;
+}
+
 bool Process::flushProjectNodeToTemporaryFile(const std::string &project_name, const JT::ObjectNode *node, std::string &file_flushed_to) const
 {
     int temp_file = m_configuration.createTempFile(project_name, file_flushed_to);
@@ -241,29 +408,37 @@ bool Process::flushProjectNodeToTemporaryFile(const std::string &project_name, c
     }
     TreeWriter *writer;
     if (m_build_environment) {
-        writer = new BuildsetTreeWriter(*m_build_environment, m_project_name, temp_file);
+        writer = new BuildsetTreeWriter(*m_build_environment, m_project_name, temp_file, true);
     } else {
-        writer = new TreeWriter(temp_file);
+        writer = new TreeWriter(temp_file, true);
     }
     writer->write(node);
     if (writer->error()) {
         fprintf(stderr, "Failed to write project node to temporary file %s\n", file_flushed_to.c_str());
+        delete writer;
         return false;
     }
     delete writer;
     return true;
 }
 
-int Process::runScript(const std::string &env_script,
-                       const std::string &script,
-                       const std::string &args,
-                       int redirect_out_to) const
+bool Process::runNativePhase(const NativePhase &native_phase) const
 {
-    if (!script.size())
-        return -1;
+    auto commands = native_phase.commands(m_project_name, m_project_node, m_build_environment);
+    for (auto it = commands.begin(); it != commands.end(); ++it) {
+        int exit_code = runCommand(m_environement_script, *it, m_log_file);
+        if (exit_code) {
+            fprintf(stderr, "Command %s for project %s failed in execution\n", it->front().c_str(), m_project_name.c_str());
+            return false;
+        }
+    }
+    return true;
+}
 
+std::string Process::environmentCommand(const std::string &env_script) const
+{
     std::string pre_script_command;
-    if (env_script.size()) {
+    if (env_script.size() && !m_environment) {
         pre_script_command += std::string("source ") + env_script + " && ";
     }
     std::string env_file = m_configuration.findBuildEnvFile();
@@ -272,41 +447,230 @@ int Process::runScript(const std::string &env_script,
         pre_script_command.append(env_file);
         pre_script_command.append(" && ");
     }
+    return pre_script_command;
+}
+
+int Process::runCommand(const std::string &env_script,
+                        const std::vector<std::string> &command,
+                        int redirect_out_to) const
+{
+    std::string command_line;
+    for (auto it = command.begin(); it != command.end(); ++it) {
+        if (command_line.size())
+            command_line += " ";
+        command_line += ShellCoprocess::quote(*it);
+    }
+
+    if (m_shell && !m_shell->error()) {
+        std::string assignments;
+        for (auto it = m_extra_environment.begin(); it != m_extra_environment.end(); ++it)
+            assignments += it->first + "=" + ShellCoprocess::quote(it->second) + " ";
+        m_usage.processes++;
+        return m_shell->runCommand(m_phase, m_project_name, m_working_directory, assignments + command_line,
+                                   redirect_out_to, m_print, m_print_errors);
+    }
+
+    // Without anything to source the command does not need a shell
+    if (m_environment && !m_configuration.findBuildEnvFile().size())
+        return exec(command, redirect_out_to, m_extra_environment);
+
+    return exec_script(environmentCommand(env_script) + "exec " + command_line, redirect_out_to, m_extra_environment);
+}
+
+int Process::runScript(const std::string &env_script,
+                       const std::string &script,
+                       const std::string &args,
+                       int redirect_out_to,
+                       const ScriptEnvironment &environment) const
+{
+    if (!script.size())
+        return -1;
+
+    // The shell has already sourced the environment
+    if (m_shell && !m_shell->error()) {
+        if (DEBUG_EXEC_SCRIPT)
+            fprintf(stderr, "executing in shell %s %s\n", script.c_str(), args.c_str());
+        m_usage.processes++;
+        return m_shell->run(m_phase, m_project_name, m_working_directory, script, args,
+                            environment, redirect_out_to, m_print, m_print_errors);
+    }
+
+    std::string pre_script_command = environmentCommand(env_script);
 
     std::string post_script_command = " ";
     post_script_command.append(args);
 
     std::string script_command = pre_script_command + script + post_script_command;
 
-    int exit_code = exec_script(script_command, redirect_out_to);
+    int exit_code = exec_script(script_command, redirect_out_to, environment);
     return exit_code;
 }
-int Process::exec_script(const std::string &command, int redirect_out_to) const
+int Process::exec_script(const std::string &command, int redirect_out_to, const ScriptEnvironment &environment) const
 {
-    if (DEBUG_EXEC_SCRIPT)
-        fprintf(stderr, "executing command %s\n", command.c_str());
-    ChildProcessIoHandler childProcessIoHandler(m_phase, m_project_name, redirect_out_to);
-    childProcessIoHandler.setPrintStdOut(m_print);
+    std::vector<std::string> bash_command = { "bash", "-c", command };
+    return exec(bash_command, redirect_out_to, environment);
+}
 
-    pid_t process = fork();
+static std::string findExecutable(const std::string &name, const char *path)
+{
+    if (name.find('/') != std::string::npos)
+        return name;
+    if (!path)
+        path = "/usr/local/bin:/usr/bin:/bin";
+
+    const char *start = path;
+    while (true) {
+        const char *end = strchr(start, ':');
+        std::string dir = end ? std::string(start, end - start) : std::string(start);
+        std::string candidate = (dir.size() ? dir : std::string(".")) + "/" + name;
+        if (access(candidate.c_str(), X_OK) == 0)
+            return candidate;
+        if (!end)
+            break;
+        start = end + 1;
+    }
+    return std::string();
+}
 
-    if (process) {
-        int child_status;
-        pid_t wpid;
+int Process::exec(const std::vector<std::string> &command, int redirect_out_to, const ScriptEnvironment &environment) const
+{
+    if (DEBUG_EXEC_SCRIPT) {
+        std::string command_line;
+        for (auto it = command.begin(); it != command.end(); ++it)
+            command_line += (it == command.begin() ? "" : " ") + *it;
+        fprintf(stderr, "executing command %s\n", command_line.c_str());
+    }
+
+    // Everything the child needs is prepared before forking. Other threads
+    // might hold the malloc lock when fork is called
+    std::vector<std::string> environment_strings;
+    if (m_environment || environment.size()) {
+        std::set<std::string> overridden;
+        for (auto it = environment.begin(); it != environment.end(); ++it)
+            overridden.insert(it->first);
+        auto add_base = [&environment_strings, &overridden](const std::string &entry) {
+            size_t equal = entry.find('=');
+            if (overridden.find(entry.substr(0, equal)) == overridden.end())
+                environment_strings.push_back(entry);
+        };
+        if (m_environment) {
+            for (auto it = m_environment->begin(); it != m_environment->end(); ++it)
+                add_base(*it);
+        } else {
+            for (char **entry = environ; *entry; ++entry)
+                add_base(*entry);
+        }
+        for (auto it = environment.begin(); it != environment.end(); ++it)
+            environment_strings.push_back(it->first + "=" + it->second);
+    }
+
+    std::vector<char *> envp;
+    const char *path = nullptr;
+    for (auto it = environment_strings.begin(); it != environment_strings.end(); ++it) {
+        envp.push_back(const_cast<char *>(it->c_str()));
+        if (it->compare(0, 5, "PATH=") == 0)
+            path = it->c_str() + 5;
+    }
+    envp.push_back(nullptr);
+    if (environment_strings.empty())
+        path = getenv("PATH");
+
+    std::vector<char *> argv;
+    for (auto it = command.begin(); it != command.end(); ++it)
+        argv.push_back(const_cast<char *>(it->c_str()));
+    argv.push_back(nullptr);
+
+    std::string executable = findExecutable(command.front(), path);
+    if (!executable.size()) {
+        fprintf(stderr, "Failed to find %s in PATH\n", command.front().c_str());
+        return -1;
+    }
+    char **child_envp = environment_strings.empty() ? environ : envp.data();
+
+    if (m_output_reactor && !m_output_reactor->error())
+        return execWithReactor(executable, argv.data(), child_envp, redirect_out_to);
+
+    int exit_code = -1;
+    unsigned long long output_bytes = 0;
+    struct rusage resource_usage;
+    {
+        ChildProcessIoHandler childProcessIoHandler(m_phase, m_project_name, redirect_out_to);
+        childProcessIoHandler.setPrintStdOut(m_print);
+        childProcessIoHandler.setPrintStdErr(m_print_errors);
+        childProcessIoHandler.setUseRoller(m_configuration.jobs() == 1);
+        childProcessIoHandler.setByteCounter(&output_bytes);
+
+        pid_t process = fork();
+
+        if (process == 0) {
+            childProcessIoHandler.setupChildProcessState();
+            execChild(executable, argv.data(), child_envp);
+        }
 
         childProcessIoHandler.setupMasterProcessState();
+        if (process < 0) {
+            fprintf(stderr, "Failed to fork for %s : %s\n", command.back().c_str(), strerror(errno));
+            return -1;
+        }
 
+        int child_status;
+        pid_t wpid;
         do {
-            wpid = wait(&child_status);
-        } while(wpid != process);
-        return WEXITSTATUS(child_status);
-    } else {
-        childProcessIoHandler.setupChildProcessState();
-        execlp("bash", "bash", "-c", command.c_str(), nullptr);
-        fprintf(stderr, "Failed to execute %s : %s\n", command.c_str(), strerror(errno));
-        exit(1);
+            wpid = wait4(process, &child_status, 0, &resource_usage);
+        } while(wpid < 0 && errno == EINTR);
+        if (wpid < 0) {
+            fprintf(stderr, "Failed to wait for %s : %s\n", command.back().c_str(), strerror(errno));
+            return -1;
+        }
+        exit_code = ChildOutput::exitCode(child_status);
+    }
+    m_usage.addChild(resource_usage);
+    m_usage.output_bytes += output_bytes;
+    return exit_code;
+}
+
+int Process::execWithReactor(const std::string &executable, char **argv, char **envp, int redirect_out_to) const
+{
+    int stdout_pipe[2];
+    int stderr_pipe[2];
+    if (pipe2(stdout_pipe, O_CLOEXEC)) {
+        fprintf(stderr, "Failed to open pipe for stdout redirection %s\n", strerror(errno));
+        return -1;
+    }
+    if (pipe2(stderr_pipe, O_CLOEXEC)) {
+        fprintf(stderr, "Failed to open pipe for stderr redirection %s\n", strerror(errno));
+        close(stdout_pipe[0]);
+        close(stdout_pipe[1]);
+        return -1;
+    }
+
+    pid_t process = fork();
+    if (process == 0) {
+        dup2(stdout_pipe[1], STDOUT_FILENO);
+        dup2(stderr_pipe[1], STDERR_FILENO);
+        execChild(executable, argv, envp);
+    }
+
+    close(stdout_pipe[1]);
+    close(stderr_pipe[1]);
+    if (process < 0) {
+        fprintf(stderr, "Failed to fork for %s : %s\n", executable.c_str(), strerror(errno));
+        close(stdout_pipe[0]);
+        close(stderr_pipe[0]);
+        return -1;
+    }
+    return m_output_reactor->run(process, stdout_pipe[0], stderr_pipe[0], redirect_out_to,
+                                 m_print, m_print_errors, m_project_name, &m_usage);
+}
+
+void Process::execChild(const std::string &executable, char **argv, char **envp) const
+{
+    if (m_working_directory.size() && chdir(m_working_directory.c_str())) {
+        fprintf(stderr, "Failed to change into directory %s : %s\n", m_working_directory.c_str(), strerror(errno));
+        _exit(1);
     }
-    assert(false);
-    return 0;
+    execve(executable.c_str(), argv, envp);
+    fprintf(stderr, "Failed to execute %s : %s\n", executable.c_str(), strerror(errno));
+    _exit(1);
 }
 
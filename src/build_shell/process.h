@@ -25,10 +25,19 @@
 
 #include "configuration.h"
 #include "json_tree.h"
+#include "process_usage.h"
 
 #include <string>
+#include <vector>
+#include <utility>
 
 class BuildEnvironment;
+class ShellCoprocess;
+class NativePhase;
+class ProjectNodeSnapshot;
+class OutputReactor;
+class BuildReport;
+class BuildTrace;
 
 class Process
 {
@@ -42,6 +51,7 @@ public:
     void setPhase(const std::string &phase);
     void setProjectName(const std::string &projectName);
     void setFallback(const std::string &fallback);
+    void setWorkingDirectory(const std::string &working_directory);
 
     void setLogFile(int logFile, bool closeFileOnDelete);
     void setLogFile(const std::string &logFile, bool append = false, bool closeFileOnDelete = true);
@@ -50,30 +60,73 @@ public:
     void setProjectNode(JT::ObjectNode *projectNode, BuildEnvironment *buildEnv);
 
     void setPrint(bool print);
+    void setPrintErrors(bool print);
 
     void setScriptHasToExist(bool exist);
+
+    void setShell(ShellCoprocess *shell);
+    void setProjectNodeSnapshot(const ProjectNodeSnapshot *snapshot);
+    // The complete environment of the project as KEY=VALUE strings. When it
+    // is set the environment script is not sourced
+    void setEnvironment(const std::vector<std::string> *environment);
+    // Set for the scripts and commands of the phase on top of the
+    // environment of the project
+    void addEnvironment(const std::string &name, const std::string &value);
+    // Children are started without an io thread of their own, their output
+    // is handled by the reactor
+    void setOutputReactor(OutputReactor *output_reactor);
+    // Each run of a phase that started a script is added to the report
+    void setBuildReport(BuildReport *build_report);
+    void setBuildTrace(BuildTrace *build_trace);
+
+    // The resources used by the children of the last run
+    const ProcessUsage &usage() const;
 private:
+    typedef std::vector<std::pair<std::string, std::string>> ScriptEnvironment;
+
+    bool runPhase(JT::ObjectNode **returnedObjectNode);
     bool flushProjectNodeToTemporaryFile(const std::string &project_name, const JT::ObjectNode *node, std::string &file_flushed_to) const;
+    bool runNativePhase(const NativePhase &native_phase) const;
+    std::string environmentCommand(const std::string &env_script) const;
     int runScript(const std::string &env_script,
                   const std::string &script,
                   const std::string &args,
-                  int redirect_out_to) const;
-    int exec_script(const std::string &command, int redirect_out_to) const;
+                  int redirect_out_to,
+                  const ScriptEnvironment &environment) const;
+    int runCommand(const std::string &env_script,
+                   const std::vector<std::string> &command,
+                   int redirect_out_to) const;
+    int exec_script(const std::string &command, int redirect_out_to,
+                    const ScriptEnvironment &environment = ScriptEnvironment()) const;
+    int execWithReactor(const std::string &executable, char **argv, char **envp, int redirect_out_to) const;
+    void execChild(const std::string &executable, char **argv, char **envp) const;
+    int exec(const std::vector<std::string> &command, int redirect_out_to,
+             const ScriptEnvironment &environment = ScriptEnvironment()) const;
 
     const Configuration &m_configuration;
     std::string m_environement_script;
     std::string m_phase;
     std::string m_project_name;
     std::string m_fallback;
+    std::string m_working_directory;
 
     BuildEnvironment *m_build_environment;
     int m_log_file;
     std::string m_log_file_str;
     bool m_close_log_file;
     bool m_print;
+    bool m_print_errors;
     bool m_script_has_to_exist;
 
     const JT::ObjectNode *m_project_node;
+    ShellCoprocess *m_shell;
+    const ProjectNodeSnapshot *m_snapshot;
+    const std::vector<std::string> *m_environment;
+    ScriptEnvironment m_extra_environment;
+    OutputReactor *m_output_reactor;
+    BuildReport *m_build_report;
+    BuildTrace *m_build_trace;
+    mutable ProcessUsage m_usage;
 };
 
 #endif
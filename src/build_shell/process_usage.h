@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef PROCESS_USAGE_H
+#define PROCESS_USAGE_H
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// The resources used by the children of a phase, as reported by wait4
+struct ProcessUsage
+{
+    ProcessUsage()
+        : wall_seconds(0)
+        , user_seconds(0)
+        , system_seconds(0)
+        , max_rss_kb(0)
+        , block_input(0)
+        , block_output(0)
+        , output_bytes(0)
+        , processes(0)
+    { }
+
+    void addChild(const struct rusage &usage)
+    {
+        user_seconds += usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0;
+        system_seconds += usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+        if (usage.ru_maxrss > max_rss_kb)
+            max_rss_kb = usage.ru_maxrss;
+        block_input += usage.ru_inblock;
+        block_output += usage.ru_oublock;
+        processes++;
+    }
+
+    double wall_seconds;
+    double user_seconds;
+    double system_seconds;
+    long max_rss_kb;
+    long block_input;
+    long block_output;
+    unsigned long long output_bytes;
+    int processes;
+};
+
+#endif //PROCESS_USAGE_H
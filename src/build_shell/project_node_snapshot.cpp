@@ -0,0 +1,155 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "project_node_snapshot.h"
+
+#include "buildset_tree_writer.h"
+#include "build_environment.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+ProjectNodeSnapshot::ProjectNodeSnapshot(const Configuration &configuration, const std::string &project_name)
+    : m_configuration(configuration)
+    , m_project_name(project_name)
+    , m_file(-1)
+    , m_temp_file(false)
+    , m_error(true)
+{
+}
+
+ProjectNodeSnapshot::~ProjectNodeSnapshot()
+{
+    if (m_file >= 0)
+        close(m_file);
+    if (m_temp_file)
+        unlink(m_path.c_str());
+}
+
+// Scripts are not children of this process when they run in the persistent
+// shell, so the memfd is opened through /proc/<pid>/fd instead of /dev/fd
+int ProjectNodeSnapshot::createMemoryFile()
+{
+#ifdef MFD_CLOEXEC
+    std::string name = "build_shell_" + m_project_name;
+    int file = memfd_create(name.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (file < 0)
+        return -1;
+    m_path = "/proc/" + std::to_string(getpid()) + "/fd/" + std::to_string(file);
+    if (access(m_path.c_str(), R_OK)) {
+        close(file);
+        m_path.clear();
+        return -1;
+    }
+    return file;
+#else
+    return -1;
+#endif
+}
+
+bool ProjectNodeSnapshot::write(const JT::ObjectNode *node, const BuildEnvironment *build_environment)
+{
+    if (m_file >= 0)
+        return !m_error;
+
+    m_file = createMemoryFile();
+    if (m_file < 0) {
+        m_file = m_configuration.createTempFile(m_project_name, m_path);
+        if (m_file < 0) {
+            fprintf(stderr, "Could not create temp file for project %s\n", m_project_name.c_str());
+            return false;
+        }
+        m_temp_file = true;
+    }
+
+    {
+        TreeWriter *writer;
+        if (build_environment) {
+            writer = new BuildsetTreeWriter(*build_environment, m_project_name, m_file);
+        } else {
+            writer = new TreeWriter(m_file);
+        }
+        writer->write(node);
+        bool writer_error = writer->error();
+        delete writer;
+        if (writer_error) {
+            fprintf(stderr, "Failed to write project node snapshot %s\n", m_path.c_str());
+            return false;
+        }
+    }
+
+#ifdef F_ADD_SEALS
+    // A script writing to its input would change it for the next phases
+    if (!m_temp_file)
+        fcntl(m_file, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+#endif
+
+    flatten(node, build_environment, m_project_name, "BS_ARG", m_environment);
+    m_error = false;
+    return true;
+}
+
+static std::string environmentName(const std::string &name)
+{
+    std::string environment_name = name;
+    for (auto it = environment_name.begin(); it != environment_name.end(); ++it) {
+        if (*it >= 'a' && *it <= 'z')
+            *it = *it - 'a' + 'A';
+        else if (!((*it >= 'A' && *it <= 'Z') || (*it >= '0' && *it <= '9')))
+            *it = '_';
+    }
+    return environment_name;
+}
+
+// Every value in the project node is exported as BS_ARG_<PATH>, so
+// arguments.src_path becomes BS_ARG_ARGUMENTS_SRC_PATH and the second
+// element of an array named list BS_ARG_LIST_1
+void ProjectNodeSnapshot::flatten(const JT::Node *node,
+                                  const BuildEnvironment *build_environment,
+                                  const std::string &project_name,
+                                  const std::string &name,
+                                  Environment &environment)
+{
+    if (const JT::ObjectNode *object = node->asObjectNode()) {
+        for (auto it = object->begin(); it != object->end(); ++it) {
+            flatten(it->second, build_environment, project_name, name + "_" + environmentName(it->first.string()), environment);
+        }
+    } else if (const JT::ArrayNode *array = node->asArrayNode()) {
+        for (size_t i = 0; i < array->size(); i++) {
+            flatten(array->index(i), build_environment, project_name, name + "_" + std::to_string(i), environment);
+        }
+    } else if (const JT::StringNode *string = node->asStringNode()) {
+        std::string value = string->string();
+        if (build_environment && BuildEnvironment::hasVariables(value.c_str(), value.size()))
+            value = build_environment->expandVariablesInString(value, project_name);
+        environment.push_back(std::make_pair(name, value));
+    } else if (const JT::NumberNode *number = node->asNumberNode()) {
+        char buffer[64];
+        snprintf(buffer, sizeof buffer, "%.17g", number->number());
+        environment.push_back(std::make_pair(name, std::string(buffer)));
+    } else if (const JT::BooleanNode *boolean = node->asBooleanNode()) {
+        environment.push_back(std::make_pair(name, std::string(boolean->value() ? "true" : "false")));
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef PROJECT_NODE_SNAPSHOT_H
+#define PROJECT_NODE_SNAPSHOT_H
+
+#include "configuration.h"
+
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace JT {
+    class Node;
+    class ObjectNode;
+}
+class BuildEnvironment;
+
+// A project node serialized with its variables expanded, written once and
+// handed to the scripts of every phase of the project that does not return
+// a node. It lives in a sealed memfd that scripts open through /proc, and
+// falls back to a temporary file where that is not possible.
+class ProjectNodeSnapshot
+{
+public:
+    typedef std::vector<std::pair<std::string, std::string>> Environment;
+
+    ProjectNodeSnapshot(const Configuration &configuration, const std::string &project_name);
+    ~ProjectNodeSnapshot();
+
+    bool write(const JT::ObjectNode *node, const BuildEnvironment *build_environment);
+
+    bool error() const { return m_error; }
+    const std::string &path() const { return m_path; }
+    const Environment &environment() const { return m_environment; }
+
+    static void flatten(const JT::Node *node,
+                        const BuildEnvironment *build_environment,
+                        const std::string &project_name,
+                        const std::string &name,
+                        Environment &environment);
+
+private:
+    int createMemoryFile();
+
+    const Configuration &m_configuration;
+    std::string m_project_name;
+    std::string m_path;
+    Environment m_environment;
+    int m_file;
+    bool m_temp_file;
+    bool m_error;
+};
+
+#endif
@@ -25,6 +25,7 @@
 #include "tree_writer.h"
 #include "process.h"
 #include "correct_branch_action.h"
+#include "dependency_scheduler.h"
 
 #include <unistd.h>
 #include <limits.h>
@@ -59,6 +60,7 @@ PullAction::PullAction(const Configuration &configuration)
     : Action(configuration)
     , m_buildset_tree_builder(configuration.buildsetFile())
 {
+    m_buildset_tree_builder.setProjects(selectedProjects());
     m_buildset_tree_builder.load();
     m_buildset_tree = m_buildset_tree_builder.rootNode();
     if (!m_buildset_tree) {
@@ -77,90 +79,176 @@ bool PullAction::execute()
     if (!m_buildset_tree || m_error)
         return false;
 
-    std::unique_ptr<JT::ObjectNode> arguments(new JT::ObjectNode());
-    arguments->addValueToObject("reset_to_sha", "true", JT::Token::Bool);
+    // Every project and every sub repo is a job. Sub repos live inside the
+    // project checkout so they wait for their project
+    DependencyScheduler scheduler;
+    scheduler.setMaxParallel(m_configuration.jobs());
+    scheduler.setStopOnFailure(false);
 
-    char cwd[PATH_MAX];
-    getcwd(cwd, sizeof(cwd));
+    std::map<std::string, PullJob> jobs;
+    bool success = true;
+    std::vector<std::string> project_names = projects();
+    for (auto it = project_names.begin(); it != project_names.end(); ++it) {
+        if (!addJobsForProject(*it, scheduler, jobs))
+            success = false;
+    }
 
-    auto end_it = endIterator(m_buildset_tree);
-    for (auto it = startIterator(m_buildset_tree); it != end_it; ++it) {
-        JT::ObjectNode *project_node = it->second->asObjectNode();
+    bool buffer_output = m_configuration.jobs() > 1;
+    if (!scheduler.run([this, &jobs, buffer_output](const std::string &job_name) {
+                return runJob(job_name, jobs.find(job_name)->second, buffer_output);
+            })) {
+        success = false;
+    }
 
-        if (!project_node || !project_node->objectNodeAt("scm"))
-            continue;
+    const std::vector<std::string> &failed = scheduler.failedJobs();
+    const std::vector<std::string> &skipped = scheduler.skippedJobs();
+    if (failed.size() || skipped.size()) {
+        fprintf(stderr, "\nPull report:\n");
+        for (auto it = failed.begin(); it != failed.end(); ++it) {
+            fprintf(stderr, "    FAILED  %s\n", it->c_str());
+        }
+        for (auto it = skipped.begin(); it != skipped.end(); ++it) {
+            fprintf(stderr, "    SKIPPED %s\n", it->c_str());
+        }
+    }
+
+    return success;
+}
 
-        RemoveArgumentNode remove_argument_handler(project_node, arguments.get());
+bool PullAction::addJobsForProject(const std::string &project_name, DependencyScheduler &scheduler, std::map<std::string, PullJob> &jobs)
+{
+    JT::ObjectNode *project_node = m_buildset_tree->objectNodeAt(project_name);
+    JT::ObjectNode *scm_node = project_node->objectNodeAt("scm");
+
+    PullJob project_job = { m_configuration.srcDir(), project_name, project_node, scm_node };
+    jobs[project_name] = project_job;
+    scheduler.addJob(project_name);
+
+    JT::ArrayNode *sub_repos = scm_node->arrayNodeAt("sub_repos");
+    if (!sub_repos)
+        return true;
 
-        if (chdir(m_configuration.srcDir().c_str())) {
-            fprintf(stderr, "Could not move into src dir:%s\n%s\n",
-                    m_configuration.srcDir().c_str(), strerror(errno));
-            return false;
+    bool success = true;
+    for (size_t i = 0; i < sub_repos->size(); i++) {
+        JT::ObjectNode *sub_repo = sub_repos->index(i)->asObjectNode();
+        if (!sub_repo)
+            continue;
+        const std::string &path = sub_repo->stringAt("path");
+        const std::string &name = sub_repo->stringAt("name");
+        if (path.size() == 0 || name.size() == 0) {
+            fprintf(stderr, "Missing name or path for sub_repo %s. Skipping\n", sub_repo->stringAt("url").c_str());
+            success = false;
+            continue;
         }
+        std::string job_name = project_name + "/" + path + "/" + name;
+        PullJob sub_repo_job = { m_configuration.srcDir() + "/" + project_name + "/" + path, name, nullptr, sub_repo };
+        jobs[job_name] = sub_repo_job;
+        scheduler.addJob(job_name);
+        scheduler.addDependency(job_name, project_name);
+    }
+    return success;
+}
 
-        const std::string &project_name = it->first.string();
-
-        JT::ObjectNode *scm_node = project_node->objectNodeAt("scm");
-
-        if (!determinAndRunScmAction( project_name, scm_node))
-            return false;
-
-        if (JT::ArrayNode *sub_repos = scm_node->arrayNodeAt("sub_repos")) {
-            for (int i = 0; i < sub_repos->size(); i++) {
-                if (JT::ObjectNode *sub_repo = const_cast<JT::ObjectNode *>(sub_repos->index(i)->asObjectNode())) {
-                    const std::string &path = sub_repo->stringAt("path");
-                    const std::string &name = sub_repo->stringAt("name");
-                    if (path.size() == 0 || name.size() == 0) {
-                        fprintf(stderr, "Missing name or path for sub_repo %s. Skipping\n", sub_repo->stringAt("url").c_str());
-                        return false;;
-                    }
-                    if (chdir(std::string(m_configuration.srcDir() + "/" + project_name + "/" + path).c_str())) {
-                        fprintf(stderr, "Could not move into src dir:%s\n%s\n",
-                                m_configuration.srcDir().c_str(), strerror(errno));
-                        return false;
-                    }
-                    fprintf(stderr, "found sub_repo %s\n", name.c_str());
-                    if (!determinAndRunScmAction(name, sub_repo))
-                        return false;
-                }
-            }
+bool PullAction::runJob(const std::string &job_name, const PullJob &job, bool buffer_output)
+{
+    int output_file = -1;
+    if (buffer_output) {
+        std::string output_file_name;
+        output_file = m_configuration.createTempFile("pull", output_file_name);
+        if (output_file >= 0)
+            unlink(output_file_name.c_str());
+    }
+
+    std::unique_ptr<JT::ObjectNode> arguments;
+    std::unique_ptr<RemoveArgumentNode> remove_argument_handler;
+    if (job.project_node) {
+        arguments.reset(new JT::ObjectNode());
+        arguments->addValueToObject("reset_to_sha", "true", JT::Token::Bool);
+        remove_argument_handler.reset(new RemoveArgumentNode(job.project_node, arguments.get()));
+    }
+
+    bool success;
+    if (!Configuration::isDir(job.parent_dir)) {
+        fprintf(stderr, "Could not find directory for %s: %s\n", job_name.c_str(), job.parent_dir.c_str());
+        success = false;
+    } else {
+        success = determinAndRunScmAction(job.parent_dir, job.name, job.scm_node, output_file);
+    }
+
+    if (output_file >= 0) {
+        std::unique_lock<std::mutex> lock(m_output_mutex);
+        fprintf(stdout, "\n******** %s %s ********\n", job_name.c_str(), success ? "pulled" : "FAILED");
+        fflush(stdout);
+        lseek(output_file, 0, SEEK_SET);
+        char buffer[4096];
+        ssize_t read_size;
+        while ((read_size = read(output_file, buffer, sizeof buffer)) > 0) {
+            if (write(STDOUT_FILENO, buffer, read_size) < 0)
+                break;
         }
+        close(output_file);
+    }
+
+    return success;
+}
 
+std::vector<std::string> PullAction::projects()
+{
+    std::vector<std::string> project_names;
+    if (!m_buildset_tree)
+        return project_names;
+
+    auto end_it = endIterator(m_buildset_tree);
+    for (auto it = startIterator(m_buildset_tree); it != end_it; ++it) {
+        JT::ObjectNode *project_node = it->second->asObjectNode();
+        if (!project_node || !project_node->objectNodeAt("scm"))
+            continue;
+        project_names.push_back(it->first.string());
     }
+    return project_names;
+}
+
+bool PullAction::pullProject(const std::string &project_name)
+{
+    if (!m_buildset_tree || m_error)
+        return false;
 
-    return true;
+    JT::ObjectNode *project_node = m_buildset_tree->objectNodeAt(project_name);
+    if (!project_node || !project_node->objectNodeAt("scm"))
+        return true;
+
+    DependencyScheduler scheduler;
+    std::map<std::string, PullJob> jobs;
+    if (!addJobsForProject(project_name, scheduler, jobs))
+        return false;
+
+    return scheduler.run([this, &jobs](const std::string &job_name) {
+            return runJob(job_name, jobs.find(job_name)->second, false);
+        });
 }
 
-bool PullAction::determinAndRunScmAction(const std::string &rel_path, JT::ObjectNode *scmNode)
+bool PullAction::determinAndRunScmAction(const std::string &parent_dir, const std::string &rel_path, JT::ObjectNode *scmNode, int output_file)
 {
+        std::string repo_dir = parent_dir + "/" + rel_path;
         bool should_clone = false;
         bool should_pull = false;
         struct stat stat_buffer;
-        if (stat(rel_path.c_str(), &stat_buffer)) {
+        if (stat(repo_dir.c_str(), &stat_buffer)) {
                 should_clone = true;
         } else if (S_ISDIR(stat_buffer.st_mode)) {
             should_pull = true;
-            if (chdir(rel_path.c_str())) {
-                char current_wd[PATH_MAX];
-                if (getcwd(current_wd, sizeof current_wd) == 0)
-                    fprintf(stderr, "failed to get cwd\n");
-                fprintf(stderr, "Failed to move into directory %s/%s : %s\n",
-                        current_wd, rel_path.c_str(), strerror(errno));
-                m_error = true;
-                return false;
-            }
         }
 
         if (!should_clone && !should_pull) {
             fprintf(stderr, "Don't know how to handle: %s in pull mode. Is it a regular file? Skipping.\n",
-                    rel_path.c_str());
+                    repo_dir.c_str());
         }
 
         ScmAction action = should_clone? Clone : Pull;
-        return runPullActionForScmNode(rel_path, action, scmNode);
+        return runPullActionForScmNode(rel_path, action, scmNode, should_clone ? parent_dir : repo_dir, repo_dir, output_file);
 }
 
-bool PullAction::runPullActionForScmNode(const std::string &name, PullAction::ScmAction action, JT::ObjectNode *scm_node)
+bool PullAction::runPullActionForScmNode(const std::string &name, PullAction::ScmAction action, JT::ObjectNode *scm_node, const std::string &working_dir, const std::string &repo_dir, int output_file)
 {
         std::string fallback_script;
         std::string mode = action == Clone ? "clone" : "pull";
@@ -181,13 +269,20 @@ bool PullAction::runPullActionForScmNode(const std::string &name, PullAction::Sc
             process.setPhase(mode);
             process.setProjectName(name);
             process.setFallback(fallback_script);
+            process.setWorkingDirectory(working_dir);
             process.setProjectNode(scm_node);
-            process.setPrint(true);
+            if (output_file >= 0) {
+                process.setLogFile(output_file, false);
+                process.setPrint(false);
+                process.setPrintErrors(false);
+            } else {
+                process.setPrint(true);
+            }
             success = process.run(nullptr);
         }
 
         if (success && m_configuration.correctBranch()) {
-            success = CorrectBranchAction::handleProjectNode(m_configuration, name, scm_node);
+            success = CorrectBranchAction::handleProjectNode(m_configuration, name, scm_node, repo_dir, output_file);
         }
 
         return success;
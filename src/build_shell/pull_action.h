@@ -25,6 +25,12 @@
 #include "action.h"
 #include "tree_builder.h"
 
+#include <vector>
+#include <map>
+#include <mutex>
+
+class DependencyScheduler;
+
 class PullAction : public Action
 {
 public:
@@ -33,14 +39,29 @@ public:
 
     bool execute();
 
+    std::vector<std::string> projects();
+    bool pullProject(const std::string &project_name);
+
 private:
     enum ScmAction {
         Pull,
         Clone
     };
 
-    bool determinAndRunScmAction(const std::string &relPath, JT::ObjectNode *scmNode);
-    bool runPullActionForScmNode(const std::string &name, ScmAction action, JT::ObjectNode *scmNode);
+    struct PullJob
+    {
+        std::string parent_dir;
+        std::string name;
+        JT::ObjectNode *project_node;
+        JT::ObjectNode *scm_node;
+    };
+
+    bool addJobsForProject(const std::string &project_name, DependencyScheduler &scheduler, std::map<std::string, PullJob> &jobs);
+    bool runJob(const std::string &job_name, const PullJob &job, bool buffer_output);
+
+    bool determinAndRunScmAction(const std::string &parentDir, const std::string &relPath, JT::ObjectNode *scmNode, int outputFile = -1);
+    bool runPullActionForScmNode(const std::string &name, ScmAction action, JT::ObjectNode *scmNode, const std::string &workingDir, const std::string &repoDir, int outputFile);
+    std::mutex m_output_mutex;
     TreeBuilder m_buildset_tree_builder;
     JT::ObjectNode *m_buildset_tree;
 };
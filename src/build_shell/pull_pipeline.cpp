@@ -0,0 +1,150 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "pull_pipeline.h"
+
+#include "build_trace.h"
+
+PullPipeline::PullPipeline(const Configuration &configuration)
+    : m_configuration(configuration)
+    , m_pull_action(configuration)
+    , m_requested_count(0)
+    , m_failed(false)
+    , m_stop(false)
+    , m_build_trace(nullptr)
+{
+    m_projects = m_pull_action.projects();
+    for (size_t i = 0; i < m_projects.size(); i++) {
+        m_project_index[m_projects[i]] = i;
+    }
+    m_state.resize(m_projects.size(), Pending);
+    m_requested.resize(m_projects.size(), false);
+}
+
+void PullPipeline::setBuildTrace(BuildTrace *build_trace)
+{
+    m_build_trace = build_trace;
+}
+
+PullPipeline::~PullPipeline()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+bool PullPipeline::error() const
+{
+    return m_pull_action.error();
+}
+
+void PullPipeline::start()
+{
+    m_thread = std::thread(&PullPipeline::run, this);
+}
+
+bool PullPipeline::waitForProject(const std::string &project_name)
+{
+    auto it = m_project_index.find(project_name);
+    if (it == m_project_index.end())
+        return true;
+
+    size_t index = it->second;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_requested[index]) {
+        m_requested[index] = true;
+        m_requested_count++;
+        m_condition.notify_all();
+    }
+    while (m_state[index] == Pending && !m_failed && !m_stop)
+        m_condition.wait(lock);
+    return m_state[index] == Pulled;
+}
+
+bool PullPipeline::finish()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_requested_count = m_projects.size();
+    }
+    m_condition.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+    return !m_failed;
+}
+
+// Projects someone is waiting for come first, then the buildset order as
+// long as it is within pullAhead() of the requested projects
+bool PullPipeline::nextProject(size_t *index)
+{
+    for (size_t i = 0; i < m_projects.size(); i++) {
+        if (m_state[i] == Pending && m_requested[i]) {
+            *index = i;
+            return true;
+        }
+    }
+    size_t window = m_requested_count + m_configuration.pullAhead();
+    for (size_t i = 0; i < m_projects.size() && i < window; i++) {
+        if (m_state[i] == Pending) {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void PullPipeline::run()
+{
+    if (m_build_trace)
+        m_build_trace->nameTrack("pull");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop && !m_failed) {
+        size_t index;
+        if (!nextProject(&index)) {
+            bool all_pulled = true;
+            for (size_t i = 0; i < m_state.size(); i++) {
+                if (m_state[i] == Pending)
+                    all_pulled = false;
+            }
+            if (all_pulled)
+                return;
+            m_condition.wait(lock);
+            continue;
+        }
+
+        lock.unlock();
+        bool success = m_pull_action.pullProject(m_projects[index]);
+        if (m_build_trace)
+            m_build_trace->instant(success ? "pulled" : "pull failed", "pull", m_projects[index]);
+        lock.lock();
+
+        m_state[index] = success ? Pulled : Failed;
+        if (!success) {
+            fprintf(stderr, "Failed to pull %s, stopping pull of remaining projects\n", m_projects[index].c_str());
+            m_failed = true;
+        }
+        m_condition.notify_all();
+    }
+}
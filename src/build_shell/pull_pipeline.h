@@ -0,0 +1,77 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef PULL_PIPELINE_H
+#define PULL_PIPELINE_H
+
+#include "pull_action.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class BuildTrace;
+
+// Pulls the projects of a buildset in a background thread, at most
+// pullAhead() projects ahead of the builds that are waiting for them
+class PullPipeline
+{
+public:
+    PullPipeline(const Configuration &configuration);
+    ~PullPipeline();
+
+    bool error() const;
+
+    void setBuildTrace(BuildTrace *build_trace);
+
+    void start();
+    bool waitForProject(const std::string &project_name);
+    bool finish();
+
+private:
+    enum State {
+        Pending,
+        Pulled,
+        Failed
+    };
+
+    void run();
+    bool nextProject(size_t *index);
+
+    const Configuration &m_configuration;
+    PullAction m_pull_action;
+    std::vector<std::string> m_projects;
+    std::map<std::string, size_t> m_project_index;
+    std::vector<State> m_state;
+    std::vector<bool> m_requested;
+    size_t m_requested_count;
+    bool m_failed;
+    bool m_stop;
+    BuildTrace *m_build_trace;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "report_action.h"
+
+#include "build_report.h"
+#include "tree_builder.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+struct ReportLine
+{
+    std::string name;
+    double wall_seconds;
+    double user_seconds;
+    double system_seconds;
+    double max_rss_kb;
+    double output_bytes;
+    bool success;
+};
+
+static double numberAt(const JT::ObjectNode *node, const std::string &name)
+{
+    const JT::Node *value = node->nodeAt(name);
+    if (value && value->asNumberNode())
+        return value->asNumberNode()->number();
+    return 0;
+}
+
+static std::string duration(double seconds)
+{
+    char buffer[32];
+    if (seconds >= 3600) {
+        snprintf(buffer, sizeof buffer, "%dh%02dm", int(seconds / 3600), int(seconds / 60) % 60);
+    } else if (seconds >= 60) {
+        snprintf(buffer, sizeof buffer, "%dm%04.1fs", int(seconds / 60), seconds - 60 * int(seconds / 60));
+    } else {
+        snprintf(buffer, sizeof buffer, "%.1fs", seconds);
+    }
+    return buffer;
+}
+
+static std::string size(double bytes)
+{
+    static const char *units[] = { "B", "K", "M", "G", "T" };
+    int unit = 0;
+    while (bytes >= 1024 && unit < 4) {
+        bytes /= 1024;
+        unit++;
+    }
+    char buffer[32];
+    snprintf(buffer, sizeof buffer, unit ? "%.1f%s" : "%.0f%s", bytes, units[unit]);
+    return buffer;
+}
+
+static void printLines(const char *title, std::vector<ReportLine> &lines, size_t max_lines)
+{
+    std::sort(lines.begin(), lines.end(), [](const ReportLine &a, const ReportLine &b) {
+            return a.wall_seconds > b.wall_seconds;
+        });
+    fprintf(stdout, "\n%-32s %10s %10s %10s %10s %10s\n", title, "wall", "user", "system", "max rss", "output");
+    for (size_t i = 0; i < lines.size() && i < max_lines; i++) {
+        const ReportLine &line = lines[i];
+        fprintf(stdout, "%-32s %10s %10s %10s %10s %10s%s\n", line.name.c_str(),
+                duration(line.wall_seconds).c_str(), duration(line.user_seconds).c_str(),
+                duration(line.system_seconds).c_str(), size(line.max_rss_kb * 1024).c_str(),
+                size(line.output_bytes).c_str(), line.success ? "" : "  FAILED");
+    }
+}
+
+static void addTo(ReportLine &total, const ReportLine &line)
+{
+    total.wall_seconds += line.wall_seconds;
+    total.user_seconds += line.user_seconds;
+    total.system_seconds += line.system_seconds;
+    total.max_rss_kb = std::max(total.max_rss_kb, line.max_rss_kb);
+    total.output_bytes += line.output_bytes;
+    total.success = total.success && line.success;
+}
+
+ReportAction::ReportAction(const Configuration &configuration)
+    : Action(configuration)
+{
+}
+
+bool ReportAction::execute()
+{
+    std::string report_file = BuildReport::latestReport(m_configuration);
+    if (!report_file.size()) {
+        fprintf(stderr, "No build reports found in %s\n", m_configuration.buildReportDir().c_str());
+        return false;
+    }
+
+    TreeBuilder tree_builder(report_file);
+    if (!tree_builder.load() || !tree_builder.rootNode()) {
+        fprintf(stderr, "Failed to read build report %s\n", report_file.c_str());
+        return false;
+    }
+    JT::ObjectNode *root = tree_builder.rootNode();
+    fprintf(stdout, "Build started %s %s in %s\n", root->stringAt("started").c_str(),
+            root->booleanAt("success") ? "succeeded" : "failed",
+            duration(numberAt(root, "wall_seconds")).c_str());
+
+    std::vector<ReportLine> projects;
+    std::vector<ReportLine> phases;
+    std::map<std::string, ReportLine> phase_totals;
+    JT::ObjectNode *projects_node = root->objectNodeAt("projects");
+    if (projects_node) {
+        for (auto project = projects_node->begin(); project != projects_node->end(); ++project) {
+            JT::ObjectNode *project_node = project->second->asObjectNode();
+            if (!project_node)
+                continue;
+            ReportLine project_line = { project->first.string(), 0, 0, 0, 0, 0, true };
+            for (auto phase = project_node->begin(); phase != project_node->end(); ++phase) {
+                JT::ObjectNode *phase_node = phase->second->asObjectNode();
+                if (!phase_node)
+                    continue;
+                ReportLine line = { project->first.string() + " " + phase->first.string(),
+                                    numberAt(phase_node, "wall_seconds"),
+                                    numberAt(phase_node, "user_seconds"),
+                                    numberAt(phase_node, "system_seconds"),
+                                    numberAt(phase_node, "max_rss_kb"),
+                                    numberAt(phase_node, "output_bytes"),
+                                    phase_node->booleanAt("success") };
+                phases.push_back(line);
+                addTo(project_line, line);
+
+                auto total = phase_totals.find(phase->first.string());
+                if (total == phase_totals.end()) {
+                    ReportLine empty = { phase->first.string(), 0, 0, 0, 0, 0, true };
+                    total = phase_totals.insert(std::make_pair(phase->first.string(), empty)).first;
+                }
+                addTo(total->second, line);
+            }
+            projects.push_back(project_line);
+        }
+    }
+
+    std::vector<ReportLine> totals;
+    for (auto it = phase_totals.begin(); it != phase_totals.end(); ++it)
+        totals.push_back(it->second);
+
+    printLines("Project", projects, projects.size());
+    printLines("Phase", totals, totals.size());
+    printLines("Slowest phases", phases, 10);
+    return true;
+}
@@ -0,0 +1,313 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "shell_coprocess.h"
+
+#include "child_process_io_handler.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static bool DEBUG_SHELL_COPROCESS = getenv("BUILD_SHELL_DEBUG_SHELL_COPROCESS") != 0;
+
+std::string ShellCoprocess::quote(const std::string &str)
+{
+    std::string quoted = "'";
+    for (auto it = str.begin(); it != str.end(); ++it) {
+        if (*it == '\'')
+            quoted += "'\\''";
+        else if (*it == '\n')
+            quoted += "'$'\\n''";
+        else
+            quoted += *it;
+    }
+    quoted += "'";
+    return quoted;
+}
+
+// Bash scripts are sourced by the subshell instead of starting a new bash
+static bool is_bash_script(const std::string &script)
+{
+    FILE *file = fopen(script.c_str(), "re");
+    if (!file)
+        return false;
+    char line[64];
+    bool bash = false;
+    if (fgets(line, sizeof line, file)) {
+        bash = strcmp(line, "#!/bin/bash\n") == 0
+            || strcmp(line, "#!/usr/bin/env bash\n") == 0;
+    }
+    fclose(file);
+    return bash;
+}
+
+// Makes sure a ChildProcessIoHandler waiting on a fifo sees a hangup, even
+// if bash never opened it
+static void hangup_fifo(const std::string &fifo)
+{
+    int fd = open(fifo.c_str(), O_WRONLY|O_NONBLOCK|O_CLOEXEC);
+    if (fd >= 0)
+        close(fd);
+}
+
+// Writing to a shell that exited raises SIGPIPE, which would kill
+// build_shell. It is blocked for this thread while writing, so the write
+// fails with EPIPE instead, and a SIGPIPE left pending by it is discarded.
+// Ignoring SIGPIPE for the whole process would be inherited by every
+// command build_shell starts
+static bool write_to_shell(int fd, const std::string &data)
+{
+    sigset_t sigpipe_set;
+    sigset_t old_set;
+    sigset_t pending_set;
+    sigemptyset(&sigpipe_set);
+    sigaddset(&sigpipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe_set, &old_set);
+    sigpending(&pending_set);
+    bool was_pending = sigismember(&pending_set, SIGPIPE);
+
+    bool success = true;
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t w = write(fd, data.c_str() + written, data.size() - written);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            int write_errno = errno;
+            if (write_errno == EPIPE && !was_pending) {
+                timespec no_wait = { 0, 0 };
+                while (sigtimedwait(&sigpipe_set, nullptr, &no_wait) < 0 && errno == EINTR)
+                    ;
+            }
+            errno = write_errno;
+            success = false;
+            break;
+        }
+        written += w;
+    }
+
+    int saved_errno = errno;
+    pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+    errno = saved_errno;
+    return success;
+}
+
+ShellCoprocess::ShellCoprocess(const Configuration &configuration, const std::string &environment_script)
+    : m_configuration(configuration)
+    , m_pid(-1)
+    , m_command_fd(-1)
+    , m_status_fd(-1)
+    , m_next_id(0)
+    , m_error(true)
+{
+    int command_pipe[2];
+    int status_pipe[2];
+    if (pipe2(command_pipe, O_CLOEXEC)) {
+        fprintf(stderr, "Failed to create command pipe for shell: %s\n", strerror(errno));
+        return;
+    }
+    if (pipe2(status_pipe, O_CLOEXEC)) {
+        fprintf(stderr, "Failed to create status pipe for shell: %s\n", strerror(errno));
+        close(command_pipe[0]);
+        close(command_pipe[1]);
+        return;
+    }
+
+    std::string driver;
+    if (environment_script.size())
+        driver += "source " + quote(environment_script) + " || exit 1\n";
+    std::string env_file = m_configuration.findBuildEnvFile();
+    if (env_file.size())
+        driver += "source " + quote(env_file) + " || exit 1\n";
+    driver +=
+        "while IFS= read -r -u 4 bs_command_line; do\n"
+        "    bs_command_id=${bs_command_line%% *}\n"
+        "    ( eval \"${bs_command_line#* }\" ) 3>&- 4<&-\n"
+        "    echo \"$bs_command_id $?\" >&3\n"
+        "done\n";
+
+    m_pid = fork();
+    if (m_pid < 0) {
+        fprintf(stderr, "Failed to fork shell: %s\n", strerror(errno));
+        close(command_pipe[0]);
+        close(command_pipe[1]);
+        close(status_pipe[0]);
+        close(status_pipe[1]);
+        return;
+    }
+
+    if (m_pid == 0) {
+        // The pipes are copied above 10 first, so neither can be replaced by
+        // the dup2 of the other. The copies are closed when bash is executed,
+        // only fd 3 and 4 are left open for it
+        int command_in = fcntl(command_pipe[0], F_DUPFD_CLOEXEC, 10);
+        int status_out = fcntl(status_pipe[1], F_DUPFD_CLOEXEC, 10);
+        if (command_in < 0 || status_out < 0 || dup2(command_in, 4) < 0 || dup2(status_out, 3) < 0) {
+            fprintf(stderr, "Failed to set up shell file descriptors: %s\n", strerror(errno));
+            _exit(1);
+        }
+        execlp("bash", "bash", "--noprofile", "--norc", "-c", driver.c_str(), nullptr);
+        fprintf(stderr, "Failed to execute bash: %s\n", strerror(errno));
+        _exit(1);
+    }
+
+    close(command_pipe[0]);
+    close(status_pipe[1]);
+    m_command_fd = command_pipe[1];
+    m_status_fd = status_pipe[0];
+    m_error = false;
+}
+
+ShellCoprocess::~ShellCoprocess()
+{
+    if (m_command_fd >= 0)
+        close(m_command_fd);
+    if (m_status_fd >= 0)
+        close(m_status_fd);
+    if (m_pid > 0) {
+        int status;
+        while (waitpid(m_pid, &status, 0) < 0 && errno == EINTR)
+            ;
+    }
+}
+
+int ShellCoprocess::run(const std::string &phase,
+                        const std::string &project_name,
+                        const std::string &working_directory,
+                        const std::string &script,
+                        const std::string &args,
+                        const std::vector<std::pair<std::string, std::string>> &environment,
+                        int out_file,
+                        bool print,
+                        bool print_errors)
+{
+    // The command runs in a subshell, so the exports do not leak into the
+    // next command
+    std::string command_line;
+    for (auto it = environment.begin(); it != environment.end(); ++it)
+        command_line += "export " + it->first + "=" + quote(it->second) + "; ";
+    command_line += is_bash_script(script) ? "source " : "";
+    command_line += quote(script) + " " + args;
+    return runCommand(phase, project_name, working_directory, command_line, out_file, print, print_errors);
+}
+
+int ShellCoprocess::runCommand(const std::string &phase,
+                               const std::string &project_name,
+                               const std::string &working_directory,
+                               const std::string &command_line,
+                               int out_file,
+                               bool print,
+                               bool print_errors)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_error)
+        return -1;
+
+    std::string command = "{ ";
+    if (working_directory.size())
+        command += "cd " + quote(working_directory) + " && ";
+    command += command_line + "; }";
+    if (command.find('\n') != std::string::npos) {
+        fprintf(stderr, "Can not send command with new line to shell: %s\n", command.c_str());
+        return -1;
+    }
+
+    std::string fifo_dir = m_configuration.tempFilePath() + "/build_shell_" + project_name + "_XXXXXX";
+    if (!mkdtemp(&fifo_dir[0])) {
+        fprintf(stderr, "Failed to create directory for output fifos %s: %s\n", fifo_dir.c_str(), strerror(errno));
+        return -1;
+    }
+    std::string stdout_fifo = fifo_dir + "/stdout";
+    std::string stderr_fifo = fifo_dir + "/stderr";
+    int exit_code = -1;
+    if (mkfifo(stdout_fifo.c_str(), S_IRUSR|S_IWUSR) || mkfifo(stderr_fifo.c_str(), S_IRUSR|S_IWUSR)) {
+        fprintf(stderr, "Failed to create output fifos in %s: %s\n", fifo_dir.c_str(), strerror(errno));
+    } else {
+        command += " > " + quote(stdout_fifo) + " 2> " + quote(stderr_fifo);
+
+        ChildProcessIoHandler io_handler(phase, project_name, out_file, stdout_fifo, stderr_fifo);
+        io_handler.setPrintStdOut(print);
+        io_handler.setPrintStdErr(print_errors);
+        io_handler.setUseRoller(m_configuration.jobs() == 1);
+        if (!io_handler.error()) {
+            io_handler.setupMasterProcessState();
+
+            unsigned long id = m_next_id++;
+            std::string line = std::to_string(id) + " " + command + "\n";
+            if (DEBUG_SHELL_COPROCESS)
+                fprintf(stderr, "sending to shell: %s", line.c_str());
+
+            if (!write_to_shell(m_command_fd, line)) {
+                if (errno == EPIPE)
+                    fprintf(stderr, "Failed to send command to shell, the shell has exited\n");
+                else
+                    fprintf(stderr, "Failed to send command to shell: %s\n", strerror(errno));
+                m_error = true;
+            }
+            if (!m_error && !readStatus(id, &exit_code))
+                m_error = true;
+        }
+        hangup_fifo(stdout_fifo);
+        hangup_fifo(stderr_fifo);
+    }
+
+    unlink(stdout_fifo.c_str());
+    unlink(stderr_fifo.c_str());
+    rmdir(fifo_dir.c_str());
+    return exit_code;
+}
+
+bool ShellCoprocess::readStatus(unsigned long id, int *exit_code)
+{
+    while (true) {
+        size_t new_line = m_status_buffer.find('\n');
+        if (new_line != std::string::npos) {
+            std::string line = m_status_buffer.substr(0, new_line);
+            m_status_buffer.erase(0, new_line + 1);
+            unsigned long status_id;
+            int status;
+            if (sscanf(line.c_str(), "%lu %d", &status_id, &status) == 2 && status_id == id) {
+                *exit_code = status;
+                return true;
+            }
+            fprintf(stderr, "Unexpected status from shell: %s\n", line.c_str());
+            continue;
+        }
+
+        char buffer[256];
+        ssize_t r = read(m_status_fd, buffer, sizeof buffer);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0) {
+            fprintf(stderr, "Shell for running scripts exited unexpectedly\n");
+            return false;
+        }
+        m_status_buffer.append(buffer, r);
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef SHELL_COPROCESS_H
+#define SHELL_COPROCESS_H
+
+#include "configuration.h"
+
+#include <string>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <sys/types.h>
+
+// A bash process that sources the environment of a project once and then
+// runs the phase scripts sent to it, one line per command on a pipe. Each
+// command runs in a subshell with its output redirected to fifos that a
+// ChildProcessIoHandler reads, and its exit status is reported on fd 3.
+class ShellCoprocess
+{
+public:
+    ShellCoprocess(const Configuration &configuration, const std::string &environment_script);
+    ~ShellCoprocess();
+
+    bool error() const { return m_error; }
+
+    int run(const std::string &phase,
+            const std::string &project_name,
+            const std::string &working_directory,
+            const std::string &script,
+            const std::string &args,
+            const std::vector<std::pair<std::string, std::string>> &environment,
+            int out_file,
+            bool print,
+            bool print_errors);
+    int runCommand(const std::string &phase,
+                   const std::string &project_name,
+                   const std::string &working_directory,
+                   const std::string &command_line,
+                   int out_file,
+                   bool print,
+                   bool print_errors);
+
+    static std::string quote(const std::string &str);
+
+private:
+    bool readStatus(unsigned long id, int *exit_code);
+
+    const Configuration &m_configuration;
+    pid_t m_pid;
+    int m_command_fd;
+    int m_status_fd;
+    unsigned long m_next_id;
+    std::string m_status_buffer;
+    std::mutex m_mutex;
+    bool m_error;
+};
+
+#endif
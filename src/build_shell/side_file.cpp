@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "side_file.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <libgen.h>
+
+SideFile::SideFile(const std::string &file, const std::string &suffix)
+    : m_path(pathFor(file, suffix))
+    , m_has_stat(false)
+{
+    char real_path[PATH_MAX];
+    if (!realpath(file.c_str(), real_path))
+        return;
+    m_file = real_path;
+    m_has_stat = stat(m_file.c_str(), &m_stat) == 0;
+}
+
+const std::string &SideFile::path() const
+{
+    return m_path;
+}
+
+const std::string &SideFile::file() const
+{
+    return m_file;
+}
+
+bool SideFile::hasStat() const
+{
+    return m_has_stat;
+}
+
+const struct stat &SideFile::fileStat() const
+{
+    return m_stat;
+}
+
+bool SideFile::write(const std::string &content) const
+{
+    std::string tmp_file = m_path + "." + std::to_string(getpid());
+    int file = open(tmp_file.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if (file < 0)
+        return false;
+    size_t written = 0;
+    while (written < content.size()) {
+        ssize_t w = ::write(file, content.data() + written, content.size() - written);
+        if (w <= 0)
+            break;
+        written += w;
+    }
+    if (close(file) || written != content.size() || rename(tmp_file.c_str(), m_path.c_str())) {
+        unlink(tmp_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string SideFile::pathFor(const std::string &file, const std::string &suffix)
+{
+    std::string dir = file;
+    std::string base = file;
+    dir = dirname(&dir[0]);
+    base = basename(&base[0]);
+    return dir + "/." + base + suffix;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef SIDE_FILE_H
+#define SIDE_FILE_H
+
+#include <string>
+
+#include <sys/stat.h>
+
+// A file stored next to another one as .<name><suffix>, holding what was
+// derived from it, like the tree snapshots and the buildset index. Its
+// content records the real path, size and modification time of the file it
+// was made from, so stale side files are recognized.
+class SideFile
+{
+public:
+    SideFile(const std::string &file, const std::string &suffix);
+
+    // The side file itself
+    const std::string &path() const;
+    // The real path of the file, empty if it does not exist
+    const std::string &file() const;
+    bool hasStat() const;
+    const struct stat &fileStat() const;
+
+    // Writes content to a temporary file next to the side file and renames
+    // it, so a concurrent reader sees the old or the new content. Read only
+    // directories just have no side file
+    bool write(const std::string &content) const;
+
+    static std::string pathFor(const std::string &file, const std::string &suffix);
+
+private:
+    std::string m_path;
+    std::string m_file;
+    struct stat m_stat;
+    bool m_has_stat;
+};
+
+#endif //SIDE_FILE_H
@@ -0,0 +1,175 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "timing_history.h"
+
+#include "build_report.h"
+#include "json_tree.h"
+#include "tree_builder.h"
+#include "tree_writer.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+static const double latest_weight = 0.5;
+
+class HistoryLock
+{
+public:
+    HistoryLock(const std::string &file)
+        : m_fd(open((file + ".lock").c_str(), O_RDWR|O_CREAT|O_CLOEXEC, S_IRUSR|S_IWUSR))
+    {
+        if (m_fd >= 0)
+            while (flock(m_fd, LOCK_EX) && errno == EINTR);
+    }
+    ~HistoryLock()
+    {
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+private:
+    int m_fd;
+};
+
+TimingHistory::TimingHistory(const Configuration &configuration)
+    : m_configuration(configuration)
+{
+}
+
+void TimingHistory::load()
+{
+    std::map<std::string, ProjectTimings> build_dirs;
+    read(build_dirs);
+    m_projects = build_dirs[m_configuration.buildDir()];
+}
+
+double TimingHistory::estimate(const std::string &project) const
+{
+    auto timings = m_projects.find(project);
+    if (timings == m_projects.end())
+        return -1;
+
+    double seconds = 0;
+    for (auto it = timings->second.begin(); it != timings->second.end(); ++it) {
+        if ((it->first == "configure" && !m_configuration.configure())
+            || (it->first == "build" && !m_configuration.build())
+            || (it->first == "install" && !m_configuration.install()))
+            continue;
+        seconds += it->second;
+    }
+    return seconds;
+}
+
+bool TimingHistory::update(const BuildReport &report)
+{
+    auto phases = report.phases();
+    if (phases.empty())
+        return true;
+    if (!Configuration::ensurePath(m_configuration.buildShellConfigDir()))
+        return false;
+
+    HistoryLock lock(historyFile());
+    std::map<std::string, ProjectTimings> build_dirs;
+    read(build_dirs);
+    ProjectTimings &projects = build_dirs[m_configuration.buildDir()];
+    for (auto it = phases.begin(); it != phases.end(); ++it) {
+        if (!it->success)
+            continue;
+        std::map<std::string, double> &timings = projects[it->project];
+        auto previous = timings.find(it->phase);
+        if (previous == timings.end()) {
+            timings[it->phase] = it->usage.wall_seconds;
+        } else {
+            previous->second = latest_weight * it->usage.wall_seconds + (1 - latest_weight) * previous->second;
+        }
+    }
+
+    JT::ObjectNode root;
+    for (auto build_dir = build_dirs.begin(); build_dir != build_dirs.end(); ++build_dir) {
+        JT::ObjectNode *build_dir_node = new JT::ObjectNode();
+        for (auto project = build_dir->second.begin(); project != build_dir->second.end(); ++project) {
+            JT::ObjectNode *project_node = new JT::ObjectNode();
+            for (auto phase = project->second.begin(); phase != project->second.end(); ++phase) {
+                char seconds[32];
+                snprintf(seconds, sizeof seconds, "%.3f", phase->second);
+                project_node->addValueToObject(phase->first, seconds, JT::Token::Number);
+            }
+            build_dir_node->insertNode(project->first, project_node);
+        }
+        root.insertNode(build_dir->first, build_dir_node);
+    }
+
+    std::string temp_file = historyFile() + ".tmp";
+    {
+        TreeWriter writer(temp_file);
+        writer.write(&root);
+        if (writer.error()) {
+            unlink(temp_file.c_str());
+            return false;
+        }
+    }
+    if (rename(temp_file.c_str(), historyFile().c_str())) {
+        fprintf(stderr, "Failed to write timing history %s : %s\n", historyFile().c_str(), strerror(errno));
+        unlink(temp_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string TimingHistory::historyFile() const
+{
+    return m_configuration.buildShellConfigDir() + "/timing_history.json";
+}
+
+bool TimingHistory::read(std::map<std::string, ProjectTimings> &build_dirs) const
+{
+    std::string file = historyFile();
+    if (access(file.c_str(), F_OK))
+        return false;
+
+    TreeBuilder tree_builder(file);
+    if (!tree_builder.load() || !tree_builder.rootNode())
+        return false;
+
+    // Build dirs contain the path delimiter, so the tree is iterated
+    JT::ObjectNode *root = tree_builder.rootNode();
+    for (auto build_dir = root->begin(); build_dir != root->end(); ++build_dir) {
+        JT::ObjectNode *build_dir_node = build_dir->second->asObjectNode();
+        if (!build_dir_node)
+            continue;
+        ProjectTimings &projects = build_dirs[build_dir->first.string()];
+        for (auto project = build_dir_node->begin(); project != build_dir_node->end(); ++project) {
+            JT::ObjectNode *project_node = project->second->asObjectNode();
+            if (!project_node)
+                continue;
+            for (auto phase = project_node->begin(); phase != project_node->end(); ++phase) {
+                if (phase->second->asNumberNode())
+                    projects[project->first.string()][phase->first.string()] = phase->second->asNumberNode()->number();
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef TIMING_HISTORY_H
+#define TIMING_HISTORY_H
+
+#include "configuration.h"
+
+#include <string>
+#include <map>
+
+class BuildReport;
+
+// How long the phases of each project took in earlier builds, per build
+// dir. The durations are kept in timing_history.json in the build_shell
+// config dir as a rolling average, where the latest build weighs half.
+class TimingHistory
+{
+public:
+    TimingHistory(const Configuration &configuration);
+
+    void load();
+
+    // The seconds the phases this build runs took last time, or -1 if the
+    // project was not built in this build dir before
+    double estimate(const std::string &project) const;
+
+    // Merges the successful phases of report into the history file
+    bool update(const BuildReport &report);
+
+private:
+    typedef std::map<std::string, std::map<std::string, double>> ProjectTimings;
+
+    std::string historyFile() const;
+    bool read(std::map<std::string, ProjectTimings> &build_dirs) const;
+
+    const Configuration &m_configuration;
+    ProjectTimings m_projects;
+};
+
+#endif //TIMING_HISTORY_H
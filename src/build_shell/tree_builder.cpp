@@ -22,6 +22,8 @@
 #include "tree_builder.h"
 
 #include "json_tree.h"
+#include "tree_snapshot.h"
+#include "buildset_index.h"
 
 TreeBuilder::TreeBuilder(const std::string &file,
             std::function<void(JT::Token *next_token)> token_transformer)
@@ -29,6 +31,9 @@ TreeBuilder::TreeBuilder(const std::string &file,
     , m_file_name(file)
     , m_mapped_file(m_file_name)
     , m_token_transformer(token_transformer)
+    , m_use_snapshot(false)
+    , m_snapshot_data(nullptr)
+    , m_loaded_from_snapshot(false)
 {
     if (!m_file_name.size()) {
         return;
@@ -40,8 +45,42 @@ TreeBuilder::~TreeBuilder()
 {
 }
 
+void TreeBuilder::setUseSnapshot(bool use, std::string *data)
+{
+    m_use_snapshot = use;
+    m_snapshot_data = data;
+}
+
+bool TreeBuilder::loadedFromSnapshot() const
+{
+    return m_loaded_from_snapshot;
+}
+
+void TreeBuilder::setProjects(const std::vector<std::string> &projects)
+{
+    m_projects = projects;
+}
+
 bool TreeBuilder::load()
 {
+    if (m_projects.size() && m_file_name.size()) {
+        const char *data = static_cast<const char *>(m_mapped_file.map());
+        if (!data)
+            return false;
+        if (loadProjects(data))
+            return true;
+    }
+
+    std::unique_ptr<TreeSnapshot> snapshot;
+    if (m_use_snapshot && m_file_name.size()) {
+        snapshot.reset(new TreeSnapshot(m_file_name));
+        if (JT::ObjectNode *root = snapshot->load(m_snapshot_data)) {
+            m_node.reset(root);
+            m_loaded_from_snapshot = true;
+            return true;
+        }
+    }
+
     const char *data = static_cast<const char *>(m_mapped_file.map());
     if (!data)
         return false;
@@ -55,6 +94,9 @@ bool TreeBuilder::load()
     auto tree_build = tree_builder.build(&tokenizer);
     if (tree_build.second == JT::Error::NoError) {
         m_node.reset(tree_build.first->asObjectNode());
+        if (snapshot)
+            snapshot->store(m_node.get(), data, m_mapped_file.size(),
+                            m_snapshot_data ? *m_snapshot_data : std::string());
     } else {
         delete tree_build.first;
         return false;
@@ -63,6 +105,38 @@ bool TreeBuilder::load()
     return true;
 }
 
+// The members are given to the tokenizer straight from the mapped file,
+// wrapped in a new top level object
+bool TreeBuilder::loadProjects(const char *data)
+{
+    BuildsetIndex index(m_file_name);
+    if (!index.load(data, m_mapped_file.size()))
+        return false;
+
+    JT::TreeBuilder tree_builder;
+    tree_builder.create_root_if_needed = true;
+    JT::Tokenizer tokenizer;
+    tokenizer.allowNewLineAsTokenDelimiter(true);
+    tokenizer.allowSuperfluousComma(true);
+    tokenizer.addData("{", 1);
+    for (auto it = m_projects.begin(); it != m_projects.end(); ++it) {
+        const BuildsetIndex::Project *project = index.project(*it);
+        if (!project)
+            continue;
+        tokenizer.addData(data + project->offset, project->size);
+        tokenizer.addData(",", 1);
+    }
+    tokenizer.addData("}", 1);
+    tokenizer.registerTokenTransformer(m_token_transformer);
+    auto tree_build = tree_builder.build(&tokenizer);
+    if (tree_build.second != JT::Error::NoError) {
+        delete tree_build.first;
+        return false;
+    }
+    m_node.reset(tree_build.first->asObjectNode());
+    return true;
+}
+
 JT::ObjectNode *TreeBuilder::rootNode() const
 {
     return m_node.get();
@@ -25,6 +25,7 @@
 #include <string>
 #include <functional>
 #include <memory>
+#include <vector>
 
 #include "mmapped_file.h"
 
@@ -41,15 +42,33 @@ public:
             std::function<void(JT::Token *next_token)> token_transformer = nullptr);
     ~TreeBuilder();
 
+    // Loads the tree from a TreeSnapshot of the file when it is up to
+    // date, and stores one after parsing the file otherwise. data is
+    // stored with the tree, since the token transformer does not run
+    // when the snapshot is used
+    void setUseSnapshot(bool use, std::string *data = nullptr);
+    bool loadedFromSnapshot() const;
+
+    // Only the top level members named in projects are parsed, found
+    // through the BuildsetIndex of the file. Neither snapshot is used then.
+    // The whole file is parsed if it can not be indexed
+    void setProjects(const std::vector<std::string> &projects);
+
     bool load();
     JT::ObjectNode *rootNode() const;
     JT::ObjectNode *takeRootNode();
 
 private:
+    bool loadProjects(const char *data);
+
     std::unique_ptr<JT::ObjectNode> m_node;
     const std::string &m_file_name;
     MmappedReadFile m_mapped_file;
     std::function<void(JT::Token *next_token)> m_token_transformer;
+    bool m_use_snapshot;
+    std::string *m_snapshot_data;
+    bool m_loaded_from_snapshot;
+    std::vector<std::string> m_projects;
 
 };
 
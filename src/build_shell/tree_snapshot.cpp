@@ -0,0 +1,286 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "tree_snapshot.h"
+#include "fingerprint_store.h"
+
+#include "json_tree.h"
+#include "mmapped_file.h"
+
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <memory>
+
+static bool NO_SNAPSHOT = getenv("BUILD_SHELL_NO_SNAPSHOT") != 0;
+
+static const char SNAPSHOT_MAGIC[8] = { 'B', 'S', 'S', 'N', 'A', 'P', 0, 1 };
+static const int MAX_DEPTH = 512;
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t hash;
+    uint32_t path_size;
+    uint32_t data_size;
+    uint64_t tree_size;
+};
+
+enum NodeType : char {
+    ObjectType = 'o',
+    ArrayType = 'a',
+    StringType = 's',
+    NumberType = 'n',
+    BoolType = 'b',
+    NullType = 'z'
+};
+
+static void appendU32(std::string &out, uint32_t value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof value);
+}
+
+static void appendString(std::string &out, const std::string &value)
+{
+    appendU32(out, value.size());
+    out.append(value);
+}
+
+static void appendNode(std::string &out, const JT::Node *node)
+{
+    if (const JT::ObjectNode *object = node->asObjectNode()) {
+        out.push_back(ObjectType);
+        size_t count_pos = out.size();
+        uint32_t count = 0;
+        appendU32(out, 0);
+        for (auto it = object->begin(); it != object->end(); ++it) {
+            appendString(out, it->first.string());
+            appendNode(out, it->second);
+            count++;
+        }
+        memcpy(&out[count_pos], &count, sizeof count);
+    } else if (const JT::ArrayNode *array = node->asArrayNode()) {
+        out.push_back(ArrayType);
+        appendU32(out, array->size());
+        for (size_t i = 0; i < array->size(); i++)
+            appendNode(out, array->index(i));
+    } else if (const JT::StringNode *string = node->asStringNode()) {
+        out.push_back(StringType);
+        appendString(out, string->string());
+    } else if (const JT::NumberNode *number = node->asNumberNode()) {
+        out.push_back(NumberType);
+        char buffer[32];
+        snprintf(buffer, sizeof buffer, "%.17g", number->number());
+        appendString(out, buffer);
+    } else if (const JT::BooleanNode *boolean = node->asBooleanNode()) {
+        out.push_back(BoolType);
+        out.push_back(boolean->value() ? 1 : 0);
+    } else {
+        out.push_back(NullType);
+    }
+}
+
+static JT::Node *createValueNode(JT::Token::Type type, const std::string &value)
+{
+    JT::Token token;
+    token.value_type = type;
+    token.value.data = value.c_str();
+    token.value.size = value.size();
+    return JT::Node::createValueNode(&token);
+}
+
+class SnapshotReader
+{
+public:
+    SnapshotReader(const char *data, size_t size)
+        : m_pos(data)
+        , m_end(data + size)
+    { }
+
+    bool readU32(uint32_t *value)
+    {
+        if (size_t(m_end - m_pos) < sizeof *value)
+            return false;
+        memcpy(value, m_pos, sizeof *value);
+        m_pos += sizeof *value;
+        return true;
+    }
+
+    bool readString(std::string *value)
+    {
+        uint32_t size;
+        if (!readU32(&size) || size_t(m_end - m_pos) < size)
+            return false;
+        value->assign(m_pos, size);
+        m_pos += size;
+        return true;
+    }
+
+    JT::Node *readNode(int depth)
+    {
+        if (m_pos == m_end || depth > MAX_DEPTH)
+            return nullptr;
+        char type = *m_pos++;
+        uint32_t count;
+        switch (type) {
+        case ObjectType: {
+            if (!readU32(&count))
+                return nullptr;
+            std::unique_ptr<JT::ObjectNode> object(new JT::ObjectNode());
+            for (uint32_t i = 0; i < count; i++) {
+                if (!readString(&m_string))
+                    return nullptr;
+                JT::Property property(m_string);
+                JT::Node *child = readNode(depth + 1);
+                if (!child)
+                    return nullptr;
+                object->insertNode(property, child);
+            }
+            return object.release();
+        }
+        case ArrayType: {
+            if (!readU32(&count))
+                return nullptr;
+            std::unique_ptr<JT::ArrayNode> array(new JT::ArrayNode());
+            for (uint32_t i = 0; i < count; i++) {
+                JT::Node *child = readNode(depth + 1);
+                if (!child)
+                    return nullptr;
+                array->append(child);
+            }
+            return array.release();
+        }
+        case StringType:
+            if (!readString(&m_string))
+                return nullptr;
+            return createValueNode(JT::Token::String, m_string);
+        case NumberType:
+            if (!readString(&m_string))
+                return nullptr;
+            return createValueNode(JT::Token::Number, m_string);
+        case BoolType:
+            if (m_pos == m_end)
+                return nullptr;
+            return createValueNode(JT::Token::Bool, *m_pos++ ? "true" : "false");
+        case NullType:
+            return createValueNode(JT::Token::Null, "null");
+        default:
+            return nullptr;
+        }
+    }
+
+    bool atEnd() const
+    {
+        return m_pos == m_end;
+    }
+
+private:
+    const char *m_pos;
+    const char *m_end;
+    std::string m_string;
+};
+
+TreeSnapshot::TreeSnapshot(const std::string &file)
+    : m_snapshot(file, ".snapshot")
+{
+}
+
+JT::ObjectNode *TreeSnapshot::load(std::string *data) const
+{
+    if (NO_SNAPSHOT || !m_snapshot.hasStat() || access(m_snapshot.path().c_str(), R_OK))
+        return nullptr;
+
+    const std::string &file = m_snapshot.file();
+    const struct stat &file_stat = m_snapshot.fileStat();
+    MmappedReadFile snapshot(m_snapshot.path());
+    const char *snapshot_data = static_cast<const char *>(snapshot.map());
+    if (!snapshot_data || snapshot.size() < sizeof(SnapshotHeader))
+        return nullptr;
+
+    SnapshotHeader header;
+    memcpy(&header, snapshot_data, sizeof header);
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof header.magic)
+            || header.size != uint64_t(file_stat.st_size)
+            || sizeof header + header.path_size + header.data_size + header.tree_size != snapshot.size()) {
+        return nullptr;
+    }
+
+    const char *path = snapshot_data + sizeof header;
+    if (file.compare(0, std::string::npos, path, header.path_size))
+        return nullptr;
+
+    // A file rewritten with the same content, ie. by a checkout, only
+    // costs hashing it
+    if (header.mtime_sec != file_stat.st_mtim.tv_sec || header.mtime_nsec != file_stat.st_mtim.tv_nsec) {
+        MmappedReadFile source(file);
+        const char *source_data = static_cast<const char *>(source.map());
+        if (!source_data || source.size() != header.size
+                || fnv1a(source_data, source.size()) != header.hash) {
+            return nullptr;
+        }
+    }
+
+    const char *user_data = path + header.path_size;
+    SnapshotReader reader(user_data + header.data_size, header.tree_size);
+    std::unique_ptr<JT::Node> root(reader.readNode(0));
+    if (!root || !root->asObjectNode() || !reader.atEnd())
+        return nullptr;
+
+    if (data)
+        data->assign(user_data, header.data_size);
+    return static_cast<JT::ObjectNode *>(root.release());
+}
+
+bool TreeSnapshot::store(const JT::ObjectNode *root, const char *source, size_t source_size,
+                         const std::string &data) const
+{
+    if (NO_SNAPSHOT || !m_snapshot.hasStat() || !root || source_size != size_t(m_snapshot.fileStat().st_size))
+        return false;
+
+    const std::string &file = m_snapshot.file();
+    const struct stat &file_stat = m_snapshot.fileStat();
+
+    std::string tree;
+    appendNode(tree, root);
+
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof header.magic);
+    header.size = source_size;
+    header.mtime_sec = file_stat.st_mtim.tv_sec;
+    header.mtime_nsec = file_stat.st_mtim.tv_nsec;
+    header.hash = fnv1a(source, source_size);
+    header.path_size = file.size();
+    header.data_size = data.size();
+    header.tree_size = tree.size();
+
+    std::string content(reinterpret_cast<const char *>(&header), sizeof header);
+    content += file;
+    content += data;
+    content += tree;
+
+    return m_snapshot.write(content);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef TREE_SNAPSHOT_H
+#define TREE_SNAPSHOT_H
+
+#include "side_file.h"
+
+#include <string>
+
+namespace JT {
+    class ObjectNode;
+}
+
+// A binary copy of the tree parsed from a json file, stored next to it as
+// .<name>.snapshot. It is used instead of parsing the file as long as the
+// path, size and modification time of the file are unchanged, or its
+// content hashes to the same value. Reading it is one mmap and no
+// tokenizing. Set BUILD_SHELL_NO_SNAPSHOT to always parse the files.
+class TreeSnapshot
+{
+public:
+    TreeSnapshot(const std::string &file);
+
+    // Returns the stored tree, or nullptr if the snapshot is missing or
+    // stale. data is set to what was stored with the tree
+    JT::ObjectNode *load(std::string *data = nullptr) const;
+    // source is the content the tree was parsed from
+    bool store(const JT::ObjectNode *root, const char *source, size_t source_size,
+               const std::string &data = std::string()) const;
+
+private:
+    SideFile m_snapshot;
+};
+
+#endif //TREE_SNAPSHOT_H
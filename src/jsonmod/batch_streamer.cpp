@@ -0,0 +1,490 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "batch_streamer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <errno.h>
+#include <string.h>
+
+static std::vector<std::string> splitProperty(const std::string &property, const std::string &delimiter)
+{
+    std::vector<std::string> path;
+    size_t pos = 0;
+    while (pos < property.size()) {
+        size_t new_pos = property.find(delimiter, pos);
+        path.push_back(property.substr(pos, new_pos - pos));
+        if (new_pos < std::string::npos - delimiter.size()) {
+            pos = new_pos + delimiter.size();
+        } else {
+            pos = new_pos;
+        }
+    }
+    return path;
+}
+
+static std::string tokenString(const JT::Data &data, JT::Token::Type type)
+{
+    if (type == JT::Token::String && data.size >= 2 && *data.data == '"')
+        return std::string(data.data + 1, data.size - 2);
+    return std::string(data.data, data.size);
+}
+
+static bool isStart(const JT::Token &token)
+{
+    return token.value_type == JT::Token::ObjectStart || token.value_type == JT::Token::ArrayStart;
+}
+
+static bool isEnd(const JT::Token &token)
+{
+    return token.value_type == JT::Token::ObjectEnd || token.value_type == JT::Token::ArrayEnd;
+}
+
+BatchStreamer::BatchStreamer(const Configuration &config)
+    : m_config(config)
+    , m_input_file(-1)
+    , m_output_file(STDOUT_FILENO)
+    , m_modify(false)
+    , m_error(false)
+{
+    const std::vector<Operation> &operations = m_config.operations();
+    for (auto it = operations.begin(); it != operations.end(); ++it) {
+        PendingOperation operation;
+        operation.type = it->type;
+        operation.path = splitProperty(it->property, m_config.delimiter());
+        operation.value = &it->value;
+        operation.done = false;
+        m_operations.push_back(operation);
+        if (it->type != Operation::Get)
+            m_modify = true;
+    }
+
+    if (config.hasInputFile()) {
+        m_input_file = open(m_config.inputFile().c_str(), O_RDONLY|O_CLOEXEC);
+        if (m_input_file < 0) {
+            fprintf(stderr, "%s\n", strerror(errno));
+            m_error = true;
+            return;
+        }
+    } else {
+        m_input_file = STDIN_FILENO;
+    }
+
+    if (m_modify && config.hasInlineSet() && config.hasInputFile()) {
+        m_tmp_output = config.inputFile();
+        m_tmp_output.append("XXXXXX");
+        m_output_file = mkstemp(&m_tmp_output[0]);
+        if (m_output_file == -1) {
+            fprintf(stderr, "%s\n", strerror(errno));
+            m_tmp_output.clear();
+            m_error = true;
+            return;
+        }
+    }
+
+    std::function<void(JT::Serializer *)> callback=
+        std::bind(&BatchStreamer::requestFlushOutBuffer, this, std::placeholders::_1);
+
+    m_tokenizer.allowNewLineAsTokenDelimiter(!m_config.strict());
+    m_tokenizer.allowSuperfluousComma(!m_config.strict());
+    m_serializer.addRequestBufferCallback(callback);
+
+    JT::SerializerOptions options = m_serializer.options();
+    options.setPretty(!m_config.compactPrint());
+    m_serializer.setOptions(options);
+}
+
+BatchStreamer::~BatchStreamer()
+{
+    if (m_config.hasInputFile() && m_input_file >= 0) {
+        close(m_input_file);
+    }
+    if (m_tmp_output.size()) {
+        fsync(m_output_file);
+        close(m_output_file);
+        if (!m_error) {
+            rename(m_tmp_output.c_str(), m_config.inputFile().c_str());
+        } else if (unlink(m_tmp_output.c_str())) {
+            fprintf(stderr, "%s\n", strerror(errno));
+        }
+    }
+}
+
+void BatchStreamer::requestFlushOutBuffer(JT::Serializer *serializer)
+{
+    JT::SerializerBuffer buffer = serializer->buffers().front();
+    serializer->clearBuffers();
+
+    writeOutBuffer(buffer);
+    serializer->appendBuffer(buffer.buffer,buffer.size);
+}
+
+void BatchStreamer::stream()
+{
+    char in_buffer[4096];
+    char out_buffer[4096];
+    m_serializer.appendBuffer(out_buffer, sizeof out_buffer);
+    ssize_t bytes_read = 0;
+    while(!m_error && !finished() && (bytes_read = read(m_input_file, in_buffer, 4096)) > 0) {
+        m_tokenizer.addData(in_buffer,bytes_read, true);
+        JT::Token token;
+        JT::Error tokenizer_error;
+        while (!m_error && (tokenizer_error = m_tokenizer.nextToken(&token)) == JT::Error::NoError) {
+            handleToken(token);
+        }
+        if (tokenizer_error != JT::Error::NeedMoreData
+                && tokenizer_error != JT::Error::NoError) {
+            fprintf(stderr, "Error while parsing json. %d\n", tokenizer_error);
+            m_error = true;
+        }
+    }
+    if (bytes_read < 0) {
+        fprintf(stderr, "Error while reading input %s\n", strerror(errno));
+        m_error = true;
+    }
+    if (m_error)
+        return;
+
+    for (auto it = m_operations.begin(); it != m_operations.end(); ++it) {
+        if (it->type != Operation::Get && !it->done) {
+            fprintf(stderr, "Could not find the parent of %s\n", it->path.back().c_str());
+            m_error = true;
+            return;
+        }
+    }
+
+    if (m_modify) {
+        auto unflushed_out_buffers = m_serializer.buffers();
+        for (auto it = unflushed_out_buffers.begin(); it != unflushed_out_buffers.end(); ++it) {
+            writeOutBuffer(*it);
+        }
+        char new_line[] = "\n";
+        write(m_output_file, new_line, sizeof new_line - 1);
+    }
+
+    printResults();
+}
+
+// Reading stops as soon as every get is answered and nothing is modified
+bool BatchStreamer::finished() const
+{
+    if (m_modify || m_captures.size())
+        return false;
+    for (auto it = m_operations.begin(); it != m_operations.end(); ++it) {
+        if (!it->done)
+            return false;
+    }
+    return true;
+}
+
+void BatchStreamer::handleToken(JT::Token &token)
+{
+    if (isEnd(token)) {
+        if (m_frames.empty()) {
+            fprintf(stderr, "Unbalanced json\n");
+            m_error = true;
+            return;
+        }
+        if (m_modify)
+            writeMissing(m_frames.size() - 1);
+        writeToken(token);
+        for (size_t i = 0; i < m_captures.size(); ) {
+            if (m_captures[i]->frame_count == m_frames.size()) {
+                finishCapture(m_captures[i].get());
+                m_captures.erase(m_captures.begin() + i);
+            } else {
+                i++;
+            }
+        }
+        m_frames.pop_back();
+        return;
+    }
+
+    std::string name;
+    if (m_frames.size()) {
+        Frame &parent = m_frames.back();
+        if (parent.array)
+            name = std::to_string(parent.index++);
+        else
+            name = tokenString(token.name, token.name_type);
+
+        for (auto it = m_operations.begin(); it != m_operations.end(); ++it) {
+            if (it->type == Operation::Get)
+                continue;
+            Match matched = match(*it, name);
+            if (matched == ExactMatch && it->type == Operation::Set) {
+                if (isStart(token)) {
+                    fprintf(stderr, "Its not possible to change the value of and object or array\n");
+                    m_error = true;
+                    return;
+                }
+                token.value.data = it->value->c_str();
+                token.value.size = it->value->size();
+                it->done = true;
+            } else if (matched == ExactMatch && token.value_type != JT::Token::ObjectStart) {
+                fprintf(stderr, "Can not create object %s, the property already exists\n", name.c_str());
+                m_error = true;
+                return;
+            } else if (matched == ExactMatch) {
+                it->done = true;
+            } else if (matched == PrefixMatch && token.value_type != JT::Token::ObjectStart) {
+                fprintf(stderr, "Can not add %s to %s, it is not an object\n", it->path.back().c_str(), name.c_str());
+                m_error = true;
+                return;
+            }
+        }
+    }
+
+    writeToken(token);
+
+    if (m_frames.size()) {
+        for (size_t i = 0; i < m_operations.size(); i++) {
+            PendingOperation &operation = m_operations[i];
+            if (operation.type != Operation::Get || operation.done || match(operation, name) != ExactMatch)
+                continue;
+            if (isStart(token)) {
+                startCapture(i, token);
+            } else {
+                operation.result = tokenString(token.value, token.value_type);
+                operation.done = true;
+            }
+        }
+    }
+
+    if (isStart(token)) {
+        Frame frame;
+        frame.name = name;
+        frame.array = token.value_type == JT::Token::ArrayStart;
+        frame.index = 0;
+        m_frames.push_back(frame);
+    }
+}
+
+// The first frame is the root object which has no name, so a token inside
+// frame n has a path of length n
+BatchStreamer::Match BatchStreamer::match(const PendingOperation &operation, const std::string &name) const
+{
+    size_t depth = m_frames.size();
+    if (operation.path.size() < depth)
+        return NoMatch;
+    for (size_t i = 1; i < depth; i++) {
+        if (m_frames[i].name != operation.path[i - 1])
+            return NoMatch;
+    }
+    if (operation.path[depth - 1] != name)
+        return NoMatch;
+    return operation.path.size() == depth ? ExactMatch : PrefixMatch;
+}
+
+void BatchStreamer::startCapture(size_t operation, const JT::Token &token)
+{
+    std::unique_ptr<Capture> capture(new Capture());
+    capture->operation = operation;
+    capture->frame_count = m_frames.size() + 1;
+    capture->serializer.appendBuffer(capture->buffer, sizeof capture->buffer);
+    Capture *capture_ptr = capture.get();
+    capture->serializer.addRequestBufferCallback([capture_ptr](JT::Serializer *serializer) {
+        JT::SerializerBuffer buffer = serializer->buffers().front();
+        serializer->clearBuffers();
+        capture_ptr->output.append(buffer.buffer, buffer.used);
+        serializer->appendBuffer(buffer.buffer, buffer.size);
+    });
+    JT::SerializerOptions options = capture->serializer.options();
+    options.setPretty(false);
+    capture->serializer.setOptions(options);
+
+    JT::Token first_token = token;
+    first_token.name.data = "";
+    first_token.name.size = 0;
+    first_token.name_type = JT::Token::Ascii;
+    capture->serializer.write(first_token);
+    m_captures.push_back(std::move(capture));
+}
+
+void BatchStreamer::finishCapture(Capture *capture)
+{
+    auto buffers = capture->serializer.buffers();
+    for (auto it = buffers.begin(); it != buffers.end(); ++it) {
+        capture->output.append(it->buffer, it->used);
+    }
+    m_operations[capture->operation].result = capture->output;
+    m_operations[capture->operation].done = true;
+}
+
+void BatchStreamer::writeToken(const JT::Token &token)
+{
+    if (m_modify)
+        m_serializer.write(token);
+    for (auto it = m_captures.begin(); it != m_captures.end(); ++it) {
+        (*it)->serializer.write(token);
+    }
+}
+
+// Called before the end of a container is written. Properties that are set
+// or created below it and were not found are added here
+void BatchStreamer::writeMissing(size_t frame_index)
+{
+    std::vector<size_t> missing;
+    for (size_t i = 0; i < m_operations.size(); i++) {
+        const PendingOperation &operation = m_operations[i];
+        if (operation.type == Operation::Get || operation.done || operation.path.size() <= frame_index)
+            continue;
+        bool below = true;
+        for (size_t j = 1; j <= frame_index && below; j++) {
+            below = m_frames[j].name == operation.path[j - 1];
+        }
+        if (below)
+            missing.push_back(i);
+    }
+    if (missing.empty())
+        return;
+    if (m_frames[frame_index].array) {
+        fprintf(stderr, "Adding properties to arrays is not supported\n");
+        m_error = true;
+        return;
+    }
+    writeMissingTree(missing, frame_index);
+}
+
+void BatchStreamer::writeMissingTree(const std::vector<size_t> &operations, size_t depth)
+{
+    std::vector<bool> written(operations.size(), false);
+    for (size_t i = 0; i < operations.size(); i++) {
+        if (written[i])
+            continue;
+        const std::string &name = m_operations[operations[i]].path[depth];
+        std::vector<size_t> children;
+        const std::string *value = nullptr;
+        for (size_t j = i; j < operations.size(); j++) {
+            PendingOperation &operation = m_operations[operations[j]];
+            if (operation.path[depth] != name)
+                continue;
+            written[j] = true;
+            operation.done = true;
+            if (operation.path.size() > depth + 1)
+                children.push_back(operations[j]);
+            else if (operation.type == Operation::Set)
+                value = operation.value;
+        }
+
+        JT::Token token;
+        token.name_type = JT::Token::String;
+        token.name.data = name.c_str();
+        token.name.size = name.size();
+        if (value) {
+            if (children.size()) {
+                fprintf(stderr, "Can not set %s to a value and add properties to it\n", name.c_str());
+                m_error = true;
+                return;
+            }
+            token.value_type = JT::Token::String;
+            token.value.data = value->c_str();
+            token.value.size = value->size();
+            writeToken(token);
+            continue;
+        }
+
+        token.value_type = JT::Token::ObjectStart;
+        token.value.data = "{";
+        token.value.size = 1;
+        writeToken(token);
+        if (children.size())
+            writeMissingTree(children, depth + 1);
+        JT::Token end_token;
+        end_token.name_type = JT::Token::Ascii;
+        end_token.name.data = "";
+        end_token.name.size = 0;
+        end_token.value_type = JT::Token::ObjectEnd;
+        end_token.value.data = "}";
+        end_token.value.size = 1;
+        writeToken(end_token);
+    }
+}
+
+void BatchStreamer::writeOutBuffer(const JT::SerializerBuffer &buffer)
+{
+    size_t written = write(m_output_file,buffer.buffer,buffer.used);
+    if (written < buffer.used) {
+        fprintf(stderr, "Error while writing to outbuffer: %s\n", strerror(errno));
+        m_error = true;
+    }
+}
+
+static std::string shellName(const std::vector<std::string> &path)
+{
+    std::string name;
+    for (auto it = path.begin(); it != path.end(); ++it) {
+        if (name.size())
+            name += "_";
+        name += *it;
+    }
+    for (auto it = name.begin(); it != name.end(); ++it) {
+        if (!((*it >= 'a' && *it <= 'z') || (*it >= 'A' && *it <= 'Z') || (*it >= '0' && *it <= '9')))
+            *it = '_';
+    }
+    if (name.empty() || (name[0] >= '0' && name[0] <= '9'))
+        name.insert(0, "_");
+    return name;
+}
+
+static std::string shellQuote(const std::string &value)
+{
+    std::string quoted = "'";
+    for (auto it = value.begin(); it != value.end(); ++it) {
+        if (*it == '\'')
+            quoted += "'\\''";
+        else
+            quoted += *it;
+    }
+    quoted += "'";
+    return quoted;
+}
+
+// Gets print one value per line in the order they were given, or with
+// --shell as name='value' lines that can be passed to eval. Properties that
+// were set in the same run return the new value
+void BatchStreamer::printResults()
+{
+    std::string output;
+    for (auto it = m_operations.begin(); it != m_operations.end(); ++it) {
+        if (it->type != Operation::Get)
+            continue;
+        std::string result = it->result;
+        if (!it->done) {
+            for (auto modified = m_operations.begin(); modified != m_operations.end(); ++modified) {
+                if (modified->type == Operation::Set && modified->path == it->path)
+                    result = *modified->value;
+            }
+        }
+        if (m_config.shellOutput())
+            output += shellName(it->path) + "=" + shellQuote(result) + "\n";
+        else
+            output += result + "\n";
+    }
+    if (output.size() && write(STDOUT_FILENO, output.c_str(), output.size()) < ssize_t(output.size())) {
+        fprintf(stderr, "Error while writing to stdout: %s\n", strerror(errno));
+        m_error = true;
+    }
+}
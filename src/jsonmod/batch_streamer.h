@@ -0,0 +1,103 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef BATCH_STREAMER_H
+#define BATCH_STREAMER_H
+
+#include "json_tokenizer.h"
+#include "configuration.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Applies all the get, set and create operations of a configuration in one
+// pass over the input. The document is only serialized when it is modified,
+// and with --inline it is written back with one rename.
+class BatchStreamer
+{
+public:
+    BatchStreamer(const Configuration &config);
+    ~BatchStreamer();
+
+    bool error() const { return m_error; }
+
+    void stream();
+
+    void requestFlushOutBuffer(JT::Serializer *);
+private:
+    enum Match {
+        NoMatch,
+        PrefixMatch,
+        ExactMatch
+    };
+
+    struct PendingOperation {
+        Operation::Type type;
+        std::vector<std::string> path;
+        const std::string *value;
+        bool done;
+        std::string result;
+    };
+
+    struct Frame {
+        std::string name;
+        bool array;
+        size_t index;
+    };
+
+    struct Capture {
+        size_t operation;
+        size_t frame_count;
+        JT::Serializer serializer;
+        std::string output;
+        char buffer[1024];
+    };
+
+    void handleToken(JT::Token &token);
+    Match match(const PendingOperation &operation, const std::string &name) const;
+    void startCapture(size_t operation, const JT::Token &token);
+    void finishCapture(Capture *capture);
+    void writeToken(const JT::Token &token);
+    void writeMissing(size_t frame_index);
+    void writeMissingTree(const std::vector<size_t> &operations, size_t depth);
+    void writeOutBuffer(const JT::SerializerBuffer &buffer);
+    void printResults();
+    bool finished() const;
+
+    const Configuration &m_config;
+
+    JT::Tokenizer m_tokenizer;
+    JT::Serializer m_serializer;
+
+    int m_input_file;
+    int m_output_file;
+    std::string m_tmp_output;
+
+    std::vector<PendingOperation> m_operations;
+    std::vector<Frame> m_frames;
+    std::vector<std::unique_ptr<Capture>> m_captures;
+
+    bool m_modify;
+    bool m_error;
+};
+
+#endif //BATCH_STREAMER_H
@@ -28,17 +28,20 @@
 #include <sys/stat.h>
 
 #include <iostream>
+#include <stdio.h>
 
 #include <errno.h>
 
 Configuration::Configuration()
     : m_delimiter(".")
+    , m_batch_from_stdin(false)
     , m_inline(false)
     , m_compact(false)
     , m_pretty_print(false)
     , m_create_object(false)
     , m_print_only_name(false)
     , m_strict(false)
+    , m_shell_output(false)
 {
 
 }
@@ -157,8 +160,126 @@ bool Configuration::strict() const
     return m_strict;
 }
 
+void Configuration::addOperation(Operation::Type type, const std::string &property, const std::string &value)
+{
+    Operation operation;
+    operation.type = type;
+    operation.property = property;
+    operation.value = value;
+    m_operations.push_back(operation);
+}
+
+// One operation per line: "get property", "set property value" or
+// "create property". Empty lines and lines starting with # are skipped
+bool Configuration::addOperations(const char *batch_file)
+{
+    FILE *file = stdin;
+    if (strcmp(batch_file, "-") != 0) {
+        file = fopen(batch_file, "re");
+        if (!file) {
+            fprintf(stderr, "Failed to open batch file %s: %s\n", batch_file, strerror(errno));
+            return false;
+        }
+    } else {
+        m_batch_from_stdin = true;
+    }
+
+    bool success = true;
+    char *line = nullptr;
+    size_t line_capacity = 0;
+    ssize_t line_size;
+    while ((line_size = getline(&line, &line_capacity, file)) > 0) {
+        std::string entry(line, line_size);
+        if (entry.back() == '\n')
+            entry.pop_back();
+        if (!entry.size() || entry[0] == '#')
+            continue;
+
+        size_t command_end = entry.find(' ');
+        std::string command = entry.substr(0, command_end);
+        std::string property;
+        std::string value;
+        if (command_end != std::string::npos) {
+            size_t property_end = entry.find(' ', command_end + 1);
+            property = entry.substr(command_end + 1, property_end - command_end - 1);
+            if (property_end != std::string::npos)
+                value = entry.substr(property_end + 1);
+        }
+
+        if (!property.size()) {
+            fprintf(stderr, "Missing property in batch line: %s\n", entry.c_str());
+            success = false;
+        } else if (command == "get") {
+            addOperation(Operation::Get, property);
+        } else if (command == "set") {
+            addOperation(Operation::Set, property, value);
+        } else if (command == "create") {
+            addOperation(Operation::Create, property);
+        } else {
+            fprintf(stderr, "Unknown batch command: %s\n", command.c_str());
+            success = false;
+        }
+    }
+    free(line);
+    if (file != stdin)
+        fclose(file);
+    return success;
+}
+
+const std::vector<Operation> &Configuration::operations() const
+{
+    return m_operations;
+}
+
+bool Configuration::batchMode() const
+{
+    return m_operations.size() != 0;
+}
+
+void Configuration::setShellOutput(bool shell)
+{
+    m_shell_output = shell;
+}
+
+bool Configuration::shellOutput() const
+{
+    return m_shell_output;
+}
+
 bool Configuration::sane() const
 {
+    if (batchMode()) {
+        if (m_property.size() || m_value.size() || m_create_object) {
+            fprintf(stderr, "Batch operations can not be combined with --property, --value or --create-object\n");
+            return false;
+        }
+        if (m_batch_from_stdin && !m_input_file.size()) {
+            fprintf(stderr, "An input file is needed when the batch is read from stdin\n");
+            return false;
+        }
+        bool has_get = false;
+        bool has_modification = false;
+        for (auto it = m_operations.begin(); it != m_operations.end(); ++it) {
+            if (it->type == Operation::Get)
+                has_get = true;
+            else
+                has_modification = true;
+            if (it->type == Operation::Set && !it->property.size()) {
+                fprintf(stderr, "Can not set a value without a property\n");
+                return false;
+            }
+            if (it->property.find("%{*}") != std::string::npos) {
+                fprintf(stderr, "Wildcards are not supported in batch operations: %s\n", it->property.c_str());
+                return false;
+            }
+        }
+        if (has_get && has_modification && !(m_inline && m_input_file.size())) {
+            fprintf(stderr, "Getting and modifying properties in the same run requires --inline and an input file\n");
+            return false;
+        }
+    }
+
+
     if (m_input_file.size()) {
         int input_file_access = m_inline ? W_OK : 0;
         input_file_access |= (R_OK | F_OK);
@@ -23,6 +23,20 @@
 #define CONFIGURATION_H
 
 #include <string>
+#include <vector>
+
+struct Operation
+{
+    enum Type {
+        Get,
+        Set,
+        Create
+    };
+
+    Type type;
+    std::string property;
+    std::string value;
+};
 
 class Configuration
 {
@@ -62,12 +76,22 @@ public:
     void setStrict(bool strict);
     bool strict() const;
 
+    void addOperation(Operation::Type type, const std::string &property, const std::string &value = std::string());
+    bool addOperations(const char *batch_file);
+    const std::vector<Operation> &operations() const;
+    bool batchMode() const;
+
+    void setShellOutput(bool shell);
+    bool shellOutput() const;
+
     bool sane() const;
 private:
     std::string m_input_file;
     std::string m_property;
     std::string m_value;
     std::string m_delimiter;
+    std::vector<Operation> m_operations;
+    bool m_batch_from_stdin;
 
     bool m_inline;
     bool m_compact;
@@ -75,6 +99,7 @@ private:
     bool m_create_object;
     bool m_print_only_name;
     bool m_strict;
+    bool m_shell_output;
 };
 
 #endif //CONFIGURATION_H
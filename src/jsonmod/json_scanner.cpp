@@ -0,0 +1,356 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#include "json_scanner.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSON_SCANNER_X86
+#endif
+
+typedef const char *(*FindFunction)(const char *pos, const char *end);
+
+static inline bool isStructural(char c)
+{
+    return c == '"' || c == '{' || c == '}' || c == '[' || c == ']';
+}
+
+static const char *findStructuralScalar(const char *pos, const char *end)
+{
+    while (pos < end && !isStructural(*pos))
+        pos++;
+    return pos;
+}
+
+static const char *findQuoteOrEscapeScalar(const char *pos, const char *end)
+{
+    while (pos < end && *pos != '"' && *pos != '\\')
+        pos++;
+    return pos;
+}
+
+#ifdef JSON_SCANNER_X86
+// '[' and ']' only differ from '{' and '}' in bit 0x20, and no other
+// characters become a bracket when it is set
+__attribute__((target("sse2")))
+static const char *findStructuralSse2(const char *pos, const char *end)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i open = _mm_set1_epi8('{');
+    const __m128i close = _mm_set1_epi8('}');
+    const __m128i fold = _mm_set1_epi8(0x20);
+    while (end - pos >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+        __m128i folded = _mm_or_si128(chunk, fold);
+        __m128i found = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                     _mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)));
+        int mask = _mm_movemask_epi8(found);
+        if (mask)
+            return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+    return findStructuralScalar(pos, end);
+}
+
+__attribute__((target("sse2")))
+static const char *findQuoteOrEscapeSse2(const char *pos, const char *end)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i escape = _mm_set1_epi8('\\');
+    while (end - pos >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, escape)));
+        if (mask)
+            return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+    return findQuoteOrEscapeScalar(pos, end);
+}
+
+__attribute__((target("avx2")))
+static const char *findStructuralAvx2(const char *pos, const char *end)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i open = _mm256_set1_epi8('{');
+    const __m256i close = _mm256_set1_epi8('}');
+    const __m256i fold = _mm256_set1_epi8(0x20);
+    while (end - pos >= 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pos));
+        __m256i folded = _mm256_or_si256(chunk, fold);
+        __m256i found = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+                                        _mm256_or_si256(_mm256_cmpeq_epi8(folded, open), _mm256_cmpeq_epi8(folded, close)));
+        unsigned mask = _mm256_movemask_epi8(found);
+        if (mask)
+            return pos + __builtin_ctz(mask);
+        pos += 32;
+    }
+    return findStructuralSse2(pos, end);
+}
+
+__attribute__((target("avx2")))
+static const char *findQuoteOrEscapeAvx2(const char *pos, const char *end)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i escape = _mm256_set1_epi8('\\');
+    while (end - pos >= 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pos));
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+                                                             _mm256_cmpeq_epi8(chunk, escape)));
+        if (mask)
+            return pos + __builtin_ctz(mask);
+        pos += 32;
+    }
+    return findQuoteOrEscapeSse2(pos, end);
+}
+#endif
+
+struct ScannerImplementation
+{
+    ScannerImplementation()
+        : name("scalar")
+        , find_structural(findStructuralScalar)
+        , find_quote_or_escape(findQuoteOrEscapeScalar)
+    {
+#ifdef JSON_SCANNER_X86
+        const char *requested = getenv("JSONMOD_SCANNER");
+        std::string wanted = requested ? requested : "avx2";
+        __builtin_cpu_init();
+        if (wanted == "avx2" && __builtin_cpu_supports("avx2")) {
+            name = "avx2";
+            find_structural = findStructuralAvx2;
+            find_quote_or_escape = findQuoteOrEscapeAvx2;
+        } else if (wanted != "scalar" && __builtin_cpu_supports("sse2")) {
+            name = "sse2";
+            find_structural = findStructuralSse2;
+            find_quote_or_escape = findQuoteOrEscapeSse2;
+        }
+#endif
+    }
+    const char *name;
+    FindFunction find_structural;
+    FindFunction find_quote_or_escape;
+};
+
+static const ScannerImplementation scanner;
+
+const char *JsonScanner::implementation()
+{
+    return scanner.name;
+}
+
+const char *JsonScanner::skipString(const char *pos, const char *end)
+{
+    while (pos < end) {
+        pos = scanner.find_quote_or_escape(pos, end);
+        if (pos == end)
+            return nullptr;
+        if (*pos == '"')
+            return pos + 1;
+        pos += 2;
+    }
+    return nullptr;
+}
+
+const char *JsonScanner::skipContainer(const char *pos, const char *end)
+{
+    int depth = 1;
+    while (pos < end) {
+        pos = scanner.find_structural(pos, end);
+        if (pos == end)
+            return nullptr;
+        char c = *pos++;
+        if (c == '"') {
+            pos = skipString(pos, end);
+            if (!pos)
+                return nullptr;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (--depth == 0) {
+            return pos;
+        }
+    }
+    return nullptr;
+}
+
+static inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static const char *skipSpace(const char *pos, const char *end)
+{
+    while (pos < end && isSpace(*pos))
+        pos++;
+    return pos;
+}
+
+// Returns the end of the value starting at pos
+static const char *skipValue(const char *pos, const char *end)
+{
+    if (pos == end)
+        return nullptr;
+    switch (*pos) {
+    case '"':
+        return JsonScanner::skipString(pos + 1, end);
+    case '{':
+    case '[':
+        return JsonScanner::skipContainer(pos + 1, end);
+    case '}':
+    case ']':
+    case ',':
+    case ':':
+        return nullptr;
+    default:
+        while (pos < end && !isSpace(*pos) && *pos != ',' && *pos != '}' && *pos != ']')
+            pos++;
+        return pos;
+    }
+}
+
+class Pruner
+{
+public:
+    Pruner(const char *end, const std::vector<std::string> &property, bool print_only_name, std::string &pruned)
+        : m_end(end)
+        , m_property(property)
+        , m_print_only_name(print_only_name)
+        , m_pruned(pruned)
+    { }
+
+    // pos points past the opening bracket of an object whose members are
+    // matched against m_property[depth].
+    //
+    // After a scalar matched the last part of the property JsonStreamer
+    // only matches again once the next object or array at that depth has
+    // ended, so that one is kept. Objects are the only values looked into,
+    // for anything else on the way the input is tokenized
+    const char *pruneObject(const char *pos, size_t depth)
+    {
+        m_pruned += '{';
+        bool first = true;
+        bool keep_containers = false;
+        while (true) {
+            while (pos < m_end && (isSpace(*pos) || *pos == ','))
+                pos++;
+            if (pos == m_end)
+                return nullptr;
+            if (*pos == '}') {
+                m_pruned += '}';
+                return pos + 1;
+            }
+
+            const char *name_start = pos;
+            const char *name_end;
+            const char *name;
+            size_t name_size;
+            if (*pos == '"') {
+                name_end = JsonScanner::skipString(pos + 1, m_end);
+                if (!name_end)
+                    return nullptr;
+                name = name_start + 1;
+                name_size = name_end - name_start - 2;
+            } else {
+                name_end = pos;
+                while (name_end < m_end && !isSpace(*name_end) && *name_end != ':'
+                       && *name_end != '{' && *name_end != '}' && *name_end != '"' && *name_end != ',') {
+                    name_end++;
+                }
+                name = name_start;
+                name_size = name_end - name_start;
+                if (!name_size)
+                    return nullptr;
+            }
+            pos = skipSpace(name_end, m_end);
+            if (pos == m_end || *pos != ':')
+                return nullptr;
+            const char *value = skipSpace(pos + 1, m_end);
+            if (value == m_end)
+                return nullptr;
+
+            bool container = *value == '{' || *value == '[';
+            bool match = matches(name, name_size, depth);
+            bool last = depth + 1 == m_property.size();
+            if (match && !last && *value != '{')
+                return nullptr;
+            if (match || (keep_containers && container)) {
+                if (!first)
+                    m_pruned += ',';
+                first = false;
+                m_pruned.append(name_start, name_end - name_start);
+                m_pruned += ':';
+            }
+
+            if (match && !last) {
+                pos = pruneObject(value + 1, depth + 1);
+                if (!pos)
+                    return nullptr;
+                keep_containers = false;
+                continue;
+            }
+
+            pos = skipValue(value, m_end);
+            if (!pos)
+                return nullptr;
+            if (!match && !(keep_containers && container))
+                continue;
+
+            if (match && m_print_only_name && container)
+                m_pruned += *value == '{' ? "{}" : "[]";
+            else
+                m_pruned.append(value, pos - value);
+            keep_containers = !container;
+        }
+    }
+
+private:
+    bool matches(const char *name, size_t size, size_t depth) const
+    {
+        if (depth >= m_property.size())
+            return false;
+        const std::string &property = m_property[depth];
+        if (property == "%{*}")
+            return true;
+        return property.size() == size && memcmp(property.c_str(), name, size) == 0;
+    }
+
+    const char *m_end;
+    const std::vector<std::string> &m_property;
+    bool m_print_only_name;
+    std::string &m_pruned;
+};
+
+bool JsonScanner::prune(const char *data, size_t size, const std::vector<std::string> &property,
+                        bool print_only_name, std::string &pruned)
+{
+    const char *end = data + size;
+    const char *pos = skipSpace(data, end);
+    if (pos == end || *pos != '{' || property.empty())
+        return false;
+
+    Pruner pruner(end, property, print_only_name, pruned);
+    pos = pruner.pruneObject(pos + 1, 0);
+    if (!pos)
+        return false;
+    return skipSpace(pos, end) == end;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright © 2013 Jørgen Lind
+
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+*/
+#ifndef JSON_SCANNER_H
+#define JSON_SCANNER_H
+
+#include <string>
+#include <vector>
+
+// Moves over json without tokenizing it, looking only at quotes and
+// brackets. The search for them uses AVX2 or SSE2 when the cpu has them.
+// Set JSONMOD_SCANNER to scalar, sse2 or avx2 to choose the implementation.
+class JsonScanner
+{
+public:
+    // pos points past the opening quote. Returns the position past the
+    // closing quote, or nullptr if the string does not end
+    static const char *skipString(const char *pos, const char *end);
+    // pos points past the opening bracket. Returns the position past the
+    // matching closing bracket, or nullptr if there is none
+    static const char *skipContainer(const char *pos, const char *end);
+
+    // Copies the members of an object that can match property to pruned,
+    // and leaves out all others. Matching values are copied as they are,
+    // with print_only_name objects and arrays are copied empty. Returns
+    // false if the input is not an object the scanner understands, then
+    // the input has to be tokenized instead
+    static bool prune(const char *data, size_t size, const std::vector<std::string> &property,
+                      bool print_only_name, std::string &pruned);
+
+    static const char *implementation();
+};
+
+#endif //JSON_SCANNER_H
@@ -21,14 +21,20 @@
 */
 #include "json_streamer.h"
 
+#include "json_scanner.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <errno.h>
 #include <string.h>
 
+static bool NO_SKIP = getenv("JSONMOD_NO_SKIP") != 0;
+
 JsonStreamer::JsonStreamer(const Configuration &config)
     : m_config(config)
     , m_error(false)
@@ -110,158 +116,194 @@ void JsonStreamer::requestFlushOutBuffer(JT::Serializer *serializer)
 
 void JsonStreamer::stream()
 {
-    char in_buffer[4096];
     char out_buffer[4096];
     m_serializer.appendBuffer(out_buffer, sizeof out_buffer);
-    ssize_t bytes_read;
-    std::vector<bool> m_found_on_depth;
-    while((bytes_read = read(m_input_file, in_buffer, 4096)) > 0) {
-        m_tokenizer.addData(in_buffer,bytes_read, true);
-        JT::Token token;
-        JT::Error tokenizer_error;
-        while ((tokenizer_error = m_tokenizer.nextToken(&token)) == JT::Error::NoError) {
-            bool print_token = false;
-            bool finished_printing_subtree = false;
-            if (!m_print_subtree && m_current_depth - 1 == m_last_matching_depth) {
-                switch (token.name_type) {
-                    case JT::Token::String:
-                        token.name.data++;
-                        token.name.size -= 2;
-                    case JT::Token::Ascii:
-                        if (matchAtDepth(token.name)) {
-                            m_last_matching_depth++;
-                            if (m_last_matching_depth == m_property.size() - 1) {
-                                print_token = true;
-                                if (m_config.hasValue()) {
-                                    token.value.data = m_config.value().c_str();
-                                    token.value.size = m_config.value().size();
-                                } else if (!m_config.createObject() && !m_config.printOnlyName()) {
-                                    token.name.data = "";
-                                    token.name.size = 0;
-                                    token.name_type = JT::Token::Ascii;
-                                    if (token.value_type == JT::Token::String) {
-                                        token.value_type = JT::Token::Ascii;
-                                        if (*token.value.data == '"') {
-                                            token.value.data++;
-                                            token.value.size -= 2;
-                                        }
+    ssize_t bytes_read = 0;
+    std::string pruned;
+    if (pruneInput(pruned)) {
+        if (streamData(pruned.c_str(), pruned.size(), false) == Abort)
+            return;
+    } else {
+        char in_buffer[4096];
+        while((bytes_read = read(m_input_file, in_buffer, 4096)) > 0) {
+            StreamResult result = streamData(in_buffer, bytes_read, true);
+            if (result == Abort)
+                return;
+            if (result == Stop)
+                break;
+        }
+    }
+    auto unflushed_out_buffers = m_serializer.buffers();
+    for (auto it = unflushed_out_buffers.begin(); it != unflushed_out_buffers.end(); ++it) {
+        writeOutBuffer(*it);
+    }
+    char new_line[] = "\n";
+    write(m_output_file, new_line, sizeof new_line - 1);
+    if (bytes_read < 0) {
+        fprintf(stderr, "Error while reading input %s\n", strerror(errno));
+        m_error = true;
+    }
+}
+
+JsonStreamer::StreamResult JsonStreamer::streamData(const char *data, size_t size, bool copy)
+{
+    m_tokenizer.addData(data, size, copy);
+    JT::Token token;
+    JT::Error tokenizer_error;
+    while ((tokenizer_error = m_tokenizer.nextToken(&token)) == JT::Error::NoError) {
+        bool print_token = false;
+        bool finished_printing_subtree = false;
+        if (!m_print_subtree && m_current_depth - 1 == m_last_matching_depth) {
+            switch (token.name_type) {
+                case JT::Token::String:
+                    token.name.data++;
+                    token.name.size -= 2;
+                case JT::Token::Ascii:
+                    if (matchAtDepth(token.name)) {
+                        m_last_matching_depth++;
+                        if (m_last_matching_depth == m_property.size() - 1) {
+                            print_token = true;
+                            if (m_config.hasValue()) {
+                                token.value.data = m_config.value().c_str();
+                                token.value.size = m_config.value().size();
+                            } else if (!m_config.createObject() && !m_config.printOnlyName()) {
+                                token.name.data = "";
+                                token.name.size = 0;
+                                token.name_type = JT::Token::Ascii;
+                                if (token.value_type == JT::Token::String) {
+                                    token.value_type = JT::Token::Ascii;
+                                    if (*token.value.data == '"') {
+                                        token.value.data++;
+                                        token.value.size -= 2;
                                     }
                                 }
                             }
-                            m_found_on_depth.back() = true;
                         }
-                        break;
-                    default:
-                        fprintf(stderr, "found invalid unrecognized type\n");
-                        tokenizer_error = JT::Error::InvalidToken;
-                        break;
+                        m_found_on_depth.back() = true;
+                    }
+                    break;
+                default:
+                    fprintf(stderr, "found invalid unrecognized type\n");
+                    tokenizer_error = JT::Error::InvalidToken;
+                    break;
 
-                }
             }
-            switch(token.value_type) {
-                case JT::Token::ObjectStart:
-                case JT::Token::ArrayStart:
-                    m_current_depth++;
-                    m_found_on_depth.push_back(false);
-                    if (print_token && !m_config.createObject() && !m_config.printOnlyName()) {
-                        if (m_config.hasValue()) {
-                            fprintf(stderr, "Its not possible to change the value of and object or array\n");
-                            m_error = true;
-                            return;
-                            break;
-                        }
-                        m_print_subtree = true;
-                        setStreamerOptions(!m_config.prettyPrint());
+        }
+        switch(token.value_type) {
+            case JT::Token::ObjectStart:
+            case JT::Token::ArrayStart:
+                m_current_depth++;
+                m_found_on_depth.push_back(false);
+                if (print_token && !m_config.createObject() && !m_config.printOnlyName()) {
+                    if (m_config.hasValue()) {
+                        fprintf(stderr, "Its not possible to change the value of and object or array\n");
+                        m_error = true;
+                        return Abort;
                     }
-                    break;
-                case JT::Token::ObjectEnd:
-                case JT::Token::ArrayEnd:
-                    if (m_last_matching_depth == m_current_depth - 1
-                            && m_found_on_depth.size() && !m_found_on_depth.back()) {
-                        if (m_property.size() -1 == m_current_depth && m_config.hasValue()) {
+                    m_print_subtree = true;
+                    setStreamerOptions(!m_config.prettyPrint());
+                }
+                break;
+            case JT::Token::ObjectEnd:
+            case JT::Token::ArrayEnd:
+                if (m_last_matching_depth == m_current_depth - 1
+                        && m_found_on_depth.size() && !m_found_on_depth.back()) {
+                    if (m_property.size() -1 == m_current_depth && m_config.hasValue()) {
+                        JT::Token new_token;
+                        new_token.name_type = JT::Token::String;
+                        new_token.name.data = m_property.back().c_str();
+                        new_token.name.size = m_property.back().size();
+                        new_token.value_type = JT::Token::String;
+                        new_token.value.data = m_config.value().c_str();
+                        new_token.value.size = m_config.value().size();
+                        m_serializer.write(new_token);
+                    } else if (m_config.createObject()) {
+                        for (size_t i = m_current_depth; i < m_property.size(); i++) {
                             JT::Token new_token;
                             new_token.name_type = JT::Token::String;
-                            new_token.name.data = m_property.back().c_str();
-                            new_token.name.size = m_property.back().size();
-                            new_token.value_type = JT::Token::String;
-                            new_token.value.data = m_config.value().c_str();
-                            new_token.value.size = m_config.value().size();
+                            new_token.name.data = m_property[i].c_str();
+                            new_token.name.size = m_property[i].size();
+                            new_token.value_type = JT::Token::ObjectStart;
+                            new_token.value.data = "{";
+                            new_token.value.size = 1;
+                            m_serializer.write(new_token);
+                        }
+                        for (size_t i = m_property.size(); i > m_current_depth; i--) {
+                            JT::Token new_token;
+                            new_token.name_type = JT::Token::Ascii;
+                            new_token.name.data = "";
+                            new_token.name.size = 0;
+                            new_token.value_type = JT::Token::ObjectEnd;
+                            new_token.value.data = "}";
+                            new_token.value.size = 1;
                             m_serializer.write(new_token);
-                        } else if (m_config.createObject()) {
-                            for (size_t i = m_current_depth; i < m_property.size(); i++) {
-                                JT::Token new_token;
-                                new_token.name_type = JT::Token::String;
-                                new_token.name.data = m_property[i].c_str();
-                                new_token.name.size = m_property[i].size();
-                                new_token.value_type = JT::Token::ObjectStart;
-                                new_token.value.data = "{";
-                                new_token.value.size = 1;
-                                m_serializer.write(new_token);
-                            }
-                            for (size_t i = m_property.size(); i > m_current_depth; i--) {
-                                JT::Token new_token;
-                                new_token.name_type = JT::Token::Ascii;
-                                new_token.name.data = "";
-                                new_token.name.size = 0;
-                                new_token.value_type = JT::Token::ObjectEnd;
-                                new_token.value.data = "}";
-                                new_token.value.size = 1;
-                                m_serializer.write(new_token);
-                            }
                         }
                     }
-
-                    if (m_print_subtree && m_last_matching_depth == m_current_depth - 1) {
-                        finished_printing_subtree = true;
-                    }
-                    if (m_current_depth - 1 == m_last_matching_depth) {
-                        m_last_matching_depth--;
-                    } else if (m_current_depth == m_last_matching_depth && m_found_on_depth.back()) {
-                        m_last_matching_depth-=2;
-                    }
-
-                    m_found_on_depth.pop_back();
-                    m_current_depth--;
-                    break;
-                default:
-                    break;
-            }
-
-            if (m_config.printOnlyName() && print_token) {
-                size_t written = write(m_output_file, token.name.data, token.name.size);
-                written += write(m_output_file, " ", 1);
-                if (written < token.name.size + 1) {
-                    fprintf(stderr, "Error while writing to outbuffer :%s\n", strerror(errno));
-                    m_error = true;
                 }
-            } else if (print_token || m_print_subtree || m_config.hasValue() || m_config.createObject()) {
-                m_serializer.write(token);
-            }
 
-            if (finished_printing_subtree) {
-                m_print_subtree = false;
-                print_token = true;
-                setStreamerOptions(m_config.compactPrint());
-            }
+                if (m_print_subtree && m_last_matching_depth == m_current_depth - 1) {
+                    finished_printing_subtree = true;
+                }
+                if (m_current_depth - 1 == m_last_matching_depth) {
+                    m_last_matching_depth--;
+                } else if (m_current_depth == m_last_matching_depth && m_found_on_depth.back()) {
+                    m_last_matching_depth-=2;
+                }
 
+                m_found_on_depth.pop_back();
+                m_current_depth--;
+                break;
+            default:
+                break;
+        }
 
+        if (m_config.printOnlyName() && print_token) {
+            size_t written = write(m_output_file, token.name.data, token.name.size);
+            written += write(m_output_file, " ", 1);
+            if (written < token.name.size + 1) {
+                fprintf(stderr, "Error while writing to outbuffer :%s\n", strerror(errno));
+                m_error = true;
+            }
+        } else if (print_token || m_print_subtree || m_config.hasValue() || m_config.createObject()) {
+            m_serializer.write(token);
         }
-        if (tokenizer_error != JT::Error::NeedMoreData
-                && tokenizer_error != JT::Error::NoError) {
-            fprintf(stderr, "Error while parsing json. %d\n", tokenizer_error);
-            break;
+
+        if (finished_printing_subtree) {
+            m_print_subtree = false;
+            print_token = true;
+            setStreamerOptions(m_config.compactPrint());
         }
     }
-    auto unflushed_out_buffers = m_serializer.buffers();
-    for (auto it = unflushed_out_buffers.begin(); it != unflushed_out_buffers.end(); ++it) {
-        writeOutBuffer(*it);
+    if (tokenizer_error != JT::Error::NeedMoreData
+            && tokenizer_error != JT::Error::NoError) {
+        fprintf(stderr, "Error while parsing json. %d\n", tokenizer_error);
+        return Stop;
     }
-    char new_line[] = "\n";
-    write(m_output_file, new_line, sizeof new_line - 1);
-    if (bytes_read < 0) {
-        fprintf(stderr, "Error while reading input %s\n", strerror(errno));
-        m_error = true;
+    return Continue;
+}
+
+// A query that only prints does not have to tokenize the parts of the file
+// that can not match. They are skipped with JsonScanner and only what is
+// left is streamed. Anything that writes the file back streams all of it
+bool JsonStreamer::pruneInput(std::string &pruned) const
+{
+    if (NO_SKIP || !m_config.hasInputFile() || !m_config.hasProperty() || m_config.strict()
+            || m_config.hasValue() || m_config.createObject() || m_config.hasInlineSet()) {
+        return false;
     }
+
+    struct stat input_stat;
+    if (fstat(m_input_file, &input_stat) || !S_ISREG(input_stat.st_mode) || input_stat.st_size == 0)
+        return false;
+
+    size_t size = input_stat.st_size;
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, m_input_file, 0);
+    if (data == MAP_FAILED)
+        return false;
+    bool pruned_input = JsonScanner::prune(static_cast<const char *>(data), size, m_property,
+                                           m_config.printOnlyName(), pruned);
+    munmap(data, size);
+    return pruned_input;
 }
 
 void JsonStreamer::createPropertyVector()
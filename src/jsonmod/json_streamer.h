@@ -45,6 +45,13 @@ private:
         Matching,
         NoMatch
     };
+    enum StreamResult {
+        Continue,
+        Stop,
+        Abort
+    };
+    StreamResult streamData(const char *data, size_t size, bool copy);
+    bool pruneInput(std::string &pruned) const;
     void createPropertyVector();
     bool matchAtDepth(const JT::Data &data) const;
     void writeOutBuffer(const JT::SerializerBuffer &buffer);
@@ -61,6 +68,7 @@ private:
     std::string m_tmp_output;
 
     std::vector<std::string> m_property;
+    std::vector<bool> m_found_on_depth;
 
     bool m_error;
     bool m_print_subtree;
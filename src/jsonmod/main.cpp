@@ -22,6 +22,7 @@
 #include "arg.h"
 #include "configuration.h"
 #include "json_streamer.h"
+#include "batch_streamer.h"
 
 #include <iostream>
 #include <vector>
@@ -39,7 +40,12 @@ enum optionIndex {
     CREATE_OBJ,
     ONLY_NAME,
     DELIMITER,
-    STRICT
+    STRICT,
+    GET,
+    SET,
+    CREATE,
+    BATCH,
+    SHELL
 };
 
 const option::Descriptor usage[] =
@@ -58,8 +64,17 @@ const option::Descriptor usage[] =
   {ONLY_NAME,     0, "n", "only-name",        option::Arg::None,         "  --only-name, -n\t Only print the name of the object."},
   {DELIMITER,     0, "d", "delimiter",        Arg::requiresValue,        "  --delimiter, -d\t Delimiter to use between objects nodes."},
   {STRICT,        0, "s", "strict",           option::Arg::None,         "  --strict    \t Use strict json parsing"},
+  {GET,           0, "" , "get",              Arg::requiresValue,        "  --get       \t Print the value of property. Can be given many times."},
+  {SET,           0, "" , "set",              Arg::requiresValue,        "  --set       \t Set property=value, creating missing objects. Can be\v"
+                                                                         "    given many times."},
+  {CREATE,        0, "" , "create",           Arg::requiresValue,        "  --create    \t Create object with path. Can be given many times."},
+  {BATCH,         0, "b", "batch",            Arg::requiresValue,        "  --batch, -b \t Read get, set and create operations from file, one per\v"
+                                                                         "    line, or from stdin if file is -."},
+  {SHELL,         0, "" , "shell",            option::Arg::None,         "  --shell     \t Print gets as name='value' lines for eval."},
   {UNKNOWN, 0,"" ,  ""   ,                    option::Arg::None,         "\nExamples:\n"
-                                                                         "  jsonmod -i -p \"foo\" -v 43, /some/file \n"},
+                                                                         "  jsonmod -i -p \"foo\" -v 43, /some/file \n"
+                                                                         "  eval $(jsonmod --shell --get scm.url --get scm.branch /some/file)\n"
+                                                                         "  jsonmod -i --set scm.branch=master --create env.post /some/file \n"},
   {0,0,0,0,0,0}
  };
 
@@ -137,6 +152,29 @@ int main(int argc, char **argv)
             case STRICT:
                 configuration.setStrict(true);
                 break;
+            case GET:
+                configuration.addOperation(Operation::Get, opt.arg);
+                break;
+            case SET: {
+                std::string property = opt.arg;
+                size_t equals = property.find('=');
+                if (equals == std::string::npos || equals == 0) {
+                    fprintf(stderr, "--set expects property=value\n");
+                    return 1;
+                }
+                configuration.addOperation(Operation::Set, property.substr(0, equals), property.substr(equals + 1));
+                break;
+            }
+            case CREATE:
+                configuration.addOperation(Operation::Create, opt.arg);
+                break;
+            case BATCH:
+                if (!configuration.addOperations(opt.arg))
+                    return 1;
+                break;
+            case SHELL:
+                configuration.setShellOutput(true);
+                break;
             case UNKNOWN:
                 fprintf(stderr, "UNKNOWN!");
                 // not possible because Arg::Unknown returns ARG_ILLEGAL
@@ -148,6 +186,13 @@ int main(int argc, char **argv)
     if (!configuration.sane()) {
         option::printUsage(std::cerr,usage);
         return 1;
+    } else if (configuration.batchMode()) {
+        BatchStreamer streamer(configuration);
+        if (streamer.error())
+            return 2;
+        streamer.stream();
+        if (streamer.error())
+            return 3;
     } else {
         JsonStreamer streamer(configuration);
         if (streamer.error())
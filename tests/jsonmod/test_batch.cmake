@@ -0,0 +1,159 @@
+if (NOT jsonmod_exec)
+    message(FATAL_ERROR "Variable jsonmod_exec not defined")
+endif (NOT jsonmod_exec)
+
+if (NOT input_file)
+    message(FATAL_ERROR "Variable input_file not defined")
+endif (NOT input_file)
+
+if (NOT test_name)
+    message(FATAL_ERROR "Variable test_name not defined")
+endif (NOT test_name)
+
+if (NOT batch_file)
+    message(FATAL_ERROR "Variable batch_file not defined")
+endif (NOT batch_file)
+
+if (NOT early_stop_file)
+    message(FATAL_ERROR "Variable early_stop_file not defined")
+endif (NOT early_stop_file)
+
+set(TEST_OUT ${test_name}.out)
+set(TEST_EXPECTED ${input_file}.expected)
+set(TEST_SHELL_OUT ${test_name}.shell.out)
+set(TEST_SHELL_EXPECTED ${input_file}.shell.expected)
+set(TEST_BATCH_OUT ${test_name}.batch.out)
+set(TEST_BATCH_STDIN_OUT ${test_name}.batch_stdin.out)
+set(TEST_BATCH_EXPECTED ${input_file}.batch.expected)
+set(TEST_INLINE_FILE ${test_name}.inline.json)
+set(TEST_EARLY_STOP_OUT ${test_name}.early_stop.out)
+set(TEST_EARLY_STOP_EXPECTED ${early_stop_file}.expected)
+
+execute_process(
+    COMMAND ${jsonmod_exec} --set qtjsbackend.scm.branch=new_branch --set qtjsbackend.new_property=new_value ${input_file}
+    OUTPUT_FILE ${TEST_OUT}
+)
+
+execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files ${TEST_OUT} ${TEST_EXPECTED}
+    RESULT_VARIABLE files_not_equal)
+
+if( files_not_equal )
+    message( FATAL_ERROR "Files are not equal" )
+endif( files_not_equal )
+
+execute_process(
+    COMMAND ${jsonmod_exec} --shell --get qtjsbackend.scm.branch --get qtjsbackend.no_install ${input_file}
+    OUTPUT_FILE ${TEST_SHELL_OUT}
+)
+
+execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files ${TEST_SHELL_OUT} ${TEST_SHELL_EXPECTED}
+    RESULT_VARIABLE shell_files_not_equal)
+
+if( shell_files_not_equal )
+    message( FATAL_ERROR "Shell output is not equal" )
+endif( shell_files_not_equal )
+
+# Sets, creates and gets from a batch file, the gets are printed after the
+# modified json
+execute_process(
+    COMMAND ${jsonmod_exec} --batch ${batch_file} ${input_file}
+    OUTPUT_FILE ${TEST_BATCH_OUT}
+    RESULT_VARIABLE batch_result
+)
+
+if( batch_result )
+    message( FATAL_ERROR "Batch from file failed with ${batch_result}" )
+endif( batch_result )
+
+execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files ${TEST_BATCH_OUT} ${TEST_BATCH_EXPECTED}
+    RESULT_VARIABLE batch_files_not_equal)
+
+if( batch_files_not_equal )
+    message( FATAL_ERROR "Batch output is not equal" )
+endif( batch_files_not_equal )
+
+execute_process(
+    COMMAND ${jsonmod_exec} --batch - ${input_file}
+    INPUT_FILE ${batch_file}
+    OUTPUT_FILE ${TEST_BATCH_STDIN_OUT}
+    RESULT_VARIABLE batch_stdin_result
+)
+
+if( batch_stdin_result )
+    message( FATAL_ERROR "Batch from stdin failed with ${batch_stdin_result}" )
+endif( batch_stdin_result )
+
+execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files ${TEST_BATCH_STDIN_OUT} ${TEST_BATCH_EXPECTED}
+    RESULT_VARIABLE batch_stdin_files_not_equal)
+
+if( batch_stdin_files_not_equal )
+    message( FATAL_ERROR "Batch output from stdin is not equal" )
+endif( batch_stdin_files_not_equal )
+
+# -i writes the result back to the file
+configure_file(${input_file} ${TEST_INLINE_FILE} COPYONLY)
+
+execute_process(
+    COMMAND ${jsonmod_exec} -i --set qtjsbackend.scm.branch=new_branch --set qtjsbackend.new_property=new_value ${TEST_INLINE_FILE}
+    RESULT_VARIABLE inline_result
+)
+
+if( inline_result )
+    message( FATAL_ERROR "Inline set failed with ${inline_result}" )
+endif( inline_result )
+
+execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files ${TEST_INLINE_FILE} ${TEST_EXPECTED}
+    RESULT_VARIABLE inline_files_not_equal)
+
+if( inline_files_not_equal )
+    message( FATAL_ERROR "Inline written file is not equal" )
+endif( inline_files_not_equal )
+
+# With only gets reading stops once they are answered, the file is broken
+# after the first read
+execute_process(
+    COMMAND ${jsonmod_exec} --shell --get qtjsbackend.scm.branch ${early_stop_file}
+    OUTPUT_FILE ${TEST_EARLY_STOP_OUT}
+    RESULT_VARIABLE early_stop_result
+)
+
+if( early_stop_result )
+    message( FATAL_ERROR "Get did not stop reading early, failed with ${early_stop_result}" )
+endif( early_stop_result )
+
+execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files ${TEST_EARLY_STOP_OUT} ${TEST_EARLY_STOP_EXPECTED}
+    RESULT_VARIABLE early_stop_files_not_equal)
+
+if( early_stop_files_not_equal )
+    message( FATAL_ERROR "Early stop output is not equal" )
+endif( early_stop_files_not_equal )
+
+# Batch operations can not be mixed with the single property options and
+# always need a property to set
+execute_process(
+    COMMAND ${jsonmod_exec} --create-object qtjsbackend.new_object --set qtjsbackend.scm.branch=new_branch ${input_file}
+    OUTPUT_QUIET
+    ERROR_QUIET
+    RESULT_VARIABLE create_object_result
+)
+
+if( NOT create_object_result )
+    message( FATAL_ERROR "--create-object was accepted together with --set" )
+endif( NOT create_object_result )
+
+execute_process(
+    COMMAND ${jsonmod_exec} --set =new_value ${input_file}
+    OUTPUT_QUIET
+    ERROR_QUIET
+    RESULT_VARIABLE empty_property_result
+)
+
+if( NOT empty_property_result )
+    message( FATAL_ERROR "--set without a property was accepted" )
+endif( NOT empty_property_result )
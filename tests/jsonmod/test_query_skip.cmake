@@ -0,0 +1,57 @@
+if (NOT jsonmod_exec)
+    message(FATAL_ERROR "Variable jsonmod_exec not defined")
+endif (NOT jsonmod_exec)
+
+if (NOT property)
+    message(FATAL_ERROR "Variable property not defined")
+endif (NOT property)
+
+if (NOT input_file)
+    message(FATAL_ERROR "Variable input_file not defined")
+endif (NOT input_file)
+
+if (NOT test_name)
+    message(FATAL_ERROR "Variable test_name not defined")
+endif (NOT test_name)
+
+# The query is answered by the tokenizer alone with JSONMOD_NO_SKIP set, that
+# output has to come out byte for byte from every scanner skipping the input
+set(QUERY_ARGS -p ${property})
+if (only_name)
+    list(APPEND QUERY_ARGS -n)
+endif (only_name)
+
+set(TEST_EXPECTED ${test_name}.no_skip.out)
+
+execute_process(
+    COMMAND ${CMAKE_COMMAND} -E env JSONMOD_NO_SKIP=1 ${jsonmod_exec} ${QUERY_ARGS} ${input_file}
+    OUTPUT_FILE ${TEST_EXPECTED}
+    RESULT_VARIABLE expected_result
+)
+
+file(READ ${TEST_EXPECTED} expected_output)
+if (expected_output STREQUAL "" OR expected_output STREQUAL "\n")
+    message(FATAL_ERROR "Query ${property} printed nothing")
+endif (expected_output STREQUAL "" OR expected_output STREQUAL "\n")
+
+foreach(scanner scalar sse2 avx2)
+    set(TEST_OUT ${test_name}.${scanner}.out)
+
+    execute_process(
+        COMMAND ${CMAKE_COMMAND} -E env JSONMOD_SCANNER=${scanner} ${jsonmod_exec} ${QUERY_ARGS} ${input_file}
+        OUTPUT_FILE ${TEST_OUT}
+        RESULT_VARIABLE result
+    )
+
+    if (NOT result STREQUAL expected_result)
+        message(FATAL_ERROR "Exit code ${result} with the ${scanner} scanner, ${expected_result} without skipping")
+    endif (NOT result STREQUAL expected_result)
+
+    execute_process(
+        COMMAND ${CMAKE_COMMAND} -E compare_files ${TEST_OUT} ${TEST_EXPECTED}
+        RESULT_VARIABLE files_not_equal)
+
+    if( files_not_equal )
+        message( FATAL_ERROR "Files are not equal with the ${scanner} scanner" )
+    endif( files_not_equal )
+endforeach(scanner)
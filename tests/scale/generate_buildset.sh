@@ -0,0 +1,118 @@
+#!/bin/bash
+
+# Generates a buildset of fake projects to test how build_shell scales,
+# without real sources or toolchains.
+#
+#    generate_buildset.sh [--projects n] [--sleep seconds] [--burn loops] dir
+#
+# dir/buildset holds the projects, with scm, env and depends_on like the
+# buildsets in examples/, and sub_repos for every 20th project. Every
+# project depends on the one at half its index, so independent projects
+# can be built concurrently. dir/src gets an empty source dir per project.
+# dir/build/build_shell/scripts gets configure, build and install scripts
+# for projects without a recognized build system. They loop --burn times
+# and sleep --sleep seconds, the default is to do neither, and add the
+# phase to dir/phases_run.
+
+projects=100
+sleep_seconds=0
+burn=0
+
+while [ $# -gt 1 ]; do
+    case $1 in
+        --projects) projects=$2; shift 2;;
+        --sleep) sleep_seconds=$2; shift 2;;
+        --burn) burn=$2; shift 2;;
+        *) echo "Unknown option $1" >&2; exit 1;;
+    esac
+done
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 [--projects n] [--sleep seconds] [--burn loops] dir" >&2
+    exit 1
+fi
+
+dir=$1
+scripts_dir=$dir/build/build_shell/scripts
+mkdir -p $dir/src $scripts_dir || exit 1
+
+
+{
+    echo "{"
+    for ((i = 0; i < projects; i++)); do
+        printf -v name "scale_%05d" $i
+        mkdir -p $dir/src/$name
+        echo "    \"$name\" : {"
+        echo "        \"scm\" : {"
+        echo "            \"type\" : \"regular_dir\","
+        echo "            \"url\" : \"git://git.example.org/$name\","
+        echo "            \"branch\" : \"master\","
+        echo "            \"remote\" : \"origin\","
+        if ((i % 20 == 0)); then
+            mkdir -p $dir/src/$name/tools/${name}_tools
+            echo "            \"remote_branch\" : \"master\","
+            echo "            \"sub_repos\" : ["
+            echo "                {"
+            echo "                    \"name\" : \"${name}_tools\","
+            echo "                    \"type\" : \"regular_dir\","
+            echo "                    \"url\" : \"git://git.example.org/${name}_tools\","
+            echo "                    \"branch\" : \"master\","
+            echo "                    \"remote\" : \"origin\","
+            echo "                    \"path\" : \"tools\""
+            echo "                }"
+            echo "            ]"
+        else
+            echo "            \"remote_branch\" : \"master\""
+        fi
+        echo "        },"
+        echo "        \"env\" : {"
+        echo "            \"local\" : {"
+        echo "                \"${name^^}_BUILDING\" : \"1\""
+        echo "            },"
+        echo "            \"post\" : {"
+        if ((i % 5 == 0)); then
+            echo "                \"ACLOCAL\" : {"
+            echo "                    \"value\" : \"aclocal -I \${install_path}/share/aclocal\","
+            echo "                    \"overwrite\" : true"
+            echo "                },"
+        fi
+        echo "                \"BS_VIM_SEARCH_PATH\" : {"
+        echo "                    \"value\" : \"\${project_src_path}/src/**\","
+        echo "                    \"seperator\" : \",\""
+        echo "                }"
+        echo "            }"
+        echo "        },"
+        if ((i > 0)); then
+            printf "        \"depends_on\" : \"scale_%05d\",\n" $((i / 2))
+        fi
+        echo "        \"scale_test\" : {"
+        echo "            \"sleep\" : \"$sleep_seconds\","
+        echo "            \"burn\" : \"$burn\""
+        echo "        },"
+        echo "        \"configure_args\" : \"--prefix=\${install_path} --with-sources=\${project_src_path}\""
+        if ((i + 1 < projects)); then
+            echo "    },"
+        else
+            echo "    }"
+        fi
+    done
+    echo "}"
+} > $dir/buildset
+
+for phase in configure build install; do
+    cat > $scripts_dir/${phase}_not_recognized <<SCRIPT
+#!/bin/bash
+
+echo $phase >> $(cd $dir && pwd)/phases_run
+SCRIPT
+    cat >> $scripts_dir/${phase}_not_recognized <<'SCRIPT'
+i=0
+while [ $i -lt ${BS_ARG_SCALE_TEST_BURN:-0} ]; do
+    i=$((i + 1))
+done
+if [ "${BS_ARG_SCALE_TEST_SLEEP:-0}" != "0" ]; then
+    sleep $BS_ARG_SCALE_TEST_SLEEP
+fi
+SCRIPT
+    chmod +x $scripts_dir/${phase}_not_recognized
+done
@@ -0,0 +1,67 @@
+if (NOT build_shell_exec)
+    message(FATAL_ERROR "Variable build_shell_exec not defined")
+endif (NOT build_shell_exec)
+
+if (NOT generator)
+    message(FATAL_ERROR "Variable generator not defined")
+endif (NOT generator)
+
+if (NOT work_dir)
+    message(FATAL_ERROR "Variable work_dir not defined")
+endif (NOT work_dir)
+
+if (NOT projects)
+    set(projects 200)
+endif (NOT projects)
+
+if (NOT jobs)
+    set(jobs 4)
+endif (NOT jobs)
+
+if (NOT max_overhead_ms)
+    set(max_overhead_ms 150)
+endif (NOT max_overhead_ms)
+
+file(REMOVE_RECURSE ${work_dir})
+
+execute_process(
+    COMMAND bash ${generator} --projects ${projects} ${work_dir}
+    RESULT_VARIABLE generate_failed)
+
+if (generate_failed)
+    message(FATAL_ERROR "Failed to generate buildset in ${work_dir}")
+endif (generate_failed)
+
+# The phase scripts do no work, so all of the time is spent by build_shell
+execute_process(COMMAND date +%s%N OUTPUT_VARIABLE start_ns OUTPUT_STRIP_TRAILING_WHITESPACE)
+
+execute_process(
+    COMMAND ${build_shell_exec} --buildset ${work_dir}/buildset --src-dir ${work_dir}/src
+            --build-dir ${work_dir}/build --no-register --jobs ${jobs} build
+    OUTPUT_FILE ${work_dir}/build.out
+    ERROR_FILE ${work_dir}/build.err
+    RESULT_VARIABLE build_failed)
+
+execute_process(COMMAND date +%s%N OUTPUT_VARIABLE end_ns OUTPUT_STRIP_TRAILING_WHITESPACE)
+
+if (build_failed)
+    file(READ ${work_dir}/build.err build_errors)
+    message(FATAL_ERROR "Build of ${projects} projects failed:\n${build_errors}")
+endif (build_failed)
+
+file(STRINGS ${work_dir}/phases_run phases_run)
+list(LENGTH phases_run phases_run_count)
+math(EXPR phases_expected "${projects} * 3")
+if (NOT phases_run_count EQUAL phases_expected)
+    message(FATAL_ERROR "${phases_run_count} of ${phases_expected} phase scripts ran")
+endif (NOT phases_run_count EQUAL phases_expected)
+
+math(EXPR overhead_us "(${end_ns} - ${start_ns}) / 1000 / ${projects}")
+math(EXPR max_overhead_us "${max_overhead_ms} * 1000")
+message(STATUS "Orchestration overhead per project: ${overhead_us} us, ${projects} projects, ${jobs} jobs")
+
+if (overhead_us GREATER max_overhead_us)
+    message(FATAL_ERROR "Overhead per project ${overhead_us} us is more than ${max_overhead_ms} ms")
+endif (overhead_us GREATER max_overhead_us)
+
+file(REMOVE_RECURSE ${work_dir})